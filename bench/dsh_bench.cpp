@@ -0,0 +1,324 @@
+// Measures dsh builtins against the coreutils programs they stand in for.
+//
+//     dsh_bench [--sizes 1,8,32] [--repeat 3] [--dir /tmp] [--json]
+//
+// For every dataset size (MiB of text) it generates a text file and a file
+// tree, runs each builtin in-process through the command registry and the
+// matching system tool through posix_spawn, both with stdout on /dev/null,
+// and reports the best of --repeat runs as MB/s and lines/s (entries/s for
+// the tree walkers). --json prints one object per measurement instead.
+#include "dsh.h"
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <sstream>
+
+namespace
+{
+struct Dataset
+{
+    std::string name;
+    std::string textFile;
+    std::string tree;
+    std::string flatDir;
+    uint64_t bytes = 0;
+    uint64_t lines = 0;
+    uint64_t treeEntries = 0;
+    uint64_t flatEntries = 0;
+};
+
+struct Case
+{
+    const char *tool;
+    bool walksTree;
+    bool wrapsSystem; // the builtin only runs the system tool through /bin/sh
+    std::function<std::vector<std::string>(const Dataset &)> builtin;
+    std::function<std::vector<std::string>(const Dataset &)> system;
+};
+
+struct Result
+{
+    std::string tool, dataset, impl, command;
+    double seconds;
+    uint64_t bytes, units;
+    bool walksTree, wrapsSystem;
+};
+
+// The command line without the generated paths, so the report shows which
+// flags each side was run with.
+std::string invocation(const std::vector<std::string> &args, const std::string &work)
+{
+    std::string line;
+    for (auto &arg : args)
+    {
+        if (arg.compare(0, work.size(), work) == 0)
+            continue;
+        line += (line.empty() ? "" : " ") + arg;
+    }
+    return line;
+}
+
+double monotonicSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Deterministic text: words from a fixed vocabulary, with "needle" on every
+// hundredth line so grep has something to print.
+void generateText(Dataset &data, uint64_t targetBytes)
+{
+    static const char *words[] = {"alpha", "bravo",  "charlie", "delta",  "echo",    "foxtrot", "golf",
+                                  "hotel", "india",  "juliet",  "kilo",   "lima",    "mike",    "november",
+                                  "oscar", "papa",   "quebec",  "romeo",  "sierra",  "tango",   "uniform",
+                                  "victor", "whiskey", "xray",  "yankee", "zulu",    "0451",    "1984"};
+    const size_t wordCount = sizeof(words) / sizeof(words[0]);
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    auto next = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+    FILE *out = fopen(data.textFile.c_str(), "w");
+    std::string line;
+    while (data.bytes < targetBytes)
+    {
+        line.clear();
+        size_t count = 4 + next() % 10;
+        for (size_t i = 0; i < count; ++i)
+        {
+            line += i ? " " : "";
+            line += words[next() % wordCount];
+        }
+        if (data.lines % 100 == 0)
+            line += " needle";
+        line += '\n';
+        fwrite(line.data(), 1, line.size(), out);
+        data.bytes += line.size();
+        ++data.lines;
+    }
+    fclose(out);
+}
+
+void generateTree(Dataset &data, uint64_t files)
+{
+    mkdir(data.tree.c_str(), 0755);
+    mkdir(data.flatDir.c_str(), 0755);
+    const uint64_t perDir = 100;
+    for (uint64_t i = 0; i < files; ++i)
+    {
+        std::string dir = data.tree + "/d" + std::to_string(i / perDir);
+        if (i % perDir == 0)
+        {
+            mkdir(dir.c_str(), 0755);
+            ++data.treeEntries;
+        }
+        std::string name = dir + "/file" + std::to_string(i) + (i % 10 == 0 ? ".log" : ".txt");
+        int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0)
+        {
+            std::string body(64 + i % 4096, 'x');
+            if (write(fd, body.data(), body.size()) < 0)
+                perror(name.c_str());
+            close(fd);
+        }
+        ++data.treeEntries;
+        std::string flat = data.flatDir + "/entry" + std::to_string(i);
+        fd = open(flat.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0)
+            close(fd);
+        ++data.flatEntries;
+    }
+}
+
+// Runs `body` with fd 1 (and therefore std::cout, stdio and any children)
+// pointed at /dev/null.
+double timeSilenced(const std::function<void()> &body)
+{
+    std::cout.flush();
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+    double start = monotonicSeconds();
+    body();
+    std::cout.flush();
+    fflush(stdout);
+    double elapsed = monotonicSeconds() - start;
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    return elapsed;
+}
+
+void runSystemTool(const std::vector<std::string> &args)
+{
+    std::vector<char *> argv;
+    for (auto &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+    pid_t pid;
+    if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) == 0)
+        waitpid(pid, nullptr, 0);
+}
+
+void removeTree(const std::string &path)
+{
+    runSystemTool({"rm", "-rf", path});
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    useBufferedOutput();
+    std::vector<uint64_t> sizes = {1, 8, 32};
+    int repeat = 3;
+    bool json = false;
+    std::string base = "/tmp";
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--sizes" && i + 1 < argc)
+        {
+            sizes.clear();
+            std::stringstream list(argv[++i]);
+            std::string size;
+            while (std::getline(list, size, ','))
+                sizes.push_back(std::stoull(size));
+        }
+        else if (arg == "--repeat" && i + 1 < argc)
+            repeat = std::max(1, atoi(argv[++i]));
+        else if (arg == "--dir" && i + 1 < argc)
+            base = argv[++i];
+        else if (arg == "--json")
+            json = true;
+        else
+        {
+            std::cerr << "Usage: dsh_bench [--sizes 1,8,32] [--repeat N] [--dir path] [--json]\n";
+            return 2;
+        }
+    }
+
+    std::string workTemplate = base + "/dsh_bench.XXXXXX";
+    std::vector<char> workDir(workTemplate.begin(), workTemplate.end());
+    workDir.push_back('\0');
+    if (!mkdtemp(workDir.data()))
+    {
+        perror("dsh_bench: mkdtemp");
+        return 1;
+    }
+    std::string work = workDir.data();
+
+    CommandRegistry registry;
+    registerBuiltinCommands(registry);
+
+    // wc, sort, uniq, find and du are still system() wrappers (du literally
+    // runs `du -sh`), so their rows measure /bin/sh startup, not an
+    // implementation; they are labelled as such. Builtin ls lists every
+    // entry, dotfiles included, in directory order, like ls -f.
+    const std::vector<Case> cases = {
+        {"cat", false, false, [](const Dataset &d) { return std::vector<std::string>{"cat", d.textFile}; },
+         [](const Dataset &d) { return std::vector<std::string>{"cat", d.textFile}; }},
+        {"grep", false, false, [](const Dataset &d) { return std::vector<std::string>{"grep", "needle", d.textFile}; },
+         [](const Dataset &d) { return std::vector<std::string>{"grep", "-F", "needle", d.textFile}; }},
+        {"wc", false, true, [](const Dataset &d) { return std::vector<std::string>{"wc", d.textFile}; },
+         [](const Dataset &d) { return std::vector<std::string>{"wc", d.textFile}; }},
+        {"sort", false, true, [](const Dataset &d) { return std::vector<std::string>{"sort", d.textFile}; },
+         [](const Dataset &d) { return std::vector<std::string>{"sort", d.textFile}; }},
+        {"uniq", false, true, [](const Dataset &d) { return std::vector<std::string>{"uniq", d.textFile}; },
+         [](const Dataset &d) { return std::vector<std::string>{"uniq", d.textFile}; }},
+        {"find", true, true, [](const Dataset &d) { return std::vector<std::string>{"find", d.tree, "*.log"}; },
+         [](const Dataset &d) { return std::vector<std::string>{"find", d.tree, "-name", "*.log"}; }},
+        {"du", true, true, [](const Dataset &d) { return std::vector<std::string>{"du", d.tree}; },
+         [](const Dataset &d) { return std::vector<std::string>{"du", "-sh", d.tree}; }},
+        {"ls", true, false, [](const Dataset &d) { return std::vector<std::string>{"ls", d.flatDir}; },
+         [](const Dataset &d) { return std::vector<std::string>{"ls", "-f", d.flatDir}; }},
+    };
+
+    std::vector<Result> results;
+    for (uint64_t size : sizes)
+    {
+        Dataset data;
+        data.name = std::to_string(size) + "MiB";
+        data.textFile = work + "/text" + std::to_string(size) + ".txt";
+        data.tree = work + "/tree" + std::to_string(size);
+        data.flatDir = work + "/flat" + std::to_string(size);
+        generateText(data, size << 20);
+        generateTree(data, std::min<uint64_t>(size * 1000, 100000));
+
+        for (const Case &c : cases)
+        {
+            Command *builtin = registry.getCommand(c.tool);
+            std::vector<std::string> builtinArgs = c.builtin(data), systemArgs = c.system(data);
+            double bestBuiltin = 1e300, bestSystem = 1e300;
+            for (int run = 0; run < repeat; ++run)
+            {
+                bestBuiltin = std::min(bestBuiltin, timeSilenced([&]() { builtin->execute(builtinArgs); }));
+                bestSystem = std::min(bestSystem, timeSilenced([&]() { runSystemTool(systemArgs); }));
+            }
+            uint64_t units = c.walksTree ? (c.tool == std::string("ls") ? data.flatEntries : data.treeEntries) : data.lines;
+            uint64_t bytes = c.walksTree ? 0 : data.bytes;
+            results.push_back({c.tool, data.name, c.wrapsSystem ? "dsh (sh)" : "dsh", invocation(builtinArgs, work),
+                               bestBuiltin, bytes, units, c.walksTree, c.wrapsSystem});
+            results.push_back({c.tool, data.name, "coreutils", invocation(systemArgs, work), bestSystem, bytes, units,
+                               c.walksTree, false});
+        }
+        removeTree(data.textFile);
+        removeTree(data.tree);
+        removeTree(data.flatDir);
+    }
+    removeTree(work);
+
+    if (json)
+    {
+        std::cout << "[";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result &r = results[i];
+            char line[512];
+            snprintf(line, sizeof(line),
+                     "%s\n{\"tool\":\"%s\",\"dataset\":\"%s\",\"impl\":\"%s\",\"command\":\"%s\","
+                     "\"system_wrapper\":%s,\"seconds\":%.6f,\"bytes\":%llu,\"%s\":%llu,\"mb_per_s\":%.2f,\"%s_per_s\":%.0f}",
+                     i ? "," : "", r.tool.c_str(), r.dataset.c_str(), r.impl.c_str(), r.command.c_str(),
+                     r.wrapsSystem ? "true" : "false", r.seconds,
+                     (unsigned long long)r.bytes, r.walksTree ? "entries" : "lines", (unsigned long long)r.units,
+                     r.bytes / 1048576.0 / r.seconds, r.walksTree ? "entries" : "lines", r.units / r.seconds);
+            std::cout << line;
+        }
+        std::cout << "\n]\n";
+        return 0;
+    }
+
+    printf("%-6s %-8s %-10s %-18s %10s %10s %14s %8s\n", "tool", "dataset", "impl", "command", "seconds", "MB/s",
+           "lines|ents/s", "speedup");
+    for (size_t i = 0; i + 1 < results.size(); i += 2)
+    {
+        for (size_t j = i; j < i + 2; ++j)
+        {
+            const Result &r = results[j];
+            char mbps[32] = "-";
+            if (r.bytes)
+                snprintf(mbps, sizeof(mbps), "%.1f", r.bytes / 1048576.0 / r.seconds);
+            printf("%-6s %-8s %-10s %-18s %10.4f %10s %14.0f", r.tool.c_str(), r.dataset.c_str(), r.impl.c_str(),
+                   r.command.c_str(), r.seconds, mbps, r.units / r.seconds);
+            // Speedup of the builtin over the tool it replaces (>1 is faster).
+            if (j == i)
+                printf(" %7.2fx\n", results[i + 1].seconds / r.seconds);
+            else
+                printf("\n");
+        }
+    }
+    printf("\ndsh (sh): the builtin runs the system tool through /bin/sh, so its speedup is shell overhead.\n");
+    return 0;
+}
@@ -0,0 +1,54 @@
+// Thin client for `dsh --server`.
+//
+//     dshc [--socket path] command [args...]
+//
+// Sends the command line to the running server, which writes straight to
+// this process's stdout/stderr, and exits with the command's status. Falls
+// back to `dsh -c` when no server is listening.
+#include "dsh.h"
+
+#include <unistd.h>
+
+int main(int argc, char **argv)
+{
+    std::string socketPath;
+    int first = 1;
+    if (argc > 2 && std::string(argv[1]) == "--socket")
+    {
+        socketPath = argv[2];
+        first = 3;
+    }
+    if (first >= argc)
+    {
+        std::cerr << "Usage: dshc [--socket path] command [args...]\n";
+        return 2;
+    }
+    // The server expands the line again, so anything beyond plain word
+    // characters is single-quoted to arrive as exactly one argument.
+    std::string line;
+    for (int i = first; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i > first)
+            line += ' ';
+        if (!arg.empty() && arg.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+                                                  "_@%+=:,./-") == std::string::npos)
+        {
+            line += arg;
+            continue;
+        }
+        line += '\'';
+        for (char c : arg)
+            line += c == '\'' ? std::string("'\\''") : std::string(1, c);
+        line += '\'';
+    }
+    if (socketPath.empty())
+        socketPath = serverSocketPath();
+
+    int status;
+    if (runOnServer(socketPath, line, status))
+        return status;
+    execlp("dsh", "dsh", "--socket", socketPath.c_str(), "-c", line.c_str(), (char *)nullptr);
+    perror("dsh");
+    return 127;
+}
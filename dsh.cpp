@@ -13,61 +13,55 @@
 #include <pwd.h>
 #include <grp.h>
 #include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <utime.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <signal.h>
+#include <regex.h>
+#include <sys/sysinfo.h>
+#include <sys/statvfs.h>
+#include <sys/utsname.h>
+#include <mntent.h>
+#include <utmpx.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <termios.h>
+#include <limits.h>
+#include <zlib.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <string>
 #include <set>
 #include <bits/stdc++.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "dsh.h"
 
-class Command
-{
-public:
-    virtual void execute(const std::vector<std::string> &args) = 0;
-    virtual std::string helpText() = 0;
-};
-
-class CommandRegistry
-{
-private:
-    std::map<std::string, Command *> commands;
-    std::map<std::string, std::string> aliases;
-
-public:
-    ~CommandRegistry()
-    {
-        for (auto cmd : commands)
-        {
-            delete cmd.second;
-        }
-    }
-    void registerCommand(const std::string &commandName, Command *command)
-    {
-        commands[commandName] = command;
-    }
-    Command *getCommand(const std::string &commandName)
-    {
-        if (aliases.count(commandName)) {
-            return commands[aliases[commandName]];
-        }
-        auto it = commands.find(commandName);
-        if (it != commands.end())
-        {
-            return it->second;
-        }
-        return nullptr;
-    }
-    void listCommands()
-    {
-        std::cout << "Available commands:\n";
-        for (auto &command : commands)
-        {
-            std::cout << command.first << " - " << command.second->helpText() << "\n";
-        }
-    }
-    void registerAlias(const std::string& aliasName, const std::string& commandName) {
-        aliases[aliasName] = commandName;
-    }
-};
+std::vector<std::string> expandLine(const std::string &line, CommandRegistry &registry);
 
 void loadDshrc(const std::string& path, CommandRegistry& registry) {
     std::ifstream file(path);
@@ -83,7 +77,7 @@ void loadDshrc(const std::string& path, CommandRegistry& registry) {
             } else {
                 Command* cmd = registry.getCommand(tokens[0]);
                 if (cmd) {
-                    cmd->execute(tokens);
+                    cmd->execute(expandLine(line, registry));
                 } else {
                     std::cout << "Unknown command or alias in .dshrc: " << tokens[0] << "\n";
                 }
@@ -92,1319 +86,9798 @@ void loadDshrc(const std::string& path, CommandRegistry& registry) {
     }
 }
 
+// Quotes one argument for the /bin/sh command lines the wrapper builtins
+// build, so it reaches the program as a single word.
+std::string shellQuote(const std::string &word)
+{
+    if (!word.empty() && word.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+                                                "_@%+=:,./-") == std::string::npos)
+        return word;
+    std::string quoted = "'";
+    for (char c : word)
+        quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    return quoted + "'";
+}
 
-class ListFilesCommand : public Command
+bool writeAll(int fd, const char *data, size_t len)
 {
-public:
-    void execute(const std::vector<std::string> &args) override
+    while (len > 0)
     {
-        const char *directory = (args.size() > 1) ? args[1].c_str() : ".";
-        DIR *dir;
-        struct dirent *ent;
-        if ((dir = opendir(directory)) != NULL)
-        {
-            while ((ent = readdir(dir)) != NULL)
-            {
-                std::cout << ent->d_name << "\n";
-            }
-            closedir(dir);
-        }
-        else
+        ssize_t n = write(fd, data, len);
+        if (n < 0)
         {
-            perror("Unable to list directory");
+            if (errno == EINTR)
+                continue;
+            return false;
         }
+        data += n;
+        len -= n;
     }
-    std::string helpText() override
+    return true;
+}
+
+// Copies `size` bytes from the current offset of `in` to `out`, letting the
+// kernel move the data where it can. Short sources are padded with zeros so
+// fixed-size containers (tar entries) stay well formed.
+bool copyFileData(int in, int out, off_t size)
+{
+    off_t remaining = size;
+    while (remaining > 0)
     {
-        return "Lists files in the current or specified directory. Usage: ls [directory]";
+        ssize_t n = copy_file_range(in, nullptr, out, nullptr, remaining, 0);
+        if (n <= 0)
+            break;
+        remaining -= n;
     }
-};
+    while (remaining > 0)
+    {
+        ssize_t n = sendfile(out, in, nullptr, remaining);
+        if (n <= 0)
+            break;
+        remaining -= n;
+    }
+    std::vector<char> buffer(1 << 16);
+    while (remaining > 0)
+    {
+        ssize_t n = read(in, buffer.data(), std::min<off_t>(remaining, buffer.size()));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            std::fill(buffer.begin(), buffer.end(), 0);
+            n = std::min<off_t>(remaining, buffer.size());
+        }
+        if (!writeAll(out, buffer.data(), n))
+            return false;
+        remaining -= n;
+    }
+    return true;
+}
 
-class ListFilesDetailCommand : public Command
+// Output layer shared by the system metric builtins. Commands fill rows of
+// named fields; a report prints as an aligned table or, with --json, as a
+// JSON object (single row) or array.
+class Report
 {
+private:
+    struct Field
+    {
+        std::string key;
+        std::string label;
+        std::string text;
+        std::string json;
+        bool numeric;
+    };
+    std::vector<std::vector<Field>> rows;
+
 public:
-    void execute(const std::vector<std::string> &args) override
+    static bool wantsJson(std::vector<std::string> &args)
     {
-        const char *directory = ".";
-        if (args.size() > 1)
-            directory = args[1].c_str();
-
-        DIR *dir;
-        struct dirent *ent;
-        struct stat st;
+        auto it = std::find(args.begin(), args.end(), "--json");
+        if (it == args.end())
+            return false;
+        args.erase(it);
+        return true;
+    }
 
-        if ((dir = opendir(directory)) != NULL)
+    static std::string jsonString(const std::string &value)
+    {
+        std::string out = "\"";
+        for (unsigned char c : value)
         {
-            while ((ent = readdir(dir)) != NULL)
+            if (c == '"' || c == '\\')
+                out += '\\', out += c;
+            else if (c == '\n')
+                out += "\\n";
+            else if (c < 0x20)
             {
-                std::string fullPath = std::string(directory) + "/" + std::string(ent->d_name);
-                if (stat(fullPath.c_str(), &st) == -1)
-                {
-                    continue;
-                }
-
-                std::cout << (S_ISDIR(st.st_mode) ? 'd' : '-')
-                          << ((st.st_mode & S_IRUSR) ? 'r' : '-')
-                          << ((st.st_mode & S_IWUSR) ? 'w' : '-')
-                          << ((st.st_mode & S_IXUSR) ? 'x' : '-')
-                          << ((st.st_mode & S_IRGRP) ? 'r' : '-')
-                          << ((st.st_mode & S_IWGRP) ? 'w' : '-')
-                          << ((st.st_mode & S_IXGRP) ? 'x' : '-')
-                          << ((st.st_mode & S_IROTH) ? 'r' : '-')
-                          << ((st.st_mode & S_IWOTH) ? 'w' : '-')
-                          << ((st.st_mode & S_IXOTH) ? 'x' : '-')
-                          << ' ' << st.st_nlink
-                          << ' ' << getpwuid(st.st_uid)->pw_name
-                          << ' ' << getgrgid(st.st_gid)->gr_name
-                          << ' ' << st.st_size
-                          << ' ' << ctime(&st.st_mtime)
-                          << ent->d_name << "\n";
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
             }
-            closedir(dir);
+            else
+                out += c;
         }
-        else
+        return out + "\"";
+    }
+
+    // 5.9Gi / 278Mi like free -h, or 5.9G / 278M (rounded up) like df -h.
+    static std::string humanSize(uint64_t bytes, bool iec)
+    {
+        static const char units[] = "BKMGTPE";
+        double value = bytes;
+        int unit = 0;
+        while (value >= 1024 && unit < 6)
         {
-            perror("Unable to list directory");
+            value /= 1024;
+            ++unit;
         }
+        if (!iec)
+            value = value < 10 ? std::ceil(value * 10) / 10 : std::ceil(value);
+        char buffer[32];
+        if (unit == 0)
+            snprintf(buffer, sizeof(buffer), iec ? "%lluB" : "%llu", (unsigned long long)bytes);
+        else if (value < 10)
+            snprintf(buffer, sizeof(buffer), "%.1f%c%s", value, units[unit], iec ? "i" : "");
+        else
+            snprintf(buffer, sizeof(buffer), "%.0f%c%s", value, units[unit], iec ? "i" : "");
+        return buffer;
     }
-    std::string helpText() override
+
+    Report &row()
     {
-        return "Lists all files in detail. Usage: lsal [directory]";
+        rows.emplace_back();
+        return *this;
+    }
+    Report &text(const std::string &key, const std::string &label, const std::string &value)
+    {
+        rows.back().push_back({key, label, value, jsonString(value), false});
+        return *this;
+    }
+    Report &number(const std::string &key, const std::string &label, double value, const std::string &shown = "")
+    {
+        char buffer[64];
+        if (value == (double)(int64_t)value)
+            snprintf(buffer, sizeof(buffer), "%lld", (long long)value);
+        else
+            snprintf(buffer, sizeof(buffer), "%.2f", value);
+        rows.back().push_back({key, label, shown.empty() ? buffer : shown, buffer, true});
+        return *this;
     }
-};
 
-class ChangeDirectoryCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    std::string json(bool single) const
     {
-        if (args.size() < 2)
-        {
-            std::cout << "Insufficient arguments. Usage: cd [directory]\n";
-        }
-        else if (chdir(args[1].c_str()) != 0)
+        std::string out = single && rows.size() == 1 ? "" : "[";
+        for (size_t r = 0; r < rows.size(); ++r)
         {
-            perror("cd failed");
+            out += r ? ",{" : "{";
+            for (size_t f = 0; f < rows[r].size(); ++f)
+                out += (f ? "," : "") + jsonString(rows[r][f].key) + ":" + rows[r][f].json;
+            out += "}";
         }
+        if (!(single && rows.size() == 1))
+            out += "]";
+        return out;
     }
-    std::string helpText() override
+
+    void printJson(bool single) const
     {
-        return "Change the current directory. Usage: cd [directory]";
+        std::cout << json(single) << "\n";
     }
-};
 
-class PrintWorkingDirectoryCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
-    {
-        char cwd[1024];
-        if (getcwd(cwd, sizeof(cwd)) != NULL)
+    std::string table() const
+    {
+        if (rows.empty())
+            return "";
+        std::vector<size_t> widths(rows[0].size(), 0);
+        for (size_t f = 0; f < rows[0].size(); ++f)
+            widths[f] = rows[0][f].label.size();
+        for (auto &r : rows)
         {
-            std::cout << cwd << "\n";
+            for (size_t f = 0; f < r.size() && f < widths.size(); ++f)
+                widths[f] = std::max(widths[f], r[f].text.size());
         }
-        else
+        auto cell = [&](std::string &out, size_t f, const std::string &value, bool right) {
+            if (f)
+                out += ' ';
+            if (f + 1 == widths.size() && !right)
+                out += value;
+            else if (right)
+                out.append(widths[f] - value.size(), ' ').append(value);
+            else
+                out.append(value).append(widths[f] - value.size(), ' ');
+        };
+        std::string out;
+        for (size_t f = 0; f < rows[0].size(); ++f)
+            cell(out, f, rows[0][f].label, rows[0][f].numeric);
+        out += "\n";
+        for (auto &r : rows)
         {
-            perror("pwd failed");
+            for (size_t f = 0; f < r.size() && f < widths.size(); ++f)
+                cell(out, f, r[f].text, r[f].numeric);
+            out += "\n";
         }
+        return out;
     }
-    std::string helpText() override
+
+    void printTable() const
     {
-        return "Prints the current directory. Usage: pwd";
+        std::cout << table();
+    }
+
+    void print(bool json) const
+    {
+        if (json)
+            printJson(true);
+        else
+            printTable();
     }
 };
 
-class HelpCommand : public Command
+// Chrome trace event recorder behind `dsh --trace file.json` (load the file
+// in chrome://tracing or ui.perfetto.dev). Every thread appends complete
+// events to its own buffer without locking; buffers are registered once
+// under a mutex and serialized when the session ends. With tracing off a
+// TraceSpan costs one relaxed atomic load.
+class Tracer
 {
 public:
-    void execute(const std::vector<std::string> &args) override
+    struct Event
     {
-        if (args.size() == 1)
-        {
-            std::cout << "Display information about available commands. Usage: help [command_name]\n";
-        }
-        else
-        {
-            std::cout << "No help available for \"" << args[1] << "\"" << std::endl;
-        }
+        const char *name;
+        std::string detail;
+        uint64_t start, duration;
+    };
+    struct Buffer
+    {
+        int tid;
+        std::vector<Event> events;
+    };
+
+private:
+    static std::atomic<bool> &active()
+    {
+        static std::atomic<bool> flag(false);
+        return flag;
     }
-    std::string helpText() override
+    static std::mutex &registryMutex()
     {
-        return "Display information about available commands. Usage: help [command_name]";
+        static std::mutex mutex;
+        return mutex;
+    }
+    static std::vector<std::shared_ptr<Buffer>> &buffers()
+    {
+        static std::vector<std::shared_ptr<Buffer>> all;
+        return all;
+    }
+    static std::string &outputPath()
+    {
+        static std::string path;
+        return path;
     }
-};
 
-class CopyFileCommand : public Command
-{
 public:
-    void execute(const std::vector<std::string> &args) override
+    static bool enabled()
     {
-        if (args.size() < 3)
-        {
-            std::cout << "Usage: cp [source] [destination]\n";
-            return;
-        }
-        std::ifstream src(args[1], std::ios::binary);
-        std::ofstream dst(args[2], std::ios::binary);
-        dst << src.rdbuf();
-        src.close();
-        dst.close();
+        return active().load(std::memory_order_relaxed);
     }
-    std::string helpText() override
+
+    static uint64_t now()
     {
-        return "Copies a file. Usage: cp [source] [destination]";
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
     }
-};
 
-class DeleteFileCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    static Buffer &local()
     {
-        if (args.size() < 2)
-        {
-            std::cout << "Usage: rm [file]\n";
-            return;
-        }
-        if (remove(args[1].c_str()) != 0)
-        {
-            perror("Error deleting file");
-        }
-        else
+        thread_local std::shared_ptr<Buffer> buffer;
+        if (!buffer)
         {
-            std::cout << "File deleted successfully\n";
+            buffer = std::make_shared<Buffer>();
+            buffer->tid = syscall(SYS_gettid);
+            buffer->events.reserve(4096);
+            std::lock_guard<std::mutex> lock(registryMutex());
+            buffers().push_back(buffer);
         }
+        return *buffer;
     }
-    std::string helpText() override
+
+    static void start(const std::string &path)
     {
-        return "Deletes a file. Usage: rm [file]";
+        outputPath() = path;
+        active().store(true);
+    }
+
+    // Writes all buffered events; called once when the shell exits.
+    static bool finish()
+    {
+        if (!enabled())
+            return true;
+        active().store(false);
+        int fd = open(outputPath().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+        std::string out = "{\"traceEvents\":[\n", pid = std::to_string(getpid());
+        bool first = true;
+        std::lock_guard<std::mutex> lock(registryMutex());
+        for (auto &buffer : buffers())
+        {
+            std::string tid = std::to_string(buffer->tid);
+            out += std::string(first ? "" : ",\n") + "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid +
+                   ",\"tid\":" + tid + ",\"args\":{\"name\":\"" + (buffer->tid == getpid() ? "dsh" : "worker") + "\"}}";
+            first = false;
+            for (auto &event : buffer->events)
+            {
+                out += ",\n{\"name\":" + Report::jsonString(event.name) + ",\"cat\":\"dsh\",\"ph\":\"X\",\"ts\":" +
+                       std::to_string(event.start) + ",\"dur\":" + std::to_string(event.duration) + ",\"pid\":" + pid +
+                       ",\"tid\":" + tid;
+                if (!event.detail.empty())
+                    out += ",\"args\":{\"detail\":" + Report::jsonString(event.detail) + "}";
+                out += "}";
+                if (out.size() > (1 << 20) && writeAll(fd, out.data(), out.size()))
+                    out.clear();
+            }
+        }
+        out += "\n]}\n";
+        bool ok = writeAll(fd, out.data(), out.size());
+        return close(fd) == 0 && ok;
     }
 };
 
-class EchoCommand : public Command
+// Records one complete ("X") event covering the lifetime of the object.
+class TraceSpan
 {
+private:
+    const char *name;
+    uint64_t start;
+    std::string detail;
+
 public:
-    void execute(const std::vector<std::string> &args) override
+    explicit TraceSpan(const char *spanName, const std::string &spanDetail = std::string())
+        : name(spanName), start(Tracer::enabled() ? Tracer::now() : 0)
     {
-        for (size_t i = 1; i < args.size(); ++i)
-        {
-            std::cout << args[i] << " ";
-        }
-        std::cout << "\n";
+        if (start)
+            detail = spanDetail;
     }
-    std::string helpText() override
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+    ~TraceSpan()
     {
-        return "Echoes text to the terminal. Usage: echo [text]";
+        if (start && Tracer::enabled())
+            Tracer::local().events.push_back({name, std::move(detail), start, Tracer::now() - start});
     }
 };
 
-class MakeDirectoryCommand : public Command
+// Read-only view of a file or a slice of it. Regular files are mmapped
+// (only the requested window); anything that cannot be mapped is read
+// into memory instead so callers see one interface.
+class MappedFile
 {
+private:
+    void *mapping = MAP_FAILED;
+    size_t mappingLength = 0;
+    const char *begin = nullptr;
+    size_t length = 0;
+    std::string fallback;
+
+    void reset()
+    {
+        if (mapping != MAP_FAILED)
+            munmap(mapping, mappingLength);
+        mapping = MAP_FAILED;
+        mappingLength = 0;
+        begin = nullptr;
+        length = 0;
+        fallback.clear();
+    }
+
 public:
-    void execute(const std::vector<std::string> &args) override
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile()
     {
-        if (args.size() < 2)
-        {
-            std::cout << "Usage: mkdir [directory]\n";
-            return;
-        }
-        if (mkdir(args[1].c_str(), 0777) != 0)
+        reset();
+    }
+
+    bool open(const std::string &path, uint64_t offset = 0, uint64_t limit = UINT64_MAX)
+    {
+        reset();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
         {
-            perror("Error creating directory");
+            uint64_t size = st.st_size;
+            length = offset < size ? std::min<uint64_t>(limit, size - offset) : 0;
+            if (length > 0)
+            {
+                uint64_t pageSize = sysconf(_SC_PAGESIZE);
+                uint64_t aligned = offset - offset % pageSize;
+                mappingLength = length + (offset - aligned);
+                mapping = mmap(nullptr, mappingLength, PROT_READ, MAP_PRIVATE, fd, aligned);
+                if (mapping != MAP_FAILED)
+                {
+                    madvise(mapping, mappingLength, MADV_SEQUENTIAL);
+                    begin = static_cast<const char *>(mapping) + (offset - aligned);
+                    close(fd);
+                    return true;
+                }
+            }
+            else
+            {
+                close(fd);
+                return true;
+            }
         }
-        else
+        length = 0;
+        std::vector<char> buffer(1 << 16);
+        uint64_t skipped = 0;
+        ssize_t n;
+        while (fallback.size() < limit && (n = read(fd, buffer.data(), buffer.size())) > 0)
         {
-            std::cout << "Directory created\n";
+            size_t start = 0;
+            if (skipped < offset)
+            {
+                start = std::min<uint64_t>(offset - skipped, n);
+                skipped += start;
+            }
+            fallback.append(buffer.data() + start, std::min<uint64_t>(n - start, limit - fallback.size()));
         }
+        close(fd);
+        begin = fallback.data();
+        length = fallback.size();
+        return true;
     }
-    std::string helpText() override
+    const char *data() const
     {
-        return "Creates a directory. Usage: mkdir [directory]";
+        return begin;
+    }
+    size_t size() const
+    {
+        return length;
     }
 };
 
-class MoveFileCommand : public Command
+class ThreadPool
 {
-public:
-    void execute(const std::vector<std::string> &args) override
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable taskReady;
+    std::condition_variable allDone;
+    size_t active = 0;
+    bool stopping = false;
+
+    void workerLoop()
     {
-        if (args.size() < 3)
+        while (true)
         {
-            std::cout << "Usage: mv [source] [destination]\n";
-            return;
-        }
-        if (rename(args[1].c_str(), args[2].c_str()) != 0)
-        {
-            perror("Error moving file");
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                taskReady.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+                ++active;
+            }
+            {
+                TraceSpan span("pool task");
+                task();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            --active;
+            if (tasks.empty() && active == 0)
+                allDone.notify_all();
         }
-        else
+    }
+
+public:
+    explicit ThreadPool(size_t threadCount = 0)
+    {
+        if (threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t i = 0; i < threadCount; ++i)
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+    ~ThreadPool()
+    {
         {
-            std::cout << "File moved\n";
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
         }
+        taskReady.notify_all();
+        for (auto &worker : workers)
+            worker.join();
     }
-    std::string helpText() override
+    size_t size() const
     {
-        return "Moves a file. Usage: mv [source] [destination]";
+        return workers.size();
     }
-};
-
-class SystemInfoCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    void submit(std::function<void()> task)
     {
-        system("uname -a"); // Simple call to 'uname -a', adjust as needed for more info
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        taskReady.notify_one();
     }
-    std::string helpText() override
+    void wait()
     {
-        return "Displays system information. Usage: sysinfo";
+        std::unique_lock<std::mutex> lock(mutex);
+        allDone.wait(lock, [this] { return tasks.empty() && active == 0; });
     }
 };
 
-class SetEnvCommand : public Command
+// pigz-style compressor: input is cut into fixed blocks that are deflated on
+// a thread pool as independent gzip members and written out in order. The
+// concatenation is a valid gzip stream for gzip, zlib and tar.
+class ParallelGzipWriter
 {
-public:
-    void execute(const std::vector<std::string> &args) override
+private:
+    struct Block
     {
-        if (args.size() < 3)
-        {
-            std::cout << "Insufficient arguments. Usage: setenv [variable] [value]\n";
-        }
-        else
-        {
-            std::cout << "Setting environment variable " << args[1] << " to " << args[2] << "\n";
-            setenv(args[1].c_str(), args[2].c_str(), 1);
-        }
+        std::string input;
+        std::string output;
+        bool done = false;
+        bool failed = false;
+    };
+
+    int fd;
+    int level;
+    size_t blockSize;
+    bool ok = true;
+    std::shared_ptr<Block> current;
+    std::deque<std::shared_ptr<Block>> pending;
+    std::mutex mutex;
+    std::condition_variable blockDone;
+    ThreadPool pool;
+
+    static bool compressBlock(Block &block, int level)
+    {
+        z_stream zs{};
+        if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return false;
+        block.output.resize(deflateBound(&zs, block.input.size()) + 64);
+        zs.next_in = reinterpret_cast<Bytef *>(&block.input[0]);
+        zs.avail_in = block.input.size();
+        zs.next_out = reinterpret_cast<Bytef *>(&block.output[0]);
+        zs.avail_out = block.output.size();
+        int rc = deflate(&zs, Z_FINISH);
+        block.output.resize(zs.total_out);
+        deflateEnd(&zs);
+        return rc == Z_STREAM_END;
     }
-    std::string helpText() override
+
+    bool frontDone()
     {
-        return "Set an environment variable. Usage: setenv [variable] [value]";
+        std::lock_guard<std::mutex> lock(mutex);
+        return pending.front()->done;
     }
-};
 
-class CatCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    void drain(size_t keep)
     {
-        if (args.size() < 2)
-        {
-            std::cout << "Usage: cat [file]\n";
-            return;
-        }
-        std::ifstream file(args[1]);
-        std::string line;
-        if (file.is_open())
+        while (!pending.empty() && (pending.size() > keep || frontDone()))
         {
-            while (getline(file, line))
+            std::shared_ptr<Block> block = pending.front();
             {
-                std::cout << line << "\n";
+                std::unique_lock<std::mutex> lock(mutex);
+                blockDone.wait(lock, [&block] { return block->done; });
             }
-            file.close();
-        }
-        else
-        {
-            std::cout << "Unable to open file\n";
+            if (block->failed || !writeAll(fd, block->output.data(), block->output.size()))
+                ok = false;
+            pending.pop_front();
         }
     }
-    std::string helpText() override
+
+    void submitCurrent()
     {
-        return "Displays the content of a file. Usage: cat [file]";
+        if (!current || current->input.empty())
+            return;
+        std::shared_ptr<Block> block = std::move(current);
+        current.reset();
+        pending.push_back(block);
+        int blockLevel = level;
+        pool.submit([this, block, blockLevel] {
+            bool compressed = compressBlock(*block, blockLevel);
+            std::lock_guard<std::mutex> lock(mutex);
+            block->failed = !compressed;
+            block->done = true;
+            std::string().swap(block->input);
+            blockDone.notify_all();
+        });
+        drain(pool.size() * 2);
     }
-};
 
-class GrepCommand : public Command
-{
 public:
-    void execute(const std::vector<std::string> &args) override
+    ParallelGzipWriter(int fd, int level = Z_DEFAULT_COMPRESSION, size_t blockSize = 1 << 20)
+        : fd(fd), level(level), blockSize(blockSize)
     {
-        if (args.size() < 3)
-        {
-            std::cout << "Usage: grep [pattern] [file]\n";
-            return;
-        }
-        std::ifstream file(args[2]);
-        std::string line;
-        if (file.is_open())
+    }
+    ~ParallelGzipWriter()
+    {
+        finish();
+    }
+    void write(const char *data, size_t len)
+    {
+        while (len > 0)
         {
-            while (getline(file, line))
+            if (!current)
             {
-                if (line.find(args[1]) != std::string::npos)
-                {
-                    std::cout << line << "\n";
-                }
+                current = std::make_shared<Block>();
+                current->input.reserve(blockSize);
             }
-            file.close();
-        }
-        else
-        {
-            std::cout << "Unable to open file\n";
+            size_t n = std::min(len, blockSize - current->input.size());
+            current->input.append(data, n);
+            data += n;
+            len -= n;
+            if (current->input.size() == blockSize)
+                submitCurrent();
         }
     }
-    std::string helpText() override
+    bool finish()
     {
-        return "Searches for a text pattern within a file. Usage: grep [pattern] [file]";
+        submitCurrent();
+        drain(0);
+        return ok;
     }
 };
 
-class TopCommand : public Command
+std::map<std::string, uint64_t> readMeminfo()
 {
-public:
-    void execute(const std::vector<std::string> &args) override
-    {
-        system("top -b -n 1"); // Runs 'top' command in batch mode for a single iteration
+    std::map<std::string, uint64_t> values;
+    char buffer[8192];
+    int fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+    ssize_t n = fd >= 0 ? read(fd, buffer, sizeof(buffer) - 1) : -1;
+    if (fd >= 0)
+        close(fd);
+    if (n <= 0)
+        return values;
+    buffer[n] = '\0';
+    for (char *line = buffer; *line;)
+    {
+        char *colon = strchr(line, ':');
+        char *next = strchr(line, '\n');
+        if (!colon || !next)
+            break;
+        values[std::string(line, colon - line)] = strtoull(colon + 1, nullptr, 10) * 1024;
+        line = next + 1;
     }
-    std::string helpText() override
+    return values;
+}
+
+int countLoggedInUsers()
+{
+    int users = 0;
+    setutxent();
+    while (struct utmpx *entry = getutxent())
     {
-        return "Displays real-time system resource usage. Usage: top";
+        if (entry->ut_type == USER_PROCESS)
+            ++users;
     }
+    endutxent();
+    return users;
+}
+
+std::string formatUptime(long seconds)
+{
+    long days = seconds / 86400, hours = (seconds % 86400) / 3600, minutes = (seconds % 3600) / 60;
+    char buffer[64];
+    std::string out;
+    if (days)
+        out += std::to_string(days) + (days == 1 ? " day, " : " days, ");
+    if (hours)
+        snprintf(buffer, sizeof(buffer), "%2ld:%02ld", hours, minutes);
+    else
+        snprintf(buffer, sizeof(buffer), "%ld min", minutes);
+    return out + buffer;
+}
+
+struct ProcessInfo
+{
+    int pid = 0;
+    int ppid = 0;
+    char state = '?';
+    char comm[32] = {};
+    uid_t uid = 0;
+    int tty = 0;
+    uint64_t utime = 0;
+    uint64_t stime = 0;
+    uint64_t startTime = 0;
+    uint64_t vsize = 0;
+    uint64_t rssPages = 0;
+    uint64_t sharedPages = 0;
+    int64_t priority = 0;
+    int64_t nice = 0;
+    int64_t threads = 0;
+    std::string cmdline;
 };
 
-class IfconfigCommand : public Command
+// Reads the process table straight from /proc. Files are opened relative
+// to a held /proc dirfd and parsed in place from stack buffers; large
+// tables are split across threads.
+class ProcessTable
 {
-public:
-    void execute(const std::vector<std::string> &args) override
-    {
-        system("ifconfig"); // Assumes 'ifconfig' is installed, consider 'ip addr' on modern systems
-    }
-    std::string helpText() override
+private:
+    static const char *skipField(const char *p, const char *end)
     {
-        return "Lists all network interface configurations. Usage: ifconfig";
+        while (p < end && *p != ' ')
+            ++p;
+        return p < end ? p + 1 : end;
     }
-};
 
-class FindCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    static const char *parseNumber(const char *p, const char *end, int64_t &value)
     {
-        if (args.size() < 3)
-        {
-            std::cout << "Usage: find [directory] [pattern]\n";
-            return;
-        }
-        std::string command = "find " + args[1] + " -name \"" + args[2] + "\"";
-        system(command.c_str());
+        bool negative = p < end && *p == '-';
+        if (negative)
+            ++p;
+        uint64_t v = 0;
+        while (p < end && *p >= '0' && *p <= '9')
+            v = v * 10 + (*p++ - '0');
+        value = negative ? -(int64_t)v : (int64_t)v;
+        return p < end ? p + 1 : end;
     }
-    std::string helpText() override
+
+    static ssize_t readAt(int dirFd, const char *path, char *buffer, size_t size)
     {
-        return "Search for files matching a pattern. Usage: find [directory] [pattern]";
+        int fd = openat(dirFd, path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return -1;
+        ssize_t n = read(fd, buffer, size);
+        close(fd);
+        return n;
     }
-};
 
-class WgetCommand : public Command
-{
 public:
-    void execute(const std::vector<std::string> &args) override
+    static long ticksPerSecond()
     {
-        if (args.size() < 2)
-        {
-            std::cout << "Usage: wget [url]\n";
-            return;
-        }
-        std::string command = "wget " + args[1];
-        system(command.c_str());
+        static long ticks = sysconf(_SC_CLK_TCK);
+        return ticks;
     }
-    std::string helpText() override
+
+    static long pageSize()
     {
-        return "Download files from the internet. Usage: wget [url]";
+        static long size = sysconf(_SC_PAGESIZE);
+        return size;
     }
-};
 
-class HexDumpCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    // Parses the contents of /proc/[pid]/stat. The command name sits in
+    // parentheses and may itself contain spaces or ')', so fields are
+    // located from the last ')'.
+    static bool parseStat(const char *data, size_t size, ProcessInfo &info)
+    {
+        const char *end = data + size;
+        const char *open = static_cast<const char *>(memchr(data, '(', size));
+        const char *close = static_cast<const char *>(memrchr(data, ')', size));
+        if (!open || !close || close < open || close + 2 >= end)
+            return false;
+        int64_t value;
+        parseNumber(data, open, value);
+        info.pid = value;
+        size_t commLength = std::min<size_t>(close - open - 1, sizeof(info.comm) - 1);
+        memcpy(info.comm, open + 1, commLength);
+        info.comm[commLength] = '\0';
+        const char *p = close + 2;
+        info.state = *p;
+        p = skipField(p, end);
+        p = parseNumber(p, end, value); // 4 ppid
+        info.ppid = value;
+        p = skipField(p, end);          // 5 pgrp
+        p = skipField(p, end);          // 6 session
+        p = parseNumber(p, end, value); // 7 tty_nr
+        info.tty = value;
+        for (int field = 8; field < 14; ++field)
+            p = skipField(p, end);
+        p = parseNumber(p, end, value); // 14 utime
+        info.utime = value;
+        p = parseNumber(p, end, value); // 15 stime
+        info.stime = value;
+        p = skipField(p, end);          // 16 cutime
+        p = skipField(p, end);          // 17 cstime
+        p = parseNumber(p, end, info.priority);
+        p = parseNumber(p, end, info.nice);
+        p = parseNumber(p, end, info.threads);
+        p = skipField(p, end);          // 21 itrealvalue
+        p = parseNumber(p, end, value); // 22 starttime
+        info.startTime = value;
+        p = parseNumber(p, end, value); // 23 vsize
+        info.vsize = value;
+        parseNumber(p, end, value);     // 24 rss
+        info.rssPages = value;
+        return true;
+    }
+
+    static bool parseStatm(const char *data, size_t size, ProcessInfo &info)
     {
-        if (args.size() < 2)
+        const char *end = data + size;
+        int64_t value;
+        const char *p = skipField(data, end);
+        p = parseNumber(p, end, value);
+        info.rssPages = value;
+        parseNumber(p, end, value);
+        info.sharedPages = value;
+        return true;
+    }
+
+    static bool readProcess(int procFd, int pid, bool withCmdline, ProcessInfo &info)
+    {
+        char path[64], buffer[1024];
+        int length = snprintf(path, sizeof(path), "%d/", pid);
+        strcpy(path + length, "stat");
+        ssize_t n = readAt(procFd, path, buffer, sizeof(buffer));
+        if (n <= 0 || !parseStat(buffer, n, info))
+            return false;
+        strcpy(path + length, "statm");
+        n = readAt(procFd, path, buffer, sizeof(buffer));
+        if (n > 0)
+            parseStatm(buffer, n, info);
+        path[length - 1] = '\0';
+        struct stat st;
+        if (fstatat(procFd, path, &st, 0) == 0)
+            info.uid = st.st_uid;
+        if (withCmdline)
         {
-            std::cout << "Usage: hexdump [file]\n";
-            return;
+            path[length - 1] = '/';
+            strcpy(path + length, "cmdline");
+            char args[4096];
+            n = readAt(procFd, path, args, sizeof(args));
+            for (ssize_t i = 0; i < n; ++i)
+            {
+                if (args[i] == '\0')
+                    args[i] = ' ';
+            }
+            while (n > 0 && args[n - 1] == ' ')
+                --n;
+            info.cmdline.assign(args, n > 0 ? n : 0);
         }
-        std::string command = "hexdump -C " + args[1];
-        system(command.c_str());
-    }
-    std::string helpText() override
-    {
-        return "Display file content in hexadecimal format. Usage: hexdump [file]";
+        return true;
     }
-};
 
-class PsCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
-    {
-        system("ps aux");
+    static std::vector<int> listPids(int procFd)
+    {
+        std::vector<int> pids;
+        DIR *dir = fdopendir(dup(procFd));
+        if (!dir)
+            return pids;
+        rewinddir(dir);
+        while (struct dirent *ent = readdir(dir))
+        {
+            if (ent->d_name[0] >= '1' && ent->d_name[0] <= '9')
+                pids.push_back(atoi(ent->d_name));
+        }
+        closedir(dir);
+        return pids;
     }
-    std::string helpText() override
-    {
-        return "Display currently running processes. Usage: ps";
+
+    static std::vector<ProcessInfo> scan(bool withCmdline)
+    {
+        std::vector<ProcessInfo> processes;
+        int procFd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (procFd < 0)
+            return processes;
+        std::vector<int> pids = listPids(procFd);
+        std::vector<ProcessInfo> slots(pids.size());
+        std::vector<char> found(pids.size(), 0);
+        auto readRange = [&](size_t from, size_t to) {
+            for (size_t i = from; i < to; ++i)
+                found[i] = readProcess(procFd, pids[i], withCmdline, slots[i]);
+        };
+        const size_t perThread = 2048;
+        size_t threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                          (pids.size() + perThread - 1) / perThread);
+        if (threads <= 1)
+        {
+            readRange(0, pids.size());
+        }
+        else
+        {
+            std::vector<std::thread> workers;
+            size_t step = (pids.size() + threads - 1) / threads;
+            for (size_t from = 0; from < pids.size(); from += step)
+                workers.emplace_back(readRange, from, std::min(pids.size(), from + step));
+            for (auto &worker : workers)
+                worker.join();
+        }
+        close(procFd);
+        processes.reserve(pids.size());
+        for (size_t i = 0; i < pids.size(); ++i)
+        {
+            if (found[i])
+                processes.push_back(std::move(slots[i]));
+        }
+        return processes;
     }
-};
 
-class NetstatCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    static const std::string &userName(uid_t uid)
     {
-        system("netstat -tuln");
+        static std::unordered_map<uid_t, std::string> names;
+        auto it = names.find(uid);
+        if (it == names.end())
+        {
+            struct passwd *pw = getpwuid(uid);
+            it = names.emplace(uid, pw ? pw->pw_name : std::to_string(uid)).first;
+        }
+        return it->second;
     }
-    std::string helpText() override
+
+    static std::string ttyName(int tty)
     {
-        return "Show network statistics. Usage: netstat";
+        unsigned major = (tty >> 8) & 0xfff, minor = (tty & 0xff) | ((tty >> 12) & 0xfff00);
+        if (tty == 0)
+            return "?";
+        if (major >= 136 && major <= 143)
+            return "pts/" + std::to_string((major - 136) * 256 + minor);
+        if (major == 4)
+            return minor < 64 ? "tty" + std::to_string(minor) : "ttyS" + std::to_string(minor - 64);
+        return "?";
     }
 };
 
-class ShutdownCommand : public Command
+
+// Sends one netlink dump request and hands every reply message to
+// `onMessage` until NLMSG_DONE. Shared by the interface and socket builtins.
+bool netlinkDump(int protocol, struct nlmsghdr *request, const std::function<void(const struct nlmsghdr *)> &onMessage)
 {
-public:
-    void execute(const std::vector<std::string> &args) override
-    {
-        if (args.size() > 1 && args[1] == "reboot")
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+    if (fd < 0)
+        return false;
+    int bufferSize = 1 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    struct sockaddr_nl kernel = {};
+    kernel.nl_family = AF_NETLINK;
+    request->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request->nlmsg_seq = 1;
+    if (sendto(fd, request, request->nlmsg_len, 0, (struct sockaddr *)&kernel, sizeof(kernel)) < 0)
+    {
+        close(fd);
+        return false;
+    }
+    std::vector<char> buffer(1 << 16);
+    bool ok = true, done = false;
+    while (!done)
+    {
+        ssize_t n = recv(fd, buffer.data(), buffer.size(), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
         {
-            system("reboot");
+            ok = false;
+            break;
         }
-        else
+        for (struct nlmsghdr *message = (struct nlmsghdr *)buffer.data(); NLMSG_OK(message, (size_t)n);
+             message = NLMSG_NEXT(message, n))
         {
-            system("shutdown now");
+            if (message->nlmsg_type == NLMSG_DONE)
+            {
+                done = true;
+                break;
+            }
+            if (message->nlmsg_type == NLMSG_ERROR)
+            {
+                struct nlmsgerr *error = (struct nlmsgerr *)NLMSG_DATA(message);
+                errno = -error->error;
+                ok = !error->error;
+                done = true;
+                break;
+            }
+            onMessage(message);
         }
     }
-    std::string helpText() override
-    {
-        return "Shut down or reboot the system. Usage: shutdown [reboot]";
-    }
+    close(fd);
+    return ok;
+}
+
+struct InterfaceInfo
+{
+    int index = 0;
+    std::string name;
+    unsigned flags = 0;
+    unsigned mtu = 0;
+    unsigned txQueue = 0;
+    unsigned short type = 0;
+    std::string mac;
+    struct Address
+    {
+        int family;
+        std::string address;
+        std::string broadcast;
+        int prefix;
+        int scope;
+    };
+    std::vector<Address> addresses;
 };
 
-class TailCommand : public Command
+// Links and addresses from rtnetlink, ordered by interface index.
+bool queryInterfaces(std::vector<InterfaceInfo> &interfaces)
 {
-public:
-    void execute(const std::vector<std::string> &args) override
-    {
-        if (args.size() < 2)
+    std::map<int, InterfaceInfo> byIndex;
+    struct
+    {
+        struct nlmsghdr header;
+        struct ifinfomsg info;
+    } linkRequest = {};
+    linkRequest.header.nlmsg_len = sizeof(linkRequest);
+    linkRequest.header.nlmsg_type = RTM_GETLINK;
+    linkRequest.info.ifi_family = AF_UNSPEC;
+    bool ok = netlinkDump(NETLINK_ROUTE, &linkRequest.header, [&](const struct nlmsghdr *message) {
+        if (message->nlmsg_type != RTM_NEWLINK)
+            return;
+        struct ifinfomsg *info = (struct ifinfomsg *)NLMSG_DATA(message);
+        InterfaceInfo &entry = byIndex[info->ifi_index];
+        entry.index = info->ifi_index;
+        entry.flags = info->ifi_flags;
+        entry.type = info->ifi_type;
+        int length = IFLA_PAYLOAD(message);
+        for (struct rtattr *attr = IFLA_RTA(info); RTA_OK(attr, length); attr = RTA_NEXT(attr, length))
         {
-            std::cout << "Usage: tail [file]\n";
+            if (attr->rta_type == IFLA_IFNAME)
+                entry.name = (const char *)RTA_DATA(attr);
+            else if (attr->rta_type == IFLA_MTU)
+                entry.mtu = *(unsigned *)RTA_DATA(attr);
+            else if (attr->rta_type == IFLA_TXQLEN)
+                entry.txQueue = *(unsigned *)RTA_DATA(attr);
+            else if (attr->rta_type == IFLA_ADDRESS)
+            {
+                const unsigned char *bytes = (const unsigned char *)RTA_DATA(attr);
+                char text[4];
+                for (size_t i = 0; i < RTA_PAYLOAD(attr); ++i)
+                {
+                    snprintf(text, sizeof(text), i ? ":%02x" : "%02x", bytes[i]);
+                    entry.mac += text;
+                }
+            }
+        }
+    });
+
+    struct
+    {
+        struct nlmsghdr header;
+        struct ifaddrmsg info;
+    } addressRequest = {};
+    addressRequest.header.nlmsg_len = sizeof(addressRequest);
+    addressRequest.header.nlmsg_type = RTM_GETADDR;
+    addressRequest.info.ifa_family = AF_UNSPEC;
+    ok = ok && netlinkDump(NETLINK_ROUTE, &addressRequest.header, [&](const struct nlmsghdr *message) {
+        if (message->nlmsg_type != RTM_NEWADDR)
             return;
+        struct ifaddrmsg *info = (struct ifaddrmsg *)NLMSG_DATA(message);
+        auto it = byIndex.find(info->ifa_index);
+        if (it == byIndex.end())
+            return;
+        InterfaceInfo::Address address = {info->ifa_family, "", "", info->ifa_prefixlen, info->ifa_scope};
+        char text[INET6_ADDRSTRLEN];
+        int length = IFA_PAYLOAD(message);
+        for (struct rtattr *attr = IFA_RTA(info); RTA_OK(attr, length); attr = RTA_NEXT(attr, length))
+        {
+            if (!inet_ntop(info->ifa_family, RTA_DATA(attr), text, sizeof(text)))
+                continue;
+            // IFA_LOCAL is the interface's own address on point-to-point links.
+            if (attr->rta_type == IFA_LOCAL || (attr->rta_type == IFA_ADDRESS && address.address.empty()))
+                address.address = text;
+            else if (attr->rta_type == IFA_BROADCAST)
+                address.broadcast = text;
         }
-        std::string command = "tail -f " + args[1];
-        system(command.c_str());
-    }
-    std::string helpText() override
-    {
-        return "Follows the tail of a file. Usage: tail [file]";
-    }
-};
+        it->second.addresses.push_back(address);
+    });
 
-class NanoCommand : public Command
+    interfaces.clear();
+    for (auto &entry : byIndex)
+        interfaces.push_back(std::move(entry.second));
+    return ok;
+}
+
+// Counters from /proc/net/dev. The file stays open and every sample is one
+// pread from offset 0, so polling at short intervals costs a single syscall.
+class NetDevCounters
 {
 public:
-    void execute(const std::vector<std::string> &args) override
+    struct Counters
     {
-        if (args.size() < 2)
+        uint64_t rxBytes, rxPackets, rxErrors, rxDropped, rxFifo, rxFrame;
+        uint64_t txBytes, txPackets, txErrors, txDropped, txFifo, txCollisions, txCarrier;
+    };
+
+private:
+    int fd = -1;
+    std::vector<char> buffer = std::vector<char>(16384);
+
+public:
+    ~NetDevCounters()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool sample(std::map<std::string, Counters> &counters)
+    {
+        if (fd < 0 && (fd = open("/proc/net/dev", O_RDONLY | O_CLOEXEC)) < 0)
+            return false;
+        ssize_t n;
+        while ((n = pread(fd, buffer.data(), buffer.size(), 0)) == (ssize_t)buffer.size())
+            buffer.resize(buffer.size() * 2);
+        if (n < 0)
+            return false;
+        counters.clear();
+        const char *p = buffer.data(), *end = p + n;
+        for (int skip = 0; skip < 2 && p < end; ++skip)
+            p = (const char *)memchr(p, '\n', end - p) + 1;
+        while (p < end)
         {
-            std::cout << "Usage: nano [file]\n";
-            return;
+            const char *lineEnd = (const char *)memchr(p, '\n', end - p);
+            if (!lineEnd)
+                lineEnd = end;
+            const char *colon = (const char *)memchr(p, ':', lineEnd - p);
+            if (colon)
+            {
+                while (*p == ' ')
+                    ++p;
+                uint64_t fields[16] = {};
+                char *cursor = (char *)colon + 1;
+                for (int i = 0; i < 16; ++i)
+                    fields[i] = strtoull(cursor, &cursor, 10);
+                counters[std::string(p, colon - p)] = {fields[0], fields[1], fields[2],  fields[3], fields[4],
+                                                       fields[5], fields[8], fields[9],  fields[10], fields[11],
+                                                       fields[12], fields[13], fields[14]};
+            }
+            p = lineEnd + 1;
         }
-        std::string command = "nano " + args[1];
-        system(command.c_str());
-    }
-    std::string helpText() override
-    {
-        return "Open a file in the Nano editor. Usage: nano [file]";
+        return true;
     }
 };
 
-class HttpCommand : public Command
+// Resolves command names against $PATH and remembers the answer. A change of
+// PATH drops everything; otherwise the PATH directories' mtimes are checked
+// at most once per second, and a changed directory only invalidates names
+// that were found in it or in a later directory (which it could now shadow).
+// A relative PATH entry (empty or ".") means something different after cd, so
+// no answer that depended on one is kept.
+class PathCache
 {
 public:
-    void execute(const std::vector<std::string> &args) override
+    struct Entry
     {
-        std::string port = "8000"; // Default port
-        if (args.size() > 1)
-        {
-            port = args[1];
-        }
-        std::string command = "python -m http.server " + port;
-        system(command.c_str());
-    }
-    std::string helpText() override
+        std::string path; // empty when the name was not found
+        size_t dirIndex;  // PATH index it was found in, or dirs.size()
+        uint64_t hits;
+    };
+
+private:
+    struct Directory
+    {
+        std::string path;
+        struct timespec mtime;
+    };
+    std::string pathValue;
+    std::vector<Directory> dirs;
+    size_t firstRelative = 0; // index of the first relative PATH entry, or dirs.size()
+    std::map<std::string, Entry> entries;
+    struct timespec lastCheck = {0, 0};
+
+    static struct timespec mtimeOf(const std::string &dir)
     {
-        return "Starts a simple HTTP server. Usage: http [port]";
+        struct stat st;
+        if (stat(dir.c_str(), &st) != 0)
+            return {0, 0};
+        return st.st_mtim;
     }
-};
 
-class ChmodCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
-    {
-        if (args.size() < 3)
+    void reload(const char *path)
+    {
+        pathValue = path;
+        dirs.clear();
+        entries.clear();
+        std::stringstream stream(pathValue);
+        std::string dir;
+        while (std::getline(stream, dir, ':'))
         {
-            std::cout << "Usage: chmod [permissions] [file]\n";
-            return;
+            if (dir.empty())
+                dir = ".";
+            dirs.push_back({dir, mtimeOf(dir)});
         }
-        std::string command = "chmod " + args[1] + " " + args[2];
-        system(command.c_str());
+        // getline drops the empty element after a trailing ':'.
+        if (!pathValue.empty() && pathValue.back() == ':')
+            dirs.push_back({".", mtimeOf(".")});
+        firstRelative = dirs.size();
+        for (size_t i = 0; i < dirs.size(); ++i)
+        {
+            if (dirs[i].path[0] != '/')
+            {
+                firstRelative = i;
+                break;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &lastCheck);
     }
-    std::string helpText() override
+
+    void revalidate()
     {
-        return "Changes file permissions. Usage: chmod [permissions] [file]";
+        const char *path = getenv("PATH");
+        if (!path)
+            path = "/usr/local/bin:/usr/bin:/bin";
+        if (pathValue != path)
+        {
+            reload(path);
+            return;
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec - lastCheck.tv_sec < 1)
+            return;
+        lastCheck = now;
+        size_t firstChanged = dirs.size() + 1;
+        for (size_t i = 0; i < dirs.size(); ++i)
+        {
+            struct timespec mtime = mtimeOf(dirs[i].path);
+            if (mtime.tv_sec != dirs[i].mtime.tv_sec || mtime.tv_nsec != dirs[i].mtime.tv_nsec)
+            {
+                dirs[i].mtime = mtime;
+                firstChanged = std::min(firstChanged, i);
+            }
+        }
+        for (auto it = entries.begin(); it != entries.end();)
+        {
+            if (it->second.dirIndex >= firstChanged)
+                it = entries.erase(it);
+            else
+                ++it;
+        }
     }
-};
 
-class ChownCommand : public Command
-{
 public:
-    void execute(const std::vector<std::string> &args) override
+    static PathCache &shared()
     {
-        if (args.size() < 3)
+        static PathCache cache;
+        return cache;
+    }
+
+    // Absolute (or slash-containing) path of an executable, or "".
+    std::string resolve(const std::string &name)
+    {
+        if (name.find('/') != std::string::npos)
+            return access(name.c_str(), X_OK) == 0 ? name : "";
+        revalidate();
+        auto it = entries.find(name);
+        if (it != entries.end())
         {
-            std::cout << "Usage: chown [owner][:group] [file]\n";
-            return;
+            // Cheap guard against a binary that was removed since.
+            if (it->second.path.empty() || access(it->second.path.c_str(), X_OK) == 0)
+            {
+                ++it->second.hits;
+                return it->second.path;
+            }
+            entries.erase(it);
         }
-        std::string command = "chown " + args[1] + " " + args[2];
-        system(command.c_str());
+        Entry entry = {"", dirs.size(), 1};
+        struct stat st;
+        for (size_t i = 0; i < dirs.size(); ++i)
+        {
+            std::string candidate = dirs[i].path + "/" + name;
+            if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(candidate.c_str(), X_OK) == 0)
+            {
+                entry.path = candidate;
+                entry.dirIndex = i;
+                break;
+            }
+        }
+        if (entry.dirIndex < firstRelative || firstRelative == dirs.size())
+            entries[name] = entry;
+        return entry.path;
     }
-    std::string helpText() override
+
+    void forget(const std::string &name)
     {
-        return "Changes file owner and group. Usage: chown [owner][:group] [file]";
+        entries.erase(name);
     }
-};
 
-class SortCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    void clear()
     {
-        if (args.size() < 2)
-        {
-            std::cout << "Usage: sort [file]\n";
-            return;
-        }
-        std::string command = "sort " + args[1];
-        system(command.c_str());
+        pathValue.clear();
+        entries.clear();
     }
-    std::string helpText() override
+
+    const std::map<std::string, Entry> &cached()
     {
-        return "Sorts the contents of a file. Usage: sort [file]";
+        revalidate();
+        return entries;
     }
 };
 
-class UniqCommand : public Command
+// Process-wide buffered standard output that std::cout is routed through
+// once the shell starts. Output is kept in a large user-space buffer and
+// written when it fills, at the end of a line when fd 1 is a terminal, or on
+// an explicit flush; chunks bigger than the buffer go out together with the
+// pending bytes in a single writev instead of being copied.
+class OutputSink : public std::streambuf
 {
-public:
-    void execute(const std::vector<std::string> &args) override
-    {
-        if (args.size() < 2)
+private:
+    static const size_t capacity = 1 << 18;
+    std::vector<char> buffer = std::vector<char>(capacity);
+    size_t used = 0;
+    bool lineBuffered = false;
+    std::streambuf *original = nullptr;
+
+    bool writeBoth(const char *data, size_t length)
+    {
+        struct iovec parts[2] = {{buffer.data(), used}, {const_cast<char *>(data), length}};
+        struct iovec *next = parts;
+        int count = used ? 2 : 1;
+        if (!used)
+            next = parts + 1;
+        used = 0;
+        while (count > 0)
         {
-            std::cout << "Usage: uniq [file]\n";
-            return;
+            ssize_t n = writev(STDOUT_FILENO, next, count);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            while (count > 0 && (size_t)n >= next->iov_len)
+            {
+                n -= next->iov_len;
+                ++next;
+                --count;
+            }
+            if (count > 0)
+            {
+                next->iov_base = (char *)next->iov_base + n;
+                next->iov_len -= n;
+            }
         }
-        std::string command = "uniq " + args[1];
-        system(command.c_str());
+        return true;
     }
-    std::string helpText() override
+
+protected:
+    int_type overflow(int_type c) override
     {
-        return "Filters or reports repeated lines in a file. Usage: uniq [file]";
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+            return flush() ? traits_type::not_eof(c) : traits_type::eof();
+        char ch = traits_type::to_char_type(c);
+        return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
     }
-};
 
-class WcCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    std::streamsize xsputn(const char *data, std::streamsize length) override
     {
-        if (args.size() < 2)
-        {
-            std::cout << "Usage: wc [file]\n";
-            return;
-        }
-        std::string command = "wc " + args[1];
-        system(command.c_str());
+        return write(data, length) ? length : 0;
     }
-    std::string helpText() override
+
+    int sync() override
     {
-        return "Counts lines, words, and characters in a file. Usage: wc [file]";
+        return flush() ? 0 : -1;
     }
-};
 
-class DfCommand : public Command
-{
 public:
-    void execute(const std::vector<std::string> &args) override
+    static OutputSink &shared()
     {
-        system("df -h");
+        static OutputSink sink;
+        return sink;
     }
-    std::string helpText() override
+
+    ~OutputSink()
     {
-        return "Reports disk space usage. Usage: df";
+        flush();
+        if (original && std::cout.rdbuf() == this)
+            std::cout.rdbuf(original);
     }
-};
 
-class PingCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    // Points std::cout at the sink and drops the iostream/stdio
+    // synchronisation; the buffering mode follows whether fd 1 is a tty.
+    void install()
     {
-        if (args.size() < 2)
+        std::ios::sync_with_stdio(false);
+        lineBuffered = isatty(STDOUT_FILENO);
+        if (std::cout.rdbuf() != this)
+            original = std::cout.rdbuf(this);
+    }
+
+    bool write(const char *data, size_t length)
+    {
+        if (length > capacity - used)
         {
-            std::cout << "Usage: ping [host]\n";
-            return;
+            if (length >= capacity / 2)
+                return writeBoth(data, length);
+            if (!flush())
+                return false;
         }
-        std::string command = "ping -c 4 " + args[1]; // Ping 4 times by default
-        system(command.c_str());
+        memcpy(buffer.data() + used, data, length);
+        used += length;
+        if (lineBuffered && memchr(data, '\n', length))
+            return flush();
+        return true;
     }
-    std::string helpText() override
+
+    bool flush()
     {
-        return "Checks network connectivity to a host. Usage: ping [host]";
+        if (!used)
+            return true;
+        size_t length = used;
+        used = 0;
+        return writeAll(STDOUT_FILENO, buffer.data(), length);
     }
 };
 
-class EnvCommand : public Command
+void useBufferedOutput()
 {
-public:
-    void execute(const std::vector<std::string> &args) override
+    OutputSink::shared().install();
+}
+
+// Collects everything a builtin writes to standard output: std::cout is
+// pointed at a growable string buffer, and file descriptor 1 at an in-memory
+// file for the builtins that write(2) directly or still run /bin/sh. Captures
+// nest, each restoring whatever was installed before it.
+class OutputCapture
+{
+private:
+    std::stringbuf buffer;
+    std::streambuf *savedBuffer;
+    int savedFd = -1;
+    int memoryFd = -1;
+
+    void restore()
     {
-        if (args.size() == 1)
-        {
-            system("printenv");
-        }
-        else if (args.size() == 3 && args[1] == "set")
+        if (savedFd >= 0)
         {
-            setenv(args[2].c_str(), args[3].c_str(), 1);
-        }
-        else if (args.size() == 2)
-        {
-            std::string value = getenv(args[1].c_str()) ? getenv(args[1].c_str()) : "Not set";
-            std::cout << args[1] << "=" << value << "\n";
+            fflush(stdout);
+            OutputSink::shared().flush();
+            dup2(savedFd, STDOUT_FILENO);
+            close(savedFd);
+            savedFd = -1;
         }
-        else
+        if (savedBuffer)
         {
-            std::cout << "Usage: env [set var value | var]\n";
+            std::cout.flush();
+            std::cout.rdbuf(savedBuffer);
+            savedBuffer = nullptr;
         }
     }
-    std::string helpText() override
-    {
-        return "Displays, sets, or gets environment variables. Usage: env [set var value | var]";
-    }
-};
 
-class LnCommand : public Command
-{
 public:
-    void execute(const std::vector<std::string> &args) override
+    OutputCapture()
     {
-        if (args.size() < 3)
+        std::cout.flush();
+        fflush(stdout);
+        savedBuffer = std::cout.rdbuf(&buffer);
+        memoryFd = memfd_create("dsh-capture", MFD_CLOEXEC);
+        if (memoryFd >= 0)
         {
-            std::cout << "Usage: ln [target] [linkname]\n";
-            return;
+            savedFd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+            if (savedFd < 0 || dup2(memoryFd, STDOUT_FILENO) < 0)
+            {
+                close(memoryFd);
+                memoryFd = -1;
+            }
         }
-        std::string command = "ln -s " + args[1] + " " + args[2];
-        system(command.c_str());
     }
-    std::string helpText() override
+
+    ~OutputCapture()
     {
-        return "Creates a symbolic link. Usage: ln [target] [linkname]";
+        restore();
+        if (memoryFd >= 0)
+            close(memoryFd);
     }
-};
 
-class ChgrpCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    std::string finish()
     {
-        if (args.size() < 3)
+        restore();
+        std::string out = buffer.str();
+        struct stat st;
+        if (memoryFd >= 0 && fstat(memoryFd, &st) == 0 && st.st_size > 0)
         {
-            std::cout << "Usage: chgrp [group] [file]\n";
-            return;
+            size_t offset = out.size();
+            out.resize(offset + st.st_size);
+            ssize_t n = pread(memoryFd, &out[offset], st.st_size, 0);
+            out.resize(offset + std::max<ssize_t>(n, 0));
         }
-        std::string command = "chgrp " + args[1] + " " + args[2];
-        system(command.c_str());
-    }
-    std::string helpText() override
-    {
-        return "Changes the group ownership of a file. Usage: chgrp [group] [file]";
+        return out;
     }
 };
 
-class UptimeCommand : public Command
+// Ignores SIGINT and SIGQUIT for its lifetime, so Ctrl-C reaches only the
+// foreground child while the shell waits for it.
+class InterruptShield
 {
+private:
+    struct sigaction savedInt, savedQuit;
+
 public:
-    void execute(const std::vector<std::string> &args) override
+    InterruptShield()
     {
-        system("uptime");
+        struct sigaction ignore = {};
+        ignore.sa_handler = SIG_IGN;
+        sigemptyset(&ignore.sa_mask);
+        sigaction(SIGINT, &ignore, &savedInt);
+        sigaction(SIGQUIT, &ignore, &savedQuit);
     }
-    std::string helpText() override
+    ~InterruptShield()
     {
-        return "Displays how long the system has been running. Usage: uptime";
+        sigaction(SIGINT, &savedInt, nullptr);
+        sigaction(SIGQUIT, &savedQuit, nullptr);
     }
 };
 
-class FreeCommand : public Command
+// Spawns an already resolved program and waits for it. Returns the
+// shell-style exit status (128 + signal for signalled children), or 127 when
+// it cannot be started. The child's resource usage lands in `usage`, and with
+// `output` its standard output is read from a pipe into that string.
+int runExternalCommand(const std::string &path, const std::vector<std::string> &args, struct rusage *usage = nullptr,
+                       std::string *output = nullptr)
 {
-public:
-    void execute(const std::vector<std::string> &args) override
+    std::vector<char *> argv;
+    for (auto &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+    std::cout << std::flush;
+    int pipeFds[2] = {-1, -1};
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (output)
+    {
+        if (pipe2(pipeFds, O_CLOEXEC) != 0)
+        {
+            perror("pipe");
+            posix_spawn_file_actions_destroy(&actions);
+            return 127;
+        }
+        posix_spawn_file_actions_adddup2(&actions, pipeFds[1], STDOUT_FILENO);
+    }
+    // The child gets default dispositions back for the signals we ignore.
+    InterruptShield shield;
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGQUIT);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+    pid_t pid;
+    int error;
+    {
+        TraceSpan span("spawn", path);
+        error = posix_spawn(&pid, path.c_str(), &actions, &attr, argv.data(), environ);
+    }
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (output)
+    {
+        close(pipeFds[1]);
+        char buffer[65536];
+        ssize_t n;
+        while (error == 0 && (n = read(pipeFds[0], buffer, sizeof(buffer))) != 0)
+        {
+            if (n > 0)
+                output->append(buffer, n);
+            else if (errno != EINTR)
+                break;
+        }
+        close(pipeFds[0]);
+    }
+    if (error != 0)
     {
-        system("free -h");
+        errno = error;
+        perror(args[0].c_str());
+        PathCache::shared().forget(args[0]);
+        return 127;
     }
-    std::string helpText() override
+    int status;
+    struct rusage childUsage;
+    TraceSpan span("wait", std::to_string(pid));
+    while (wait4(pid, &status, 0, &childUsage) < 0)
     {
-        return "Displays the amount of free and used memory in the system. Usage: free";
+        if (errno != EINTR)
+            return 127;
     }
-};
+    if (usage)
+        *usage = childUsage;
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
 
-class WhoCommand : public Command
+// Log-linear latency histogram in the style of HdrHistogram: values below 32
+// get exact buckets, above that each power of two is split into 32 buckets,
+// so any recorded value is reported within ~3% over the full 64-bit range.
+class LatencyHistogram
 {
-public:
-    void execute(const std::vector<std::string> &args) override
+private:
+    static const int subBits = 5;
+    static const uint64_t subCount = 1 << subBits;
+    std::vector<uint64_t> counts = std::vector<uint64_t>((64 - subBits + 1) * subCount);
+    uint64_t total = 0;
+
+    static size_t bucketOf(uint64_t value)
     {
-        system("who");
+        if (value < subCount)
+            return value;
+        int shift = 63 - __builtin_clzll(value) - subBits;
+        return (shift + 1) * subCount + ((value >> shift) & (subCount - 1));
     }
-    std::string helpText() override
+
+    static uint64_t lowerBound(size_t bucket)
     {
-        return "Displays who is logged on. Usage: who";
+        if (bucket < subCount)
+            return bucket;
+        int shift = bucket / subCount - 1;
+        return (subCount + bucket % subCount) << shift;
     }
-};
 
-class TracerouteCommand : public Command
-{
 public:
-    void execute(const std::vector<std::string> &args) override
+    void record(uint64_t value)
     {
-        if (args.size() < 2)
-        {
-            std::cout << "Usage: traceroute [host]\n";
-            return;
-        }
-        std::string command = "traceroute " + args[1];
-        system(command.c_str());
+        ++counts[bucketOf(value)];
+        ++total;
     }
-    std::string helpText() override
+
+    uint64_t count() const
     {
-        return "Traces the route packets take to a network host. Usage: traceroute [host]";
+        return total;
     }
-};
 
-class BashCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    // Value at quantile q (0..1), as the midpoint of its bucket.
+    uint64_t quantile(double q) const
     {
-        std::string command = "bash ";
-        for (int i = 1; i < args.size(); i++)
+        uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q * total)), seen = 0;
+        for (size_t bucket = 0; bucket < counts.size(); ++bucket)
         {
-            command += args[i] + " ";
+            seen += counts[bucket];
+            if (seen >= rank)
+            {
+                uint64_t low = lowerBound(bucket), high = lowerBound(bucket + 1);
+                return low + (high - low) / 2;
+            }
         }
-        system(command.c_str());
+        return 0;
     }
-    std::string helpText() override
+
+    // Non-empty buckets as [low, high) ranges with their counts.
+    std::vector<std::tuple<uint64_t, uint64_t, uint64_t>> buckets() const
     {
-        return "Executes a bash script or command. Usage: bash [command]";
+        std::vector<std::tuple<uint64_t, uint64_t, uint64_t>> out;
+        for (size_t bucket = 0; bucket < counts.size(); ++bucket)
+        {
+            if (counts[bucket])
+                out.emplace_back(lowerBound(bucket), lowerBound(bucket + 1), counts[bucket]);
+        }
+        return out;
     }
 };
 
-class GzipCommand : public Command
+// Per-command latency and resource totals for everything the loop
+// dispatches. External commands are measured exactly with wait4; builtins
+// run in-process, so their CPU is the shell's (and any child's) rusage delta
+// and their max RSS is the shell's high-water mark.
+class CommandStats
 {
 public:
-    void execute(const std::vector<std::string> &args) override
+    struct Totals
+    {
+        LatencyHistogram latency; // microseconds
+        uint64_t failures = 0;
+        uint64_t totalMicros = 0;
+        uint64_t maxMicros = 0;
+        uint64_t userMicros = 0;
+        uint64_t systemMicros = 0;
+        long maxRssKb = 0;
+        bool external = false;
+    };
+
+private:
+    std::map<std::string, Totals> commands;
+
+public:
+    static CommandStats &shared()
     {
-        if (args.size() < 3)
-        {
-            std::cout << "Usage: gzip [option] [file]\n";
-            return;
-        }
-        std::string command = "gzip " + args[1] + " " + args[2];
-        system(command.c_str());
+        static CommandStats stats;
+        return stats;
     }
-    std::string helpText() override
+
+    static uint64_t micros(const struct timeval &time)
     {
-        return "Compress or decompress files using gzip. Usage: gzip [option] [file]";
+        return time.tv_sec * 1000000ULL + time.tv_usec;
     }
-};
 
-class KillCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
-    {
-        if (args.size() < 2)
-        {
-            std::cout << "Usage: kill [pid]\n";
-            return;
-        }
-        std::string command = "kill " + args[1];
-        system(command.c_str());
+    // Adds the counters that grew between two getrusage snapshots to `total`.
+    static void accumulate(struct rusage &total, const struct rusage &before, const struct rusage &after)
+    {
+        uint64_t user = micros(total.ru_utime) + micros(after.ru_utime) - micros(before.ru_utime);
+        uint64_t system = micros(total.ru_stime) + micros(after.ru_stime) - micros(before.ru_stime);
+        total.ru_utime = {(time_t)(user / 1000000), (suseconds_t)(user % 1000000)};
+        total.ru_stime = {(time_t)(system / 1000000), (suseconds_t)(system % 1000000)};
+        total.ru_minflt += after.ru_minflt - before.ru_minflt;
+        total.ru_majflt += after.ru_majflt - before.ru_majflt;
+        total.ru_nvcsw += after.ru_nvcsw - before.ru_nvcsw;
+        total.ru_nivcsw += after.ru_nivcsw - before.ru_nivcsw;
+        total.ru_inblock += after.ru_inblock - before.ru_inblock;
+        total.ru_oublock += after.ru_oublock - before.ru_oublock;
     }
-    std::string helpText() override
+
+    static std::string formatMicros(uint64_t value)
     {
-        return "Send a signal to a process. Usage: kill [pid]";
+        char buffer[32];
+        if (value < 1000)
+            snprintf(buffer, sizeof(buffer), "%lluus", (unsigned long long)value);
+        else if (value < 1000000)
+            snprintf(buffer, sizeof(buffer), "%.1fms", value / 1e3);
+        else
+            snprintf(buffer, sizeof(buffer), "%.2fs", value / 1e6);
+        return buffer;
     }
-};
 
-class AwkCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    void record(const std::string &name, bool external, int status, uint64_t wallMicros, const struct rusage &usage)
+    {
+        Totals &totals = commands[name];
+        totals.external = external;
+        totals.latency.record(wallMicros);
+        totals.failures += status != 0;
+        totals.totalMicros += wallMicros;
+        totals.maxMicros = std::max(totals.maxMicros, wallMicros);
+        totals.userMicros += micros(usage.ru_utime);
+        totals.systemMicros += micros(usage.ru_stime);
+        totals.maxRssKb = std::max(totals.maxRssKb, usage.ru_maxrss);
+    }
+
+    void reset()
     {
-        std::string command = "awk ";
-        for (int i = 1; i < args.size(); i++)
+        commands.clear();
+    }
+
+    const std::map<std::string, Totals> &all() const
+    {
+        return commands;
+    }
+
+    Report report() const
+    {
+        Report report;
+        for (auto &entry : commands)
         {
-            command += args[i] + " ";
+            const Totals &t = entry.second;
+            uint64_t count = t.latency.count();
+            // Bucket midpoints can overshoot the exact maximum.
+            uint64_t p50 = std::min(t.latency.quantile(0.50), t.maxMicros);
+            uint64_t p90 = std::min(t.latency.quantile(0.90), t.maxMicros);
+            uint64_t p99 = std::min(t.latency.quantile(0.99), t.maxMicros);
+            report.row()
+                .text("command", "COMMAND", entry.first)
+                .text("kind", "KIND", t.external ? "external" : "builtin")
+                .number("count", "COUNT", count)
+                .number("failures", "FAIL", t.failures)
+                .number("mean_us", "MEAN", t.totalMicros / count, formatMicros(t.totalMicros / count))
+                .number("p50_us", "P50", p50, formatMicros(p50))
+                .number("p90_us", "P90", p90, formatMicros(p90))
+                .number("p99_us", "P99", p99, formatMicros(p99))
+                .number("max_us", "MAX", t.maxMicros, formatMicros(t.maxMicros))
+                .number("user_us", "USER", t.userMicros, formatMicros(t.userMicros))
+                .number("sys_us", "SYS", t.systemMicros, formatMicros(t.systemMicros))
+                .number("max_rss_kb", "MAXRSS", t.maxRssKb, Report::humanSize(t.maxRssKb * 1024ULL, false));
         }
-        system(command.c_str());
+        return report;
     }
-    std::string helpText() override
+
+    // Writes the JSON report to `path`, e.g. from the DSH_STATS_FILE exit hook.
+    bool dump(const std::string &path) const
     {
-        return "Program for pattern scanning and processing. Usage: awk [program] [file...]";
+        std::string json = report().json(false) + "\n";
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+        bool ok = writeAll(fd, json.data(), json.size());
+        return close(fd) == 0 && ok;
     }
 };
 
-class UnameCommand : public Command
+// Prefix tree over completion candidates. Each terminal keeps a reference
+// count so the same name can come from several sources (a builtin and a
+// PATH directory, or two PATH directories) and be removed independently.
+class CompletionTrie
 {
-public:
-    void execute(const std::vector<std::string> &args) override
+private:
+    struct Node
     {
-        std::string command = "uname ";
-        if (args.size() > 1)
+        std::vector<std::pair<char, uint32_t>> children; // sorted by char
+        uint32_t count = 0;
+    };
+    std::vector<Node> nodes = std::vector<Node>(1);
+
+    uint32_t child(uint32_t node, char c, bool create)
+    {
+        auto &children = nodes[node].children;
+        auto it = std::lower_bound(children.begin(), children.end(), std::make_pair(c, (uint32_t)0));
+        if (it != children.end() && it->first == c)
+            return it->second;
+        if (!create)
+            return 0;
+        uint32_t next = nodes.size();
+        children.insert(it, {c, next});
+        nodes.emplace_back();
+        return next;
+    }
+
+    void collect(uint32_t node, std::string &word, std::vector<std::string> &out) const
+    {
+        if (nodes[node].count)
+            out.push_back(word);
+        for (auto &entry : nodes[node].children)
         {
-            command += args[1];
+            word.push_back(entry.first);
+            collect(entry.second, word, out);
+            word.pop_back();
         }
-        system(command.c_str());
     }
-    std::string helpText() override
+
+public:
+    void insert(const std::string &word)
     {
-        return "Prints system information. Usage: uname [option]";
+        uint32_t node = 0;
+        for (char c : word)
+            node = child(node, c, true);
+        ++nodes[node].count;
     }
-};
 
-class LessCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    void remove(const std::string &word)
     {
-        if (args.size() < 2)
+        uint32_t node = 0;
+        for (char c : word)
         {
-            std::cout << "Usage: less [file]\n";
-            return;
+            if (!(node = child(node, c, false)))
+                return;
         }
-        std::string command = "less " + args[1];
-        system(command.c_str());
+        if (nodes[node].count)
+            --nodes[node].count;
     }
-    std::string helpText() override
+
+    void clear()
     {
-        return "View file contents interactively. Usage: less [file]";
+        nodes.assign(1, Node());
+    }
+
+    // All words starting with `prefix`, in sorted order.
+    std::vector<std::string> complete(const std::string &prefix) const
+    {
+        std::vector<std::string> out;
+        uint32_t node = 0;
+        for (char c : prefix)
+        {
+            if (!(node = const_cast<CompletionTrie *>(this)->child(node, c, false)))
+                return out;
+        }
+        std::string word = prefix;
+        collect(node, word, out);
+        return out;
     }
 };
 
-class DateCommand : public Command
+// Tab completion for the readline prompt. Command words come from a trie of
+// builtins, aliases and PATH executables that is built once and refreshed
+// per PATH directory when that directory's mtime changes. Arguments complete
+// according to the command: directories for cd, command names for help and
+// hash, variable names for setenv/env, and files otherwise. Directory
+// listings are cached by mtime too, so repeated Tab presses do not rescan.
+class CompletionEngine
 {
 public:
-    void execute(const std::vector<std::string> &args) override
+    enum Kind
     {
-        if (args.size() == 1)
+        Files,
+        Directories,
+        Commands,
+        Variables
+    };
+
+private:
+    struct Listing
+    {
+        struct timespec mtime;
+        std::vector<std::pair<std::string, bool>> entries; // sorted; bool = is directory
+    };
+    CommandRegistry *registry = nullptr;
+    CompletionTrie commands;
+    size_t builtinCount = 0;
+    std::string pathValue;
+    std::vector<std::pair<std::string, Listing>> pathDirs;
+    std::map<std::string, Listing> listings;
+    std::map<std::string, Kind> argumentKinds = {{"cd", Directories},  {"rmdir", Directories}, {"help", Commands},
+                                                 {"hash", Commands},   {"time", Commands},     {"setenv", Variables},
+                                                 {"env", Variables}};
+    std::vector<std::string> matches;
+
+    static bool sameTime(const struct timespec &a, const struct timespec &b)
+    {
+        return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+    }
+
+    // Returns the cached listing of `dir`, rereading it only when its mtime
+    // moved. `executablesOnly` keeps regular files with an execute bit.
+    static bool scan(const std::string &dir, Listing &listing, bool executablesOnly)
+    {
+        struct stat st;
+        if (stat(dir.c_str(), &st) != 0)
         {
-            system("date");
+            bool changed = !listing.entries.empty();
+            listing.entries.clear();
+            listing.mtime = {0, 0};
+            return changed;
         }
-        else if (args.size() == 2)
+        if (sameTime(st.st_mtim, listing.mtime) && listing.mtime.tv_sec)
+            return false;
+        listing.mtime = st.st_mtim;
+        listing.entries.clear();
+        int dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR *stream = dirFd >= 0 ? fdopendir(dirFd) : nullptr;
+        if (!stream)
         {
-            std::string command = "date -s \"" + args[1] + "\"";
-            system(command.c_str());
+            if (dirFd >= 0)
+                close(dirFd);
+            return true;
         }
-        else
+        while (struct dirent *entry = readdir(stream))
         {
-            std::cout << "Usage: date [\"new date and time\"]\n";
+            if (entry->d_name[0] == '.' && (!entry->d_name[1] || (entry->d_name[1] == '.' && !entry->d_name[2])))
+                continue;
+            bool isDir = entry->d_type == DT_DIR;
+            if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK || executablesOnly)
+            {
+                struct stat target;
+                if (fstatat(dirfd(stream), entry->d_name, &target, 0) != 0)
+                    continue;
+                isDir = S_ISDIR(target.st_mode);
+                if (executablesOnly && (!S_ISREG(target.st_mode) || !(target.st_mode & 0111)))
+                    continue;
+            }
+            listing.entries.push_back({entry->d_name, isDir});
         }
+        closedir(stream);
+        std::sort(listing.entries.begin(), listing.entries.end());
+        return true;
     }
-    std::string helpText() override
-    {
-        return "Displays or sets the system date and time. Usage: date [\"YYYY-MM-DD HH:MM:SS\"]";
-    }
-};
 
-class MountCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    void refreshCommands()
     {
-        if (args.size() < 3)
+        std::vector<std::string> builtins = registry->names();
+        if (builtins.size() != builtinCount)
         {
-            std::cout << "Usage: mount [source] [target]\n";
-            return;
+            // Builtins and aliases only grow; reinsert them and the PATH names.
+            commands.clear();
+            for (auto &name : builtins)
+                commands.insert(name);
+            builtinCount = builtins.size();
+            for (auto &dir : pathDirs)
+            {
+                for (auto &entry : dir.second.entries)
+                    commands.insert(entry.first);
+            }
+        }
+
+        const char *path = getenv("PATH");
+        std::string value = path ? path : "";
+        if (value != pathValue)
+        {
+            for (auto &dir : pathDirs)
+            {
+                for (auto &entry : dir.second.entries)
+                    commands.remove(entry.first);
+            }
+            pathDirs.clear();
+            pathValue = value;
+            std::stringstream stream(value);
+            std::string dir;
+            while (std::getline(stream, dir, ':'))
+                pathDirs.push_back({dir.empty() ? "." : dir, Listing{{0, 0}, {}}});
+        }
+        for (auto &dir : pathDirs)
+        {
+            std::vector<std::pair<std::string, bool>> previous = dir.second.entries;
+            if (!scan(dir.first, dir.second, true))
+                continue;
+            for (auto &entry : previous)
+                commands.remove(entry.first);
+            for (auto &entry : dir.second.entries)
+                commands.insert(entry.first);
         }
-        std::string command = "mount " + args[1] + " " + args[2];
-        system(command.c_str());
     }
-    std::string helpText() override
+
+    void completeFiles(const std::string &text, bool directoriesOnly)
     {
-        return "Mounts filesystems. Usage: mount [source] [target]";
+        size_t slash = text.rfind('/');
+        std::string shownDir = slash == std::string::npos ? "" : text.substr(0, slash + 1);
+        std::string prefix = slash == std::string::npos ? text : text.substr(slash + 1);
+        std::string dir = shownDir.empty() ? "." : shownDir;
+        if (dir[0] == '~')
+        {
+            const char *home = getenv("HOME");
+            dir = std::string(home ? home : "") + dir.substr(1);
+        }
+        Listing &listing = listings[dir];
+        scan(dir, listing, false);
+        auto it = std::lower_bound(listing.entries.begin(), listing.entries.end(), std::make_pair(prefix, false));
+        for (; it != listing.entries.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+        {
+            if (directoriesOnly && !it->second)
+                continue;
+            if (prefix.empty() && it->first[0] == '.')
+                continue;
+            matches.push_back(shownDir + it->first);
+        }
+        rl_filename_completion_desired = 1;
     }
-};
 
-class UmountCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    void completeVariables(const std::string &text)
     {
-        if (args.size() < 2)
+        for (char **variable = environ; *variable; ++variable)
         {
-            std::cout << "Usage: umount [target]\n";
-            return;
+            const char *equals = strchr(*variable, '=');
+            std::string name(*variable, equals ? equals - *variable : strlen(*variable));
+            if (name.compare(0, text.size(), text) == 0)
+                matches.push_back(name);
         }
-        std::string command = "umount " + args[1];
-        system(command.c_str());
+        std::sort(matches.begin(), matches.end());
     }
-    std::string helpText() override
+
+    static char *generate(const char *, int state)
     {
-        return "Unmounts filesystems. Usage: umount [target]";
+        static size_t next;
+        CompletionEngine &engine = shared();
+        if (state == 0)
+            next = 0;
+        return next < engine.matches.size() ? strdup(engine.matches[next++].c_str()) : nullptr;
     }
-};
 
-class InitCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    static char **attempt(const char *text, int start, int)
     {
-        if (args.size() < 2)
+        CompletionEngine &engine = shared();
+        engine.matches.clear();
+        rl_attempted_completion_over = 1;
+
+        std::istringstream words(std::string(rl_line_buffer, start));
+        std::vector<std::string> before{std::istream_iterator<std::string>{words}, {}};
+        if (before.empty())
         {
-            std::cout << "Usage: init [runlevel]\n";
-            return;
+            engine.refreshCommands();
+            engine.matches = engine.commands.complete(text);
+            // A word with a slash is a path to a program, not a command name.
+            if (strchr(text, '/'))
+                engine.completeFiles(text, false);
         }
-        std::string command = "init " + args[1];
-        system(command.c_str());
-    }
-    std::string helpText() override
-    {
-        return "Changes the runlevel of the system. Usage: init [runlevel]";
+        else
+        {
+            auto kind = engine.argumentKinds.find(before[0]);
+            Kind argument = kind == engine.argumentKinds.end() ? Files : kind->second;
+            if (argument == Commands)
+            {
+                engine.refreshCommands();
+                engine.matches = engine.commands.complete(text);
+            }
+            else if (argument == Variables && (before.size() == 1 || (before.size() == 2 && before[1] == "set")))
+                engine.completeVariables(text);
+            else
+                engine.completeFiles(text, argument == Directories);
+        }
+        return engine.matches.empty() ? nullptr : rl_completion_matches(text, generate);
     }
-};
 
-class LastCommand : public Command
-{
 public:
-    void execute(const std::vector<std::string> &args) override
+    static CompletionEngine &shared()
     {
-        system("last");
+        static CompletionEngine engine;
+        return engine;
     }
-    std::string helpText() override
+
+    void attach(CommandRegistry &commandRegistry)
     {
-        return "Shows a list of last logged in users. Usage: last";
+        registry = &commandRegistry;
+        rl_attempted_completion_function = attempt;
+        rl_bind_key('\t', rl_complete);
     }
+
 };
 
-class NmapCommand : public Command
+// Persistent history shared by every dsh session of a user. Each finished
+// command is appended to ~/.dsh_history as one line
+//     <start ms since epoch>\t<duration ms>\t<exit status>\t<pid>\t<command>
+// under an exclusive flock, after first pulling in whatever other sessions
+// appended since our last read. Reads go through MappedFile. Reverse search
+// uses a trigram index over all entries, built on first use and then kept
+// up to date as entries arrive.
+class CommandHistory
 {
 public:
-    void execute(const std::vector<std::string> &args) override
+    struct Entry
     {
-        std::string command = "nmap ";
-        for (int i = 1; i < args.size(); i++)
-        {
-            command += args[i] + " ";
-        }
-        system(command.c_str());
-    }
-    std::string helpText() override
+        int64_t startMs;
+        uint32_t durationMs;
+        int status;
+        pid_t pid;
+        std::string command;
+    };
+
+private:
+    std::string path;
+    int fd = -1;
+    uint64_t consumed = 0;
+    std::vector<Entry> entries;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> trigrams;
+    size_t indexed = 0;
+    bool indexing = false;
+    static const size_t readlineEntries = 10000;
+
+    static uint32_t trigram(const char *p)
     {
-        return "Network exploration tool and security scanner. Usage: nmap [options]";
+        return (uint32_t)(unsigned char)p[0] << 16 | (uint32_t)(unsigned char)p[1] << 8 | (unsigned char)p[2];
     }
-};
 
-class PsAuxCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    void index(size_t id)
     {
-        system("ps aux");
+        const std::string &command = entries[id].command;
+        for (size_t i = 0; i + 3 <= command.size(); ++i)
+        {
+            auto &postings = trigrams[trigram(command.data() + i)];
+            if (postings.empty() || postings.back() != id)
+                postings.push_back(id);
+        }
     }
-    std::string helpText() override
+
+    void add(Entry entry, bool toReadline)
     {
-        return "Detailed view of currently running processes. Usage: ps aux";
+        if (toReadline)
+            add_history(entry.command.c_str());
+        entries.push_back(std::move(entry));
+        if (indexing)
+            index(entries.size() - 1);
     }
-};
 
-class TcpdumpCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    // Parses complete lines appended since `consumed`; a partially written
+    // trailing line is left for the next call.
+    void readNew(bool toReadline)
     {
-        std::string command = "tcpdump ";
-        for (int i = 1; i < args.size(); i++)
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || (uint64_t)st.st_size <= consumed)
+            return;
+        MappedFile file;
+        if (!file.open(path, consumed, st.st_size - consumed))
+            return;
+        const char *p = file.data(), *end = p + file.size();
+        std::vector<Entry> parsed;
+        while (p < end)
         {
-            command += args[i] + " ";
+            const char *newline = (const char *)memchr(p, '\n', end - p);
+            if (!newline)
+                break;
+            consumed += newline + 1 - p;
+            Entry entry = {0, 0, 0, 0, ""};
+            char *cursor;
+            entry.startMs = strtoll(p, &cursor, 10);
+            entry.durationMs = strtoul(cursor, &cursor, 10);
+            entry.status = strtol(cursor, &cursor, 10);
+            entry.pid = strtol(cursor, &cursor, 10);
+            if (cursor < newline && *cursor == '\t')
+            {
+                entry.command.assign(cursor + 1, newline - cursor - 1);
+                parsed.push_back(std::move(entry));
+            }
+            p = newline + 1;
         }
-        system(command.c_str());
+        size_t skip = parsed.size() > readlineEntries ? parsed.size() - readlineEntries : 0;
+        for (size_t i = 0; i < parsed.size(); ++i)
+            add(std::move(parsed[i]), toReadline && i >= skip);
     }
-    std::string helpText() override
-    {
-        return "Command-line packet analyzer. Usage: tcpdump [options]";
+
+    static int reverseSearch(int, int)
+    {
+        CommandHistory &history = shared();
+        history.sync();
+        std::string original(rl_line_buffer), query;
+        ssize_t match = history.entries.size();
+        bool failed = false;
+        auto show = [&]() {
+            rl_set_prompt(((failed ? "(failed reverse-i-search)`" : "(reverse-i-search)`") + query + "': ").c_str());
+            const std::string &text = match < (ssize_t)history.entries.size() ? history.entries[match].command : original;
+            rl_replace_line(text.c_str(), 0);
+            size_t at = query.empty() ? std::string::npos : text.rfind(query);
+            rl_point = at == std::string::npos ? text.size() : at;
+            rl_redisplay();
+        };
+        auto find = [&](ssize_t before) {
+            ssize_t found = history.search(query, before);
+            // Skip older copies of the command already shown.
+            while (found >= 0 && match < (ssize_t)history.entries.size() &&
+                   history.entries[found].command == history.entries[match].command)
+                found = history.search(query, found);
+            failed = found < 0;
+            if (!failed)
+                match = found;
+        };
+        rl_save_prompt();
+        show();
+        while (true)
+        {
+            int key = rl_read_key();
+            if (key == 18) // Ctrl-R: next older match
+                find(match);
+            else if (key == 7 || key == 27) // Ctrl-G / Esc: abandon
+            {
+                rl_replace_line(original.c_str(), 0);
+                rl_point = rl_end;
+                break;
+            }
+            else if (key == 127 || key == 8)
+            {
+                if (!query.empty())
+                    query.pop_back();
+                match = history.entries.size();
+                find(match);
+            }
+            else if (key >= 32 && key < 127)
+            {
+                query += (char)key;
+                // The current match may still contain the longer query.
+                ssize_t from = match < (ssize_t)history.entries.size() ? match + 1 : match;
+                match = history.entries.size();
+                find(from);
+            }
+            else
+            {
+                if (key == '\r' || key == '\n')
+                    rl_done = 1;
+                else
+                    rl_execute_next(key);
+                break;
+            }
+            show();
+        }
+        rl_restore_prompt();
+        rl_redisplay();
+        return 0;
     }
-};
 
-class TouchCommand : public Command
-{
 public:
-    void execute(const std::vector<std::string> &args) override
+    static CommandHistory &shared()
     {
-        if (args.size() < 2)
-        {
-            std::cout << "Usage: touch [file]\n";
-            return;
-        }
-        std::string command = "touch " + args[1];
-        system(command.c_str());
+        static CommandHistory history;
+        return history;
     }
-    std::string helpText() override
+
+    ~CommandHistory()
     {
-        return "Updates the access and modification times of a file. Usage: touch [file]";
+        if (fd >= 0)
+            close(fd);
     }
-};
 
-class ManCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    void open(const std::string &historyPath)
     {
-        if (args.size() < 2)
-        {
-            std::cout << "Usage: man [command]\n";
+        path = historyPath;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        if (fd < 0)
             return;
-        }
-        std::string command = "man " + args[1];
-        system(command.c_str());
+        flock(fd, LOCK_SH);
+        readNew(true);
+        flock(fd, LOCK_UN);
+        rl_bind_keyseq("\\C-r", reverseSearch);
     }
-    std::string helpText() override
+
+    // Picks up entries other sessions appended since the last read.
+    void sync()
     {
-        return "Displays user manual of any command. Usage: man [command]";
+        if (fd < 0)
+            return;
+        flock(fd, LOCK_SH);
+        readNew(true);
+        flock(fd, LOCK_UN);
     }
-};
 
-class RsyncCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    void record(const std::string &command, int64_t startMs, uint32_t durationMs, int status)
     {
-        std::string command = "rsync ";
-        for (int i = 1; i < args.size(); i++)
+        Entry entry = {startMs, durationMs, status, getpid(), command};
+        if (fd < 0)
         {
-            command += args[i] + " ";
+            add(entry, false);
+            return;
         }
-        system(command.c_str());
+        char prefix[96];
+        int length = snprintf(prefix, sizeof(prefix), "%lld\t%u\t%d\t%d\t", (long long)startMs, durationMs, status, (int)entry.pid);
+        std::string line = std::string(prefix, length) + command + "\n";
+        flock(fd, LOCK_EX);
+        readNew(true);
+        if (writeAll(fd, line.data(), line.size()))
+            consumed += line.size();
+        flock(fd, LOCK_UN);
+        add(entry, false);
     }
-    std::string helpText() override
+
+    const std::vector<Entry> &all() const
     {
-        return "Syncs files and directories between two locations. Usage: rsync [options] [source] [destination]";
+        return entries;
     }
-};
 
-class SqlCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    // Newest entry before `before` whose command contains `query`, or -1.
+    ssize_t search(const std::string &query, ssize_t before)
     {
-        std::string command = "sqlite3 ";
-        for (int i = 1; i < args.size(); i++)
+        before = std::min<ssize_t>(before, entries.size());
+        if (query.size() < 3)
+        {
+            for (ssize_t i = before - 1; i >= 0; --i)
+            {
+                if (entries[i].command.find(query) != std::string::npos)
+                    return i;
+            }
+            return -1;
+        }
+        if (!indexing)
         {
-            command += args[i] + " ";
+            indexing = true;
+            for (; indexed < entries.size(); ++indexed)
+                index(indexed);
         }
-        system(command.c_str());
-    }
-    std::string helpText() override
-    {
-        return "Executes SQL commands or scripts. Usage: sql [database] [SQL command]";
+        // Walk the rarest trigram's posting list; every hit still gets a
+        // substring check since trigrams can match out of order.
+        const std::vector<uint32_t> *rarest = nullptr;
+        for (size_t i = 0; i + 3 <= query.size(); ++i)
+        {
+            auto it = trigrams.find(trigram(query.data() + i));
+            if (it == trigrams.end())
+                return -1;
+            if (!rarest || it->second.size() < rarest->size())
+                rarest = &it->second;
+        }
+        auto it = std::lower_bound(rarest->begin(), rarest->end(), (uint32_t)before);
+        while (it != rarest->begin())
+        {
+            --it;
+            if (entries[*it].command.find(query) != std::string::npos)
+                return *it;
+        }
+        return -1;
     }
 };
 
-class GitCommand : public Command
+// Renders the readline prompt from a format string:
+//     %d  working directory      %~  working directory with $HOME as ~
+//     %u  user name              %h  host name
+//     %g  " (branch)"            %G  " (branch*)" with * when the tree is dirty
+//     %s  " [status]" after a failing command
+//     %t  " 1.2s" after a command that ran for at least a second
+//     %%  a literal %
+// The working directory is only re-read when cd changes it. Git segments are
+// computed on a background thread; rendering waits at most `gitBudgetMs` for
+// a fresh answer and otherwise shows the last known one for that directory,
+// so a slow `git status` in a large repository never blocks the prompt.
+class Prompt
 {
-public:
-    void execute(const std::vector<std::string> &args) override
+private:
+    struct GitInfo
+    {
+        std::string branch;
+        bool dirty = false;
+    };
+    // Shared with the worker thread, which may outlive the Prompt at exit.
+    struct State
+    {
+        std::mutex mutex;
+        std::condition_variable wake, done;
+        std::string pendingDir;
+        bool pendingDirty = false;
+        std::string gitPath;
+        uint64_t requested = 0, completed = 0;
+        std::map<std::string, GitInfo> cache;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    bool workerStarted = false;
+    std::string format = "%d: ";
+    std::string cwd, home, user, host;
+    int lastStatus = 0;
+    uint32_t lastDurationMs = 0;
+    static constexpr int gitBudgetMs = 30;
+
+    static bool readSmallFile(const std::string &path, std::string &out)
+    {
+        char buffer[512];
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        close(fd);
+        if (n <= 0)
+            return false;
+        out.assign(buffer, n);
+        while (!out.empty() && (out.back() == '\n' || out.back() == '\r'))
+            out.pop_back();
+        return true;
+    }
+
+    // Finds the enclosing repository and reads HEAD directly, without
+    // starting git.
+    static std::string gitBranch(const std::string &dir, std::string &workTree)
     {
-        std::string command = "git ";
-        for (int i = 1; i < args.size(); i++)
+        std::string current = dir, contents;
+        while (true)
         {
-            command += args[i] + " ";
+            std::string dotGit = current + (current == "/" ? ".git" : "/.git");
+            struct stat st;
+            if (stat(dotGit.c_str(), &st) == 0)
+            {
+                std::string gitDir = dotGit;
+                // Worktrees and submodules use a "gitdir: <path>" file.
+                if (S_ISREG(st.st_mode) && readSmallFile(dotGit, contents) && contents.compare(0, 8, "gitdir: ") == 0)
+                    gitDir = contents[8] == '/' ? contents.substr(8) : current + "/" + contents.substr(8);
+                if (!readSmallFile(gitDir + "/HEAD", contents))
+                    return "";
+                workTree = current;
+                if (contents.compare(0, 16, "ref: refs/heads/") == 0)
+                    return contents.substr(16);
+                return contents.substr(0, 7);
+            }
+            if (current == "/" || current.empty())
+                return "";
+            size_t slash = current.rfind('/');
+            current = slash == 0 ? "/" : current.substr(0, slash);
         }
-        system(command.c_str());
     }
-    std::string helpText() override
-    {
-        return "Executes Git commands for version control. Usage: git [command]";
+
+    static bool gitDirty(const std::string &git, const std::string &workTree)
+    {
+        int pipeFds[2];
+        if (pipe2(pipeFds, O_CLOEXEC) != 0)
+            return false;
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, pipeFds[1], STDOUT_FILENO);
+        posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+        const char *argv[] = {"git", "-C", workTree.c_str(), "status", "--porcelain", "-uno", nullptr};
+        pid_t pid;
+        bool spawned = !git.empty() && posix_spawn(&pid, git.c_str(), &actions, nullptr, (char **)argv, environ) == 0;
+        posix_spawn_file_actions_destroy(&actions);
+        close(pipeFds[1]);
+        bool dirty = false;
+        char buffer[4096];
+        ssize_t n;
+        while (spawned && (n = read(pipeFds[0], buffer, sizeof(buffer))) != 0)
+        {
+            if (n > 0)
+                dirty = true;
+            else if (errno != EINTR)
+                break;
+        }
+        close(pipeFds[0]);
+        if (spawned)
+            waitpid(pid, nullptr, 0);
+        return dirty;
     }
-};
 
-class PythonCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    static void worker(std::shared_ptr<State> state)
     {
-        std::string command = "python3 ";
-        for (int i = 1; i < args.size(); i++)
+        std::unique_lock<std::mutex> lock(state->mutex);
+        while (true)
         {
-            command += args[i] + " ";
+            state->wake.wait(lock, [&]() { return state->requested != state->completed; });
+            uint64_t generation = state->requested;
+            std::string dir = state->pendingDir;
+            bool wantDirty = state->pendingDirty;
+            std::string git = state->gitPath;
+            lock.unlock();
+            std::string workTree;
+            std::string branch = gitBranch(dir, workTree);
+            // Publish the cheap branch name first, keeping the previous dirty
+            // flag until the slow status check has finished.
+            lock.lock();
+            GitInfo &info = state->cache[dir];
+            if (info.branch != branch)
+                info.dirty = false;
+            info.branch = branch;
+            state->done.notify_all();
+            if (wantDirty && !branch.empty())
+            {
+                lock.unlock();
+                bool dirty = gitDirty(git, workTree);
+                lock.lock();
+                state->cache[dir].dirty = dirty;
+            }
+            state->completed = generation;
+            state->done.notify_all();
         }
-        system(command.c_str());
     }
-    std::string helpText() override
+
+    std::string gitSegment(bool withDirty)
     {
-        return "Executes Python scripts or commands. Usage: python [script or command]";
+        if (!workerStarted)
+        {
+            workerStarted = true;
+            std::thread(worker, state).detach();
+        }
+        std::unique_lock<std::mutex> lock(state->mutex);
+        uint64_t generation = ++state->requested;
+        state->pendingDir = cwd;
+        state->pendingDirty = withDirty;
+        // PathCache is not thread-safe, so resolve git here.
+        if (withDirty)
+            state->gitPath = PathCache::shared().resolve("git");
+        state->wake.notify_one();
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(gitBudgetMs);
+        state->done.wait_until(lock, deadline, [&]() { return state->completed >= generation; });
+        auto it = state->cache.find(cwd);
+        if (it == state->cache.end() || it->second.branch.empty())
+            return "";
+        return " (" + it->second.branch + (withDirty && it->second.dirty ? "*" : "") + ")";
     }
-};
 
-class EnvListCommand : public Command
-{
 public:
-    void execute(const std::vector<std::string> &args) override
+    static Prompt &shared()
     {
-        system("printenv");
+        static Prompt prompt;
+        return prompt;
     }
-    std::string helpText() override
+
+    Prompt()
     {
-        return "Lists all environment variables. Usage: envlist";
+        directoryChanged();
+        const char *homeDir = getenv("HOME");
+        home = homeDir ? homeDir : "";
+        struct passwd *pw = getpwuid(getuid());
+        user = pw ? pw->pw_name : std::to_string(getuid());
+        char name[256] = "";
+        gethostname(name, sizeof(name) - 1);
+        host = std::string(name).substr(0, std::string(name).find('.'));
+    }
+
+    void directoryChanged()
+    {
+        char *dir = getcwd(nullptr, 0);
+        cwd = dir ? dir : "?";
+        free(dir);
+    }
+
+    const std::string &directory() const
+    {
+        return cwd;
+    }
+
+    void setFormat(const std::string &newFormat)
+    {
+        format = newFormat;
+    }
+
+    const std::string &currentFormat() const
+    {
+        return format;
+    }
+
+    void commandFinished(int status, uint32_t durationMs)
+    {
+        lastStatus = status;
+        lastDurationMs = durationMs;
+    }
+
+    std::string render()
+    {
+        std::string out;
+        for (size_t i = 0; i < format.size(); ++i)
+        {
+            if (format[i] != '%' || i + 1 == format.size())
+            {
+                out += format[i];
+                continue;
+            }
+            char buffer[32];
+            switch (format[++i])
+            {
+            case 'd':
+                out += cwd;
+                break;
+            case '~':
+                if (!home.empty() && cwd.compare(0, home.size(), home) == 0 &&
+                    (cwd.size() == home.size() || cwd[home.size()] == '/'))
+                    out += "~" + cwd.substr(home.size());
+                else
+                    out += cwd;
+                break;
+            case 'u':
+                out += user;
+                break;
+            case 'h':
+                out += host;
+                break;
+            case 'g':
+            case 'G':
+                out += gitSegment(format[i] == 'G');
+                break;
+            case 's':
+                if (lastStatus)
+                    out += " [" + std::to_string(lastStatus) + "]";
+                break;
+            case 't':
+                if (lastDurationMs >= 1000)
+                {
+                    snprintf(buffer, sizeof(buffer), " %.1fs", lastDurationMs / 1000.0);
+                    out += buffer;
+                }
+                break;
+            default:
+                out += format[i];
+            }
+        }
+        return out;
     }
 };
 
-class GppCommand : public Command
+// Shell-style wildcard pattern (*, ?, [abc], [a-z], [!x]) compiled once into
+// a small program of literal runs, single-character tests and stars, then
+// matched with the usual greedy scan that backtracks only to the last star.
+class GlobMatcher
 {
+private:
+    enum Kind
+    {
+        Literal,
+        Any,
+        Class,
+        Star
+    };
+    struct Op
+    {
+        Kind kind;
+        std::string literal;
+        std::bitset<256> members;
+    };
+    std::vector<Op> ops;
+
+    bool matchOne(const Op &op, const char *text, size_t length, size_t &consumed) const
+    {
+        if (op.kind == Literal)
+        {
+            consumed = op.literal.size();
+            return length >= consumed && memcmp(text, op.literal.data(), consumed) == 0;
+        }
+        consumed = 1;
+        return length > 0 && (op.kind == Any || op.members.test((unsigned char)*text));
+    }
+
 public:
-    void execute(const std::vector<std::string> &args) override
+    // A backslash makes the next character literal.
+    static bool hasWildcards(const std::string &text)
     {
-        if (args.size() < 2)
+        for (size_t i = 0; i < text.size(); ++i)
         {
-            std::cout << "Usage: g++ [source file]\n";
-            return;
+            if (text[i] == '\\')
+                ++i;
+            else if (text[i] == '*' || text[i] == '?' || text[i] == '[')
+                return true;
         }
-        std::string command = "g++ " + args[1] + " -o " + args[1].substr(0, args[1].find('.')) + " ";
-        system(command.c_str());
+        return false;
     }
-    std::string helpText() override
+
+    static std::string unescape(const std::string &text)
     {
-        return "Compiles C++ source files. Usage: g++ [source file]";
+        std::string out;
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            if (text[i] == '\\' && i + 1 < text.size())
+                ++i;
+            out += text[i];
+        }
+        return out;
+    }
+
+    explicit GlobMatcher(const std::string &pattern)
+    {
+        for (size_t i = 0; i < pattern.size(); ++i)
+        {
+            char c = pattern[i];
+            if (c == '*')
+            {
+                if (ops.empty() || ops.back().kind != Star)
+                    ops.push_back({Star, "", {}});
+                continue;
+            }
+            if (c == '?')
+            {
+                ops.push_back({Any, "", {}});
+                continue;
+            }
+            size_t close = c == '[' ? pattern.find(']', i + 2) : std::string::npos;
+            if (close != std::string::npos)
+            {
+                Op op = {Class, "", {}};
+                size_t j = i + 1;
+                bool negate = pattern[j] == '!' || pattern[j] == '^';
+                if (negate)
+                    ++j;
+                for (; j < close; ++j)
+                {
+                    if (j + 2 < close && pattern[j + 1] == '-')
+                    {
+                        for (int member = (unsigned char)pattern[j]; member <= (unsigned char)pattern[j + 2]; ++member)
+                            op.members.set(member);
+                        j += 2;
+                    }
+                    else
+                        op.members.set((unsigned char)pattern[j]);
+                }
+                if (negate)
+                    op.members.flip();
+                ops.push_back(op);
+                i = close;
+                continue;
+            }
+            if (c == '\\' && i + 1 < pattern.size())
+                c = pattern[++i];
+            if (ops.empty() || ops.back().kind != Literal)
+                ops.push_back({Literal, "", {}});
+            ops.back().literal += c;
+        }
+    }
+
+    bool matches(const char *text, size_t length) const
+    {
+        size_t op = 0, pos = 0, starOp = SIZE_MAX, starPos = 0;
+        while (op < ops.size() || pos < length)
+        {
+            size_t consumed;
+            if (op < ops.size() && ops[op].kind == Star)
+            {
+                starOp = op++;
+                starPos = pos;
+                continue;
+            }
+            if (op < ops.size() && matchOne(ops[op], text + pos, length - pos, consumed))
+            {
+                ++op;
+                pos += consumed;
+                continue;
+            }
+            // Let the last star swallow one more character and retry.
+            if (starOp == SIZE_MAX || starPos >= length)
+                return false;
+            op = starOp + 1;
+            pos = ++starPos;
+        }
+        return true;
     }
 };
 
-class EncryptCommand : public Command
+// Expansion phase applied to a command line before dispatch: $VAR, ${VAR},
+// ${VAR:-default}, ${#VAR}, $? and $$, a leading ~ or ~user, and wildcard
+// patterns, followed by quote removal: the words that come out are the argv
+// every command receives. Nothing inside '...' is expanded, and quoted or
+// backslash-escaped characters match literally in patterns. Directories are
+// read once per command line with getdents64, so matching *.log in a
+// directory of 100k files never stats the files themselves. $(...) and `...` run builtins in-process with their
+// output captured and externals through a pipe, so no subshell is forked.
+class Expander
 {
-public:
-    void execute(const std::vector<std::string> &args) override
+private:
+    struct Listing
+    {
+        std::vector<std::pair<std::string, unsigned char>> entries; // name, d_type
+        bool ok = false;
+    };
+    int lastStatus;
+    CommandRegistry *registry;
+    std::unordered_map<std::string, Listing> listings;
+
+    const Listing &list(const std::string &dir)
     {
-        if (args.size() < 3)
+        auto it = listings.find(dir);
+        if (it != listings.end())
+            return it->second;
+        Listing &listing = listings[dir];
+        int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+            return listing;
+        listing.ok = true;
+        std::vector<char> buffer(1 << 16);
+        while (true)
+        {
+            long n = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+            if (n <= 0)
+                break;
+            for (long offset = 0; offset < n;)
+            {
+                struct Record
+                {
+                    uint64_t ino;
+                    int64_t off;
+                    unsigned short reclen;
+                    unsigned char type;
+                    char name[1];
+                };
+                const Record *record = (const Record *)(buffer.data() + offset);
+                if (strcmp(record->name, ".") && strcmp(record->name, ".."))
+                    listing.entries.emplace_back(record->name, record->type);
+                offset += record->reclen;
+            }
+        }
+        close(fd);
+        return listing;
+    }
+
+    static std::string join(const std::string &dir, const std::string &name)
+    {
+        if (dir.empty())
+            return name;
+        return dir.back() == '/' ? dir + name : dir + "/" + name;
+    }
+
+    bool isDirectory(const std::string &path, unsigned char type)
+    {
+        if (type == DT_DIR)
+            return true;
+        if (type != DT_LNK && type != DT_UNKNOWN)
+            return false;
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+
+    std::vector<std::string> glob(const std::string &pattern)
+    {
+        std::vector<std::string> components;
+        std::stringstream stream(pattern);
+        std::string component;
+        while (std::getline(stream, component, '/'))
+        {
+            if (!component.empty())
+                components.push_back(component);
+        }
+        bool trailingSlash = pattern.size() > 1 && pattern.back() == '/';
+        std::vector<std::string> paths = {pattern[0] == '/' ? "/" : ""};
+        bool globbed = false;
+        for (size_t k = 0; k < components.size() && !paths.empty(); ++k)
+        {
+            bool last = k + 1 == components.size();
+            std::vector<std::string> next;
+            if (!GlobMatcher::hasWildcards(components[k]))
+            {
+                for (auto &path : paths)
+                {
+                    std::string candidate = join(path, GlobMatcher::unescape(components[k]));
+                    struct stat st;
+                    // Only paths produced by an earlier wildcard need checking.
+                    if (!globbed || lstat(candidate.c_str(), &st) == 0)
+                        next.push_back(candidate);
+                }
+            }
+            else
+            {
+                globbed = true;
+                GlobMatcher matcher(components[k]);
+                bool showHidden = components[k][0] == '.';
+                for (auto &path : paths)
+                {
+                    for (auto &entry : list(path).entries)
+                    {
+                        if ((entry.first[0] == '.' && !showHidden) ||
+                            !matcher.matches(entry.first.data(), entry.first.size()))
+                            continue;
+                        std::string candidate = join(path, entry.first);
+                        if ((!last || trailingSlash) && !isDirectory(candidate, entry.second))
+                            continue;
+                        next.push_back(candidate);
+                    }
+                }
+            }
+            paths.swap(next);
+        }
+        std::sort(paths.begin(), paths.end());
+        if (trailingSlash)
+        {
+            for (auto &path : paths)
+                path += '/';
+        }
+        return paths;
+    }
+
+    std::string variable(const std::string &name)
+    {
+        if (name == "?")
+            return std::to_string(lastStatus);
+        if (name == "$")
+            return std::to_string(getpid());
+        const char *value = getenv(name.c_str());
+        return value ? value : "";
+    }
+
+    // Expands one ${...} body.
+    std::string parameter(const std::string &body)
+    {
+        if (!body.empty() && body[0] == '#')
+            return std::to_string(variable(body.substr(1)).size());
+        size_t op = body.find(":-");
+        if (op != std::string::npos)
+        {
+            std::string value = variable(body.substr(0, op));
+            return value.empty() ? body.substr(op + 2) : value;
+        }
+        return variable(body);
+    }
+
+    // Index of the ')' closing the "$(" that starts at `open`, or npos.
+    static size_t closingParen(const std::string &line, size_t open)
+    {
+        int depth = 1;
+        char quote = 0;
+        for (size_t i = open + 1; i < line.size(); ++i)
+        {
+            char c = line[i];
+            if (quote)
+            {
+                if (c == quote)
+                    quote = 0;
+            }
+            else if (c == '\\')
+                ++i;
+            else if (c == '\'' || c == '"')
+                quote = c;
+            else if (c == '(')
+                ++depth;
+            else if (c == ')' && --depth == 0)
+                return i;
+        }
+        return std::string::npos;
+    }
+
+    std::string substitute(const std::string &commandLine)
+    {
+        TraceSpan span("substitution", commandLine);
+        std::vector<std::string> tokens = Expander(lastStatus, registry).expand(commandLine);
+        std::string output;
+        if (!tokens.empty())
+            runCommand(*registry, tokens, nullptr, &output);
+        while (!output.empty() && output.back() == '\n')
+            output.pop_back();
+        return output;
+    }
+
+    // Appends text that must match itself when the word is globbed.
+    static void literal(std::string &pattern, const std::string &text)
+    {
+        for (char c : text)
         {
-            std::cout << "Usage: encrypt [file] [key]\n";
+            if (c == '*' || c == '?' || c == '[' || c == '\\')
+                pattern += '\\';
+            pattern += c;
+        }
+    }
+
+    void emit(std::vector<std::string> &words, const std::string &word, const std::string &pattern, bool hadText,
+              bool wildcard)
+    {
+        // An unquoted expansion that produced nothing leaves no word.
+        if (word.empty() && !hadText)
             return;
+        if (wildcard)
+        {
+            std::vector<std::string> matches = glob(pattern);
+            if (!matches.empty())
+            {
+                words.insert(words.end(), matches.begin(), matches.end());
+                return;
+            }
         }
-        std::string command = "openssl enc -aes-256-cbc -salt -in " + args[1] + " -out " + args[1] + ".enc -k " + args[2];
-        system(command.c_str());
+        words.push_back(word);
     }
-    std::string helpText() override
+
+public:
+    explicit Expander(int status, CommandRegistry *commands = nullptr) : lastStatus(status), registry(commands) {}
+
+    std::vector<std::string> expand(const std::string &line)
     {
-        return "Encrypts a file. Usage: encrypt [file] [key]";
+        std::vector<std::string> words;
+        char quote = 0;
+        size_t i = 0;
+        while (i < line.size())
+        {
+            while (i < line.size() && !quote && isspace((unsigned char)line[i]))
+                ++i;
+            if (i == line.size())
+                break;
+            // `word` is the argument itself, `pattern` the same text for
+            // globbing, with quoted characters escaped.
+            std::string word, pattern;
+            bool hadText = false, wildcard = false, tildeAllowed = true;
+            for (; i < line.size() && (quote || !isspace((unsigned char)line[i])); ++i)
+            {
+                char c = line[i];
+                if (quote == '\'')
+                {
+                    hadText = true;
+                    if (c == '\'')
+                        quote = 0;
+                    else
+                    {
+                        word += c;
+                        literal(pattern, std::string(1, c));
+                    }
+                    continue;
+                }
+                if (c == '\\' && i + 1 < line.size())
+                {
+                    // Inside "..." a backslash only escapes what is special there.
+                    std::string text(1, line[i + 1]);
+                    if (quote && !strchr("$`\"\\\n", line[i + 1]))
+                        text.insert(text.begin(), c);
+                    word += text;
+                    literal(pattern, text);
+                    hadText = true;
+                    ++i;
+                    continue;
+                }
+                if (c == '\'' || c == '"')
+                {
+                    if (quote && quote != c)
+                    {
+                        word += c;
+                        pattern += c;
+                    }
+                    quote = quote == c ? 0 : (quote ? quote : c);
+                    hadText = true;
+                    continue;
+                }
+                if (c == '~' && tildeAllowed && !quote && !hadText)
+                {
+                    size_t end = line.find_first_of("/ \t", i);
+                    if (end == std::string::npos)
+                        end = line.size();
+                    std::string user = line.substr(i + 1, end - i - 1);
+                    const char *home = nullptr;
+                    if (user.empty())
+                        home = getenv("HOME");
+                    else if (struct passwd *pw = getpwnam(user.c_str()))
+                        home = pw->pw_dir;
+                    if (home)
+                    {
+                        word += home;
+                        literal(pattern, home);
+                        hadText = true;
+                        i = end - 1;
+                        tildeAllowed = false;
+                        continue;
+                    }
+                }
+                tildeAllowed = false;
+                size_t close = std::string::npos;
+                if (registry && c == '$' && i + 1 < line.size() && line[i + 1] == '(')
+                    close = closingParen(line, i + 1);
+                else if (registry && c == '`')
+                    close = line.find('`', i + 1);
+                if (close != std::string::npos)
+                {
+                    size_t begin = c == '`' ? i + 1 : i + 2;
+                    std::string output = substitute(line.substr(begin, close - begin));
+                    i = close;
+                    if (quote)
+                    {
+                        word += output;
+                        literal(pattern, output);
+                        continue;
+                    }
+                    // Unquoted output is split into words on whitespace.
+                    std::istringstream fields(output);
+                    std::string field;
+                    bool first = !isspace((unsigned char)output[0]);
+                    while (fields >> field)
+                    {
+                        if (!first)
+                        {
+                            emit(words, word, pattern, hadText, wildcard);
+                            word.clear();
+                            pattern.clear();
+                            wildcard = false;
+                        }
+                        word += field;
+                        pattern += field;
+                        hadText = true;
+                        first = false;
+                    }
+                    if (!output.empty() && isspace((unsigned char)output.back()) && hadText)
+                    {
+                        emit(words, word, pattern, hadText, wildcard);
+                        word.clear();
+                        pattern.clear();
+                        hadText = wildcard = false;
+                    }
+                    continue;
+                }
+                if (c == '$' && i + 1 < line.size())
+                {
+                    char next = line[i + 1];
+                    std::string value;
+                    size_t end = std::string::npos;
+                    if (next == '{' && (end = line.find('}', i + 2)) != std::string::npos)
+                        value = parameter(line.substr(i + 2, end - i - 2));
+                    else if (next == '?' || next == '$')
+                    {
+                        value = variable(std::string(1, next));
+                        end = i + 1;
+                    }
+                    else if (isalpha((unsigned char)next) || next == '_')
+                    {
+                        end = i + 1;
+                        while (end + 1 < line.size() && (isalnum((unsigned char)line[end + 1]) || line[end + 1] == '_'))
+                            ++end;
+                        value = variable(line.substr(i + 1, end - i));
+                    }
+                    if (end != std::string::npos)
+                    {
+                        word += value;
+                        if (quote)
+                            literal(pattern, value);
+                        else
+                            pattern += value;
+                        hadText |= quote != 0 || next == '?' || next == '$';
+                        i = end;
+                        continue;
+                    }
+                }
+                if (!quote && (c == '*' || c == '?' || c == '['))
+                    wildcard = true;
+                word += c;
+                if (quote)
+                    literal(pattern, std::string(1, c));
+                else
+                    pattern += c;
+                hadText = true;
+            }
+            emit(words, word, pattern, hadText, wildcard);
+        }
+        return words;
     }
 };
 
-class DiffCommand : public Command
+// Expands one command line the way the prompt does, for .dshrc.
+std::vector<std::string> expandLine(const std::string &line, CommandRegistry &registry)
+{
+    return Expander(0, &registry).expand(line);
+}
+
+class ListFilesCommand : public Command
 {
 public:
     void execute(const std::vector<std::string> &args) override
     {
-        if (args.size() < 3)
+        const char *directory = (args.size() > 1) ? args[1].c_str() : ".";
+        DIR *dir;
+        struct dirent *ent;
+        if ((dir = opendir(directory)) != NULL)
         {
-            std::cout << "Usage: diff [file1] [file2]\n";
-            return;
+            while ((ent = readdir(dir)) != NULL)
+            {
+                std::cout << ent->d_name << "\n";
+            }
+            closedir(dir);
+        }
+        else
+        {
+            perror("Unable to list directory");
         }
-        std::string command = "diff " + args[1] + " " + args[2];
-        system(command.c_str());
     }
     std::string helpText() override
     {
-        return "Compares files line by line. Usage: diff [file1] [file2]";
+        return "Lists files in the current or specified directory. Usage: ls [directory]";
     }
 };
 
-class IfstatCommand : public Command
+class ListFilesDetailCommand : public Command
 {
 public:
     void execute(const std::vector<std::string> &args) override
     {
-        system("ifstat"); // Assumes ifstat is installed and available
+        const char *directory = ".";
+        if (args.size() > 1)
+            directory = args[1].c_str();
+
+        DIR *dir;
+        struct dirent *ent;
+        struct stat st;
+
+        if ((dir = opendir(directory)) != NULL)
+        {
+            while ((ent = readdir(dir)) != NULL)
+            {
+                std::string fullPath = std::string(directory) + "/" + std::string(ent->d_name);
+                if (stat(fullPath.c_str(), &st) == -1)
+                {
+                    continue;
+                }
+
+                std::cout << (S_ISDIR(st.st_mode) ? 'd' : '-')
+                          << ((st.st_mode & S_IRUSR) ? 'r' : '-')
+                          << ((st.st_mode & S_IWUSR) ? 'w' : '-')
+                          << ((st.st_mode & S_IXUSR) ? 'x' : '-')
+                          << ((st.st_mode & S_IRGRP) ? 'r' : '-')
+                          << ((st.st_mode & S_IWGRP) ? 'w' : '-')
+                          << ((st.st_mode & S_IXGRP) ? 'x' : '-')
+                          << ((st.st_mode & S_IROTH) ? 'r' : '-')
+                          << ((st.st_mode & S_IWOTH) ? 'w' : '-')
+                          << ((st.st_mode & S_IXOTH) ? 'x' : '-')
+                          << ' ' << st.st_nlink
+                          << ' ' << getpwuid(st.st_uid)->pw_name
+                          << ' ' << getgrgid(st.st_gid)->gr_name
+                          << ' ' << st.st_size
+                          << ' ' << ctime(&st.st_mtime)
+                          << ent->d_name << "\n";
+            }
+            closedir(dir);
+        }
+        else
+        {
+            perror("Unable to list directory");
+        }
     }
     std::string helpText() override
     {
-        return "Displays network interface statistics. Usage: ifstat";
+        return "Lists all files in detail. Usage: lsal [directory]";
     }
 };
 
-class HtopCommand : public Command
+class ChangeDirectoryCommand : public Command
 {
 public:
     void execute(const std::vector<std::string> &args) override
     {
-        system("htop"); // Assumes htop is installed
-    }
-    std::string helpText() override
+        if (args.size() < 2)
+        {
+            std::cout << "Insufficient arguments. Usage: cd [directory]\n";
+        }
+        else if (chdir(args[1].c_str()) != 0)
+        {
+            perror("cd failed");
+        }
+        else
+        {
+            Prompt::shared().directoryChanged();
+        }
+    }
+    std::string helpText() override
+    {
+        return "Change the current directory. Usage: cd [directory]";
+    }
+};
+
+class PrintWorkingDirectoryCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        char cwd[1024];
+        if (getcwd(cwd, sizeof(cwd)) != NULL)
+        {
+            std::cout << cwd << "\n";
+        }
+        else
+        {
+            perror("pwd failed");
+        }
+    }
+    std::string helpText() override
+    {
+        return "Prints the current directory. Usage: pwd";
+    }
+};
+
+class HelpCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() == 1)
+        {
+            std::cout << "Display information about available commands. Usage: help [command_name]\n";
+        }
+        else
+        {
+            std::cout << "No help available for \"" << args[1] << "\"\n";
+        }
+    }
+    std::string helpText() override
+    {
+        return "Display information about available commands. Usage: help [command_name]";
+    }
+};
+
+class CopyFileCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 3)
+        {
+            std::cout << "Usage: cp [source] [destination]\n";
+            return;
+        }
+        std::ifstream src(args[1], std::ios::binary);
+        std::ofstream dst(args[2], std::ios::binary);
+        dst << src.rdbuf();
+        src.close();
+        dst.close();
+    }
+    std::string helpText() override
+    {
+        return "Copies a file. Usage: cp [source] [destination]";
+    }
+};
+
+class DeleteFileCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: rm [file]\n";
+            return;
+        }
+        if (remove(args[1].c_str()) != 0)
+        {
+            perror("Error deleting file");
+        }
+        else
+        {
+            std::cout << "File deleted successfully\n";
+        }
+    }
+    std::string helpText() override
+    {
+        return "Deletes a file. Usage: rm [file]";
+    }
+};
+
+class EchoCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            std::cout << args[i] << " ";
+        }
+        std::cout << "\n";
+    }
+    std::string helpText() override
+    {
+        return "Echoes text to the terminal. Usage: echo [text]";
+    }
+};
+
+class MakeDirectoryCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: mkdir [directory]\n";
+            return;
+        }
+        if (mkdir(args[1].c_str(), 0777) != 0)
+        {
+            perror("Error creating directory");
+        }
+        else
+        {
+            std::cout << "Directory created\n";
+        }
+    }
+    std::string helpText() override
+    {
+        return "Creates a directory. Usage: mkdir [directory]";
+    }
+};
+
+class MoveFileCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 3)
+        {
+            std::cout << "Usage: mv [source] [destination]\n";
+            return;
+        }
+        if (rename(args[1].c_str(), args[2].c_str()) != 0)
+        {
+            perror("Error moving file");
+        }
+        else
+        {
+            std::cout << "File moved\n";
+        }
+    }
+    std::string helpText() override
+    {
+        return "Moves a file. Usage: mv [source] [destination]";
+    }
+};
+
+class SystemInfoCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::vector<std::string> options(args);
+        bool json = Report::wantsJson(options);
+        struct utsname names;
+        struct sysinfo si;
+        if (uname(&names) != 0 || sysinfo(&si) != 0)
+        {
+            perror("sysinfo");
+            return;
+        }
+        if (!json)
+        {
+            std::cout << names.sysname << " " << names.nodename << " " << names.release << " " << names.version << " "
+                      << names.machine << " GNU/Linux\n"
+                      << "up " << formatUptime(si.uptime) << ", " << si.procs << " processes, "
+                      << Report::humanSize((uint64_t)si.freeram * si.mem_unit, true) << " free of "
+                      << Report::humanSize((uint64_t)si.totalram * si.mem_unit, true) << " memory\n";
+            return;
+        }
+        Report report;
+        report.row()
+            .text("kernel", "", names.sysname)
+            .text("hostname", "", names.nodename)
+            .text("release", "", names.release)
+            .text("version", "", names.version)
+            .text("machine", "", names.machine)
+            .number("uptime_seconds", "", si.uptime)
+            .number("load1", "", si.loads[0] / (double)(1 << SI_LOAD_SHIFT))
+            .number("load5", "", si.loads[1] / (double)(1 << SI_LOAD_SHIFT))
+            .number("load15", "", si.loads[2] / (double)(1 << SI_LOAD_SHIFT))
+            .number("mem_total", "", (double)si.totalram * si.mem_unit)
+            .number("mem_free", "", (double)si.freeram * si.mem_unit)
+            .number("swap_total", "", (double)si.totalswap * si.mem_unit)
+            .number("swap_free", "", (double)si.freeswap * si.mem_unit)
+            .number("procs", "", si.procs)
+            .number("cpus", "", sysconf(_SC_NPROCESSORS_ONLN));
+        report.print(true);
+    }
+    std::string helpText() override
+    {
+        return "Displays system information. Usage: sysinfo [--json]";
+    }
+};
+
+class SetEnvCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 3)
+        {
+            std::cout << "Insufficient arguments. Usage: setenv [variable] [value]\n";
+        }
+        else
+        {
+            std::cout << "Setting environment variable " << args[1] << " to " << args[2] << "\n";
+            setenv(args[1].c_str(), args[2].c_str(), 1);
+            if (args[1] == "PATH")
+                PathCache::shared().clear();
+        }
+    }
+    std::string helpText() override
+    {
+        return "Set an environment variable. Usage: setenv [variable] [value]";
+    }
+};
+
+class CatCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: cat [file]\n";
+            return;
+        }
+        std::ifstream file(args[1]);
+        std::string line;
+        if (file.is_open())
+        {
+            while (getline(file, line))
+            {
+                std::cout << line << "\n";
+            }
+            file.close();
+        }
+        else
+        {
+            std::cout << "Unable to open file\n";
+        }
+    }
+    std::string helpText() override
+    {
+        return "Displays the content of a file. Usage: cat [file]";
+    }
+};
+
+// Pattern matcher shared by grep and sed. Patterns without regex
+// metacharacters are searched with memmem; everything else is a POSIX
+// basic (or, with `extended`, extended) regex compiled with REG_NEWLINE
+// and run with REG_STARTEND, so matching works directly on mmapped text
+// that spans many lines and is not NUL terminated. glibc serializes
+// regexec on one regex_t, so threads each compile their own matcher.
+class TextMatcher
+{
+private:
+    std::string literal;
+    bool useRegex = false;
+    bool compiled = false;
+    regex_t regex;
+
+public:
+    TextMatcher() = default;
+    TextMatcher(const TextMatcher &) = delete;
+    TextMatcher &operator=(const TextMatcher &) = delete;
+    ~TextMatcher()
+    {
+        if (compiled)
+            regfree(&regex);
+    }
+
+    // Returns an error message, or "" on success.
+    std::string compile(const std::string &pattern, bool extended, bool ignoreCase, bool fixed = false)
+    {
+        const char *special = extended ? ".[]*^$\\+?(){}|" : ".[]*^$\\";
+        useRegex = !fixed && (ignoreCase || pattern.find_first_of(special) != std::string::npos);
+        if (!useRegex)
+        {
+            literal = pattern;
+            return "";
+        }
+        std::string source = pattern;
+        if (fixed)
+        {
+            // -F with -i: escape the text into a basic regex.
+            source.clear();
+            for (char c : pattern)
+            {
+                if (strchr(".[]*^$\\", c))
+                    source += '\\';
+                source += c;
+            }
+        }
+        int flags = REG_NEWLINE | (extended && !fixed ? REG_EXTENDED : 0) | (ignoreCase ? REG_ICASE : 0);
+        int rc = regcomp(&regex, source.c_str(), flags);
+        if (rc != 0)
+        {
+            char message[256];
+            regerror(rc, &regex, message, sizeof(message));
+            return message;
+        }
+        compiled = true;
+        return "";
+    }
+
+    size_t groups() const
+    {
+        return useRegex ? regex.re_nsub + 1 : 1;
+    }
+
+    // Finds the first match in text[from, length). `match` receives up to
+    // `count` groups with offsets relative to `text`.
+    bool find(const char *text, size_t length, size_t from, regmatch_t *match, size_t count) const
+    {
+        if (!useRegex)
+        {
+            const void *hit = literal.empty() ? text + from : memmem(text + from, length - from, literal.data(), literal.size());
+            if (!hit)
+                return false;
+            match[0].rm_so = static_cast<const char *>(hit) - text;
+            match[0].rm_eo = match[0].rm_so + literal.size();
+            for (size_t i = 1; i < count; ++i)
+                match[i].rm_so = match[i].rm_eo = -1;
+            return true;
+        }
+        match[0].rm_so = from;
+        match[0].rm_eo = length;
+        return regexec(&regex, text, count, match, REG_STARTEND) == 0;
+    }
+};
+
+class GrepCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        bool extended = false, fixed = false, ignoreCase = false, invert = false, numbers = false, count = false;
+        size_t i = 1;
+        for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; ++i)
+        {
+            for (char flag : args[i].substr(1))
+            {
+                if (flag == 'E')
+                    extended = true;
+                else if (flag == 'F')
+                    fixed = true;
+                else if (flag == 'i')
+                    ignoreCase = true;
+                else if (flag == 'v')
+                    invert = true;
+                else if (flag == 'n')
+                    numbers = true;
+                else if (flag == 'c')
+                    count = true;
+            }
+        }
+        if (args.size() < i + 2)
+        {
+            std::cout << "Usage: grep [-EFivnc] [pattern] [file...]\n";
+            return;
+        }
+        TextMatcher matcher;
+        std::string error = matcher.compile(args[i], extended, ignoreCase, fixed);
+        if (!error.empty())
+        {
+            std::cout << "grep: " << error << "\n";
+            return;
+        }
+        bool prefix = args.size() > i + 2;
+        for (size_t f = i + 1; f < args.size(); ++f)
+        {
+            TraceSpan span("grep scan", args[f]);
+            MappedFile file;
+            if (!file.open(args[f]))
+            {
+                std::cout << "Unable to open file\n";
+                continue;
+            }
+            const char *data = file.data();
+            size_t size = file.size(), pos = 0, lineNumber = 0, matches = 0;
+            std::string out;
+            regmatch_t match;
+            while (pos < size)
+            {
+                // Without -v or -n whole runs of non-matching lines are
+                // skipped by searching the rest of the file at once.
+                size_t start = pos;
+                if (!invert && !numbers)
+                {
+                    if (!matcher.find(data, size, pos, &match, 1))
+                        break;
+                    const char *lineStart = (const char *)memrchr(data + pos, '\n', match.rm_so - pos);
+                    start = lineStart ? lineStart - data + 1 : pos;
+                }
+                const char *newline = (const char *)memchr(data + start, '\n', size - start);
+                size_t end = newline ? newline - data : size;
+                ++lineNumber;
+                bool hit = invert || numbers ? matcher.find(data, end, start, &match, 1) != invert : true;
+                if (hit)
+                {
+                    ++matches;
+                    if (!count)
+                    {
+                        if (prefix)
+                            out.append(args[f]).append(":");
+                        if (numbers)
+                            out.append(std::to_string(lineNumber)).append(":");
+                        out.append(data + start, end - start).append("\n");
+                        if (out.size() >= (1 << 20))
+                        {
+                            std::cout << out;
+                            out.clear();
+                        }
+                    }
+                }
+                pos = end + 1;
+            }
+            std::cout << out;
+            if (count)
+                std::cout << (prefix ? args[f] + ":" : "") << matches << "\n";
+        }
+    }
+    std::string helpText() override
+    {
+        return "Searches for a text pattern within files (basic regex; -E extended, -F fixed string, -i ignore "
+               "case, -v invert, -n line numbers, -c count). Usage: grep [-EFivnc] [pattern] [file...]";
+    }
+};
+
+// Redraws only the screen rows that changed since the previous frame.
+class TerminalFrame
+{
+private:
+    std::vector<std::string> previous;
+
+public:
+    void reset()
+    {
+        previous.clear();
+    }
+    void render(const std::vector<std::string> &lines)
+    {
+        std::string out;
+        for (size_t row = 0; row < lines.size(); ++row)
+        {
+            if (row < previous.size() && previous[row] == lines[row])
+                continue;
+            out += "\x1b[" + std::to_string(row + 1) + ";1H" + lines[row] + "\x1b[K";
+        }
+        if (lines.size() < previous.size())
+            out += "\x1b[" + std::to_string(lines.size() + 1) + ";1H\x1b[J";
+        previous = lines;
+        writeAll(STDOUT_FILENO, out.data(), out.size());
+    }
+};
+
+class TopCommand : public Command
+{
+private:
+    // One held /proc/[pid]/stat descriptor per process; it is re-read with
+    // pread every tick and only reparsed when its bytes change.
+    struct Tracked
+    {
+        int statFd = -1;
+        std::string lastStat;
+        ProcessInfo info;
+        uint64_t previousTicks = 0;
+        double cpu = 0;
+        bool cmdlineRead = false;
+    };
+
+    struct CpuTimes
+    {
+        uint64_t user = 0, nice = 0, system = 0, idle = 0, iowait = 0, irq = 0, softirq = 0, steal = 0;
+        uint64_t total() const
+        {
+            return user + nice + system + idle + iowait + irq + softirq + steal;
+        }
+    };
+
+    int procFd = -1;
+    int cpuFd = -1;
+    int memFd = -1;
+    int loadFd = -1;
+    std::unordered_map<int, Tracked> tracked;
+    CpuTimes previousCpu, currentCpu;
+    struct timespec previousSample = {0, 0};
+    bool sortByMemory = false;
+    bool showCmdline = false;
+    struct rlimit savedLimit = {0, 0};
+    bool raisedLimit = false;
+
+    static ssize_t preadAll(int fd, char *buffer, size_t size)
+    {
+        ssize_t n = pread(fd, buffer, size - 1, 0);
+        if (n >= 0)
+            buffer[n] = '\0';
+        return n;
+    }
+
+    static uint64_t meminfoValue(const char *data, const char *key)
+    {
+        const char *p = strstr(data, key);
+        return p ? strtoull(p + strlen(key), nullptr, 10) : 0;
+    }
+
+    void openSystemFiles()
+    {
+        if (procFd >= 0)
+            return;
+        procFd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        cpuFd = openat(procFd, "stat", O_RDONLY | O_CLOEXEC);
+        memFd = openat(procFd, "meminfo", O_RDONLY | O_CLOEXEC);
+        loadFd = openat(procFd, "loadavg", O_RDONLY | O_CLOEXEC);
+        // Raised only while top runs; children of the shell keep the old limit.
+        if (getrlimit(RLIMIT_NOFILE, &savedLimit) == 0 && savedLimit.rlim_cur < savedLimit.rlim_max)
+        {
+            struct rlimit limit = savedLimit;
+            limit.rlim_cur = limit.rlim_max;
+            raisedLimit = setrlimit(RLIMIT_NOFILE, &limit) == 0;
+        }
+    }
+
+    void closeAll()
+    {
+        for (auto &entry : tracked)
+        {
+            if (entry.second.statFd >= 0)
+                close(entry.second.statFd);
+        }
+        tracked.clear();
+        for (int *fd : {&cpuFd, &memFd, &loadFd, &procFd})
+        {
+            if (*fd >= 0)
+                close(*fd);
+            *fd = -1;
+        }
+        if (raisedLimit)
+            setrlimit(RLIMIT_NOFILE, &savedLimit);
+        raisedLimit = false;
+    }
+
+    void sample()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double elapsed = previousSample.tv_sec ? (now.tv_sec - previousSample.tv_sec) + (now.tv_nsec - previousSample.tv_nsec) / 1e9 : 0;
+        previousSample = now;
+
+        char buffer[4096];
+        previousCpu = currentCpu;
+        if (preadAll(cpuFd, buffer, sizeof(buffer)) > 0)
+        {
+            unsigned long long v[8] = {};
+            sscanf(buffer, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+            currentCpu = {v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]};
+        }
+
+        std::vector<int> pids = ProcessTable::listPids(procFd);
+        std::unordered_set<int> alive(pids.begin(), pids.end());
+        for (auto it = tracked.begin(); it != tracked.end();)
+        {
+            if (!alive.count(it->first))
+            {
+                if (it->second.statFd >= 0)
+                    close(it->second.statFd);
+                it = tracked.erase(it);
+            }
+            else
+                ++it;
+        }
+
+        char path[64];
+        for (int pid : pids)
+        {
+            auto inserted = tracked.emplace(pid, Tracked());
+            Tracked &t = inserted.first->second;
+            bool fresh = inserted.second;
+            if (t.statFd < 0)
+            {
+                snprintf(path, sizeof(path), "%d/stat", pid);
+                t.statFd = openat(procFd, path, O_RDONLY | O_CLOEXEC);
+                if (t.statFd < 0 && errno != EMFILE && errno != ENFILE)
+                {
+                    tracked.erase(pid);
+                    continue;
+                }
+            }
+            ssize_t n;
+            if (t.statFd >= 0)
+            {
+                n = preadAll(t.statFd, buffer, sizeof(buffer));
+            }
+            else
+            {
+                // Out of descriptors: fall back to opening per tick.
+                snprintf(path, sizeof(path), "%d/stat", pid);
+                int fd = openat(procFd, path, O_RDONLY | O_CLOEXEC);
+                n = fd >= 0 ? preadAll(fd, buffer, sizeof(buffer)) : -1;
+                if (fd >= 0)
+                    close(fd);
+            }
+            if (n <= 0)
+            {
+                if (t.statFd >= 0)
+                    close(t.statFd);
+                tracked.erase(pid);
+                continue;
+            }
+            if (!fresh && t.lastStat.size() == (size_t)n && memcmp(t.lastStat.data(), buffer, n) == 0)
+            {
+                t.cpu = 0;
+                continue;
+            }
+            t.lastStat.assign(buffer, n);
+            std::string oldComm = t.info.comm;
+            ProcessTable::parseStat(buffer, n, t.info);
+            snprintf(path, sizeof(path), "%d/statm", pid);
+            int statm = openat(procFd, path, O_RDONLY | O_CLOEXEC);
+            if (statm >= 0)
+            {
+                ssize_t m = preadAll(statm, buffer, sizeof(buffer));
+                if (m > 0)
+                    ProcessTable::parseStatm(buffer, m, t.info);
+                close(statm);
+            }
+            if (fresh)
+            {
+                snprintf(path, sizeof(path), "%d", pid);
+                struct stat st;
+                if (fstatat(procFd, path, &st, 0) == 0)
+                    t.info.uid = st.st_uid;
+            }
+            if (oldComm != t.info.comm)
+                t.cmdlineRead = false;
+            uint64_t ticks = t.info.utime + t.info.stime;
+            t.cpu = (!fresh && elapsed > 0) ? 100.0 * (ticks - t.previousTicks) / ProcessTable::ticksPerSecond() / elapsed : 0;
+            t.previousTicks = ticks;
+        }
+    }
+
+    void readCmdline(int pid, Tracked &t)
+    {
+        if (t.cmdlineRead)
+            return;
+        char path[64], args[1024];
+        snprintf(path, sizeof(path), "%d/cmdline", pid);
+        int fd = openat(procFd, path, O_RDONLY | O_CLOEXEC);
+        ssize_t n = fd >= 0 ? read(fd, args, sizeof(args)) : -1;
+        if (fd >= 0)
+            close(fd);
+        for (ssize_t i = 0; i < n; ++i)
+        {
+            if (args[i] == '\0')
+                args[i] = ' ';
+        }
+        while (n > 0 && args[n - 1] == ' ')
+            --n;
+        t.info.cmdline.assign(args, n > 0 ? n : 0);
+        t.cmdlineRead = true;
+    }
+
+    std::vector<std::string> frame(size_t height, size_t width)
+    {
+        std::vector<std::string> lines;
+        char line[512];
+        char buffer[4096];
+
+        double up = 0, load1 = 0, load5 = 0, load15 = 0;
+        struct timespec boot;
+        clock_gettime(CLOCK_BOOTTIME, &boot);
+        up = boot.tv_sec;
+        if (preadAll(loadFd, buffer, sizeof(buffer)) > 0)
+            sscanf(buffer, "%lf %lf %lf", &load1, &load5, &load15);
+        time_t now = time(nullptr);
+        struct tm tm;
+        localtime_r(&now, &tm);
+        int days = up / 86400, hours = ((int)up % 86400) / 3600, minutes = ((int)up % 3600) / 60;
+        snprintf(line, sizeof(line), "top - %02d:%02d:%02d up %d days, %2d:%02d,  load average: %.2f, %.2f, %.2f",
+                 tm.tm_hour, tm.tm_min, tm.tm_sec, days, hours, minutes, load1, load5, load15);
+        lines.push_back(line);
+
+        int running = 0, sleeping = 0, stopped = 0, zombie = 0;
+        for (auto &entry : tracked)
+        {
+            char state = entry.second.info.state;
+            running += state == 'R';
+            sleeping += state == 'S' || state == 'D' || state == 'I';
+            stopped += state == 'T' || state == 't';
+            zombie += state == 'Z';
+        }
+        snprintf(line, sizeof(line), "Tasks: %zu total, %d running, %d sleeping, %d stopped, %d zombie",
+                 tracked.size(), running, sleeping, stopped, zombie);
+        lines.push_back(line);
+
+        double total = currentCpu.total() - previousCpu.total();
+        auto share = [total](uint64_t now, uint64_t before) { return total > 0 ? 100.0 * (now - before) / total : 0.0; };
+        snprintf(line, sizeof(line), "%%Cpu(s): %5.1f us, %5.1f sy, %5.1f ni, %5.1f id, %5.1f wa, %5.1f hi, %5.1f si, %5.1f st",
+                 share(currentCpu.user, previousCpu.user), share(currentCpu.system, previousCpu.system),
+                 share(currentCpu.nice, previousCpu.nice), share(currentCpu.idle, previousCpu.idle),
+                 share(currentCpu.iowait, previousCpu.iowait), share(currentCpu.irq, previousCpu.irq),
+                 share(currentCpu.softirq, previousCpu.softirq), share(currentCpu.steal, previousCpu.steal));
+        lines.push_back(line);
+
+        uint64_t memTotal = 0;
+        if (preadAll(memFd, buffer, sizeof(buffer)) > 0)
+        {
+            memTotal = meminfoValue(buffer, "MemTotal:");
+            uint64_t memFree = meminfoValue(buffer, "MemFree:");
+            uint64_t available = meminfoValue(buffer, "MemAvailable:");
+            uint64_t cache = meminfoValue(buffer, "Buffers:") + meminfoValue(buffer, "Cached:") + meminfoValue(buffer, "SReclaimable:");
+            snprintf(line, sizeof(line), "MiB Mem : %8.1f total, %8.1f free, %8.1f used, %8.1f buff/cache",
+                     memTotal / 1024.0, memFree / 1024.0, (memTotal - memFree - std::min(cache, memTotal - memFree)) / 1024.0, cache / 1024.0);
+            lines.push_back(line);
+            uint64_t swapTotal = meminfoValue(buffer, "SwapTotal:"), swapFree = meminfoValue(buffer, "SwapFree:");
+            snprintf(line, sizeof(line), "MiB Swap: %8.1f total, %8.1f free, %8.1f used. %8.1f avail Mem",
+                     swapTotal / 1024.0, swapFree / 1024.0, (swapTotal - swapFree) / 1024.0, available / 1024.0);
+            lines.push_back(line);
+        }
+        lines.push_back("");
+        snprintf(line, sizeof(line), "%7s %-8s %3s %3s %7s %7s %c %5s %5s %9s %s", "PID", "USER", "PR", "NI", "VIRT", "RES",
+                 'S', "%CPU", "%MEM", "TIME+", "COMMAND");
+        lines.push_back(line);
+
+        std::vector<std::pair<int, Tracked *>> order;
+        order.reserve(tracked.size());
+        for (auto &entry : tracked)
+            order.emplace_back(entry.first, &entry.second);
+        size_t rows = height > lines.size() ? height - lines.size() : 0;
+        auto byLoad = [this](const std::pair<int, Tracked *> &a, const std::pair<int, Tracked *> &b) {
+            if (sortByMemory ? a.second->info.rssPages != b.second->info.rssPages : a.second->cpu != b.second->cpu)
+                return sortByMemory ? a.second->info.rssPages > b.second->info.rssPages : a.second->cpu > b.second->cpu;
+            return a.first < b.first;
+        };
+        rows = std::min(rows, order.size());
+        std::partial_sort(order.begin(), order.begin() + rows, order.end(), byLoad);
+        long page = ProcessTable::pageSize();
+        for (size_t i = 0; i < rows; ++i)
+        {
+            Tracked &t = *order[i].second;
+            const ProcessInfo &p = t.info;
+            uint64_t centis = (p.utime + p.stime) * 100 / ProcessTable::ticksPerSecond();
+            char time[32];
+            snprintf(time, sizeof(time), "%llu:%02llu.%02llu", (unsigned long long)centis / 6000,
+                     (unsigned long long)(centis / 100) % 60, (unsigned long long)centis % 100);
+            if (showCmdline)
+                readCmdline(order[i].first, t);
+            std::string command = showCmdline && !p.cmdline.empty() ? p.cmdline : p.comm;
+            snprintf(line, sizeof(line), "%7d %-8.8s %3lld %3lld %7llu %7llu %c %5.1f %5.1f %9s %s", p.pid,
+                     ProcessTable::userName(p.uid).c_str(), (long long)p.priority, (long long)p.nice,
+                     (unsigned long long)p.vsize / 1024, (unsigned long long)p.rssPages * page / 1024, p.state, t.cpu,
+                     memTotal ? 100.0 * p.rssPages * page / 1024 / memTotal : 0.0, time, command.c_str());
+            lines.push_back(line);
+        }
+        for (auto &l : lines)
+        {
+            if (l.size() > width)
+                l.resize(width);
+        }
+        return lines;
+    }
+
+public:
+    ~TopCommand()
+    {
+        closeAll();
+    }
+    void execute(const std::vector<std::string> &args) override
+    {
+        double delay = 2.0;
+        long iterations = -1;
+        bool batch = !isatty(STDOUT_FILENO) || !isatty(STDIN_FILENO);
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if (args[i] == "-d" && i + 1 < args.size())
+                delay = std::max(0.1, atof(args[++i].c_str()));
+            else if (args[i] == "-n" && i + 1 < args.size())
+                iterations = atol(args[++i].c_str());
+            else if (args[i] == "-b")
+                batch = true;
+            else if (args[i] == "-c")
+                showCmdline = true;
+            else
+            {
+                std::cout << "Usage: top [-d seconds] [-n iterations] [-b] [-c]\n";
+                return;
+            }
+        }
+        if (batch && iterations < 0)
+            iterations = 1;
+
+        openSystemFiles();
+        if (procFd < 0)
+        {
+            perror("top: /proc");
+            return;
+        }
+        std::cout << std::flush;
+        // Prime the counters so the first frame already shows deltas.
+        sample();
+        usleep((useconds_t)(std::min(delay, 0.5) * 1e6));
+
+        struct termios saved;
+        TerminalFrame screen;
+        if (!batch)
+        {
+            tcgetattr(STDIN_FILENO, &saved);
+            struct termios raw = saved;
+            raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+            raw.c_cc[VMIN] = 0;
+            raw.c_cc[VTIME] = 0;
+            tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+            const char *enter = "\x1b[?1049h\x1b[?25l\x1b[H\x1b[2J";
+            writeAll(STDOUT_FILENO, enter, strlen(enter));
+        }
+        for (long tick = 0; iterations < 0 || tick < iterations; ++tick)
+        {
+            sample();
+            struct winsize ws = {};
+            size_t height = 50, width = 200;
+            if (!batch && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0)
+            {
+                height = ws.ws_row;
+                width = ws.ws_col;
+            }
+            std::vector<std::string> lines = frame(batch ? SIZE_MAX : height, batch ? SIZE_MAX : width);
+            if (batch)
+            {
+                std::string out;
+                for (auto &l : lines)
+                    out += l + "\n";
+                out += "\n";
+                writeAll(STDOUT_FILENO, out.data(), out.size());
+                if (tick + 1 < iterations)
+                    usleep((useconds_t)(delay * 1e6));
+                continue;
+            }
+            screen.render(lines);
+            struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+            bool quit = false;
+            if (poll(&input, 1, (int)(delay * 1000)) > 0)
+            {
+                char key = 0;
+                if (read(STDIN_FILENO, &key, 1) == 1)
+                {
+                    quit = key == 'q' || key == 3;
+                    if (key == 'M' || key == 'P')
+                        sortByMemory = key == 'M';
+                    if (key == 'c')
+                        showCmdline = !showCmdline;
+                }
+            }
+            if (quit)
+                break;
+        }
+        if (!batch)
+        {
+            const char *leave = "\x1b[?25h\x1b[?1049l";
+            writeAll(STDOUT_FILENO, leave, strlen(leave));
+            tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+        }
+        closeAll();
+        previousSample = {0, 0};
+        currentCpu = previousCpu = CpuTimes();
+    }
+    std::string helpText() override
+    {
+        return "Displays real-time system resource usage (q quits, M/P sort, c command lines). Usage: top [-d seconds] [-n iterations] [-b] [-c]";
+    }
+};
+
+class IfconfigCommand : public Command
+{
+private:
+    static std::string flagNames(unsigned flags)
+    {
+        static const std::pair<unsigned, const char *> names[] = {
+            {IFF_UP, "UP"},           {IFF_BROADCAST, "BROADCAST"}, {IFF_DEBUG, "DEBUG"},
+            {IFF_LOOPBACK, "LOOPBACK"}, {IFF_POINTOPOINT, "POINTOPOINT"}, {IFF_RUNNING, "RUNNING"},
+            {IFF_NOARP, "NOARP"},     {IFF_PROMISC, "PROMISC"},     {IFF_ALLMULTI, "ALLMULTI"},
+            {IFF_MASTER, "MASTER"},   {IFF_SLAVE, "SLAVE"},         {IFF_MULTICAST, "MULTICAST"}};
+        std::string out;
+        for (auto &name : names)
+        {
+            if (flags & name.first)
+                out += (out.empty() ? "" : ",") + std::string(name.second);
+        }
+        return out;
+    }
+
+    static std::string netmask(int prefix)
+    {
+        uint32_t mask = prefix ? htonl(0xffffffffu << (32 - prefix)) : 0;
+        char text[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &mask, text, sizeof(text));
+        return text;
+    }
+
+    static std::string scopeName(int scope)
+    {
+        if (scope == RT_SCOPE_HOST)
+            return "0x10<host>";
+        if (scope == RT_SCOPE_LINK)
+            return "0x20<link>";
+        if (scope == RT_SCOPE_SITE)
+            return "0x40<site>";
+        return "0x0<global>";
+    }
+
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        bool all = false;
+        std::string only;
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if (args[i] == "-a")
+                all = true;
+            else if (only.empty() && args[i][0] != '-')
+                only = args[i];
+            else
+            {
+                std::cout << "Usage: ifconfig [-a] [interface]\n";
+                return;
+            }
+        }
+        std::vector<InterfaceInfo> interfaces;
+        NetDevCounters devices;
+        std::map<std::string, NetDevCounters::Counters> counters;
+        if (!queryInterfaces(interfaces) || !devices.sample(counters))
+        {
+            perror("ifconfig");
+            return;
+        }
+
+        std::ostringstream out;
+        bool found = false;
+        for (auto &entry : interfaces)
+        {
+            if (only.empty() ? !(all || (entry.flags & IFF_UP)) : entry.name != only)
+                continue;
+            found = true;
+            out << entry.name << ": flags=" << (entry.flags & 0xffff) << "<" << flagNames(entry.flags) << ">  mtu " << entry.mtu
+                << "\n";
+            for (auto &address : entry.addresses)
+            {
+                if (address.family == AF_INET)
+                {
+                    out << "        inet " << address.address << "  netmask " << netmask(address.prefix);
+                    if (!address.broadcast.empty())
+                        out << "  broadcast " << address.broadcast;
+                    out << "\n";
+                }
+                else if (address.family == AF_INET6)
+                    out << "        inet6 " << address.address << "  prefixlen " << address.prefix << "  scopeid "
+                        << scopeName(address.scope) << "\n";
+            }
+            if (entry.flags & IFF_LOOPBACK)
+                out << "        loop  txqueuelen " << entry.txQueue << "  (Local Loopback)\n";
+            else if (!entry.mac.empty())
+                out << "        ether " << entry.mac << "  txqueuelen " << entry.txQueue << "  (Ethernet)\n";
+            auto it = counters.find(entry.name);
+            if (it != counters.end())
+            {
+                const NetDevCounters::Counters &c = it->second;
+                out << "        RX packets " << c.rxPackets << "  bytes " << c.rxBytes << " ("
+                    << Report::humanSize(c.rxBytes, false) << ")\n"
+                    << "        RX errors " << c.rxErrors << "  dropped " << c.rxDropped << "  overruns " << c.rxFifo
+                    << "  frame " << c.rxFrame << "\n"
+                    << "        TX packets " << c.txPackets << "  bytes " << c.txBytes << " ("
+                    << Report::humanSize(c.txBytes, false) << ")\n"
+                    << "        TX errors " << c.txErrors << "  dropped " << c.txDropped << " overruns " << c.txFifo
+                    << "  carrier " << c.txCarrier << "  collisions " << c.txCollisions << "\n";
+            }
+            out << "\n";
+        }
+        if (!only.empty() && !found)
+            std::cout << only << ": error fetching interface information: Device not found\n";
+        std::cout << out.str();
+    }
+    std::string helpText() override
+    {
+        return "Lists network interface configurations. Usage: ifconfig [-a] [interface]";
+    }
+};
+
+class FindCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 3)
+        {
+            std::cout << "Usage: find [directory] [pattern]\n";
+            return;
+        }
+        std::string command = "find " + shellQuote(args[1]) + " -name " + shellQuote(args[2]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Search for files matching a pattern. Usage: find [directory] [pattern]";
+    }
+};
+
+class WgetCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: wget [url]\n";
+            return;
+        }
+        std::string command = "wget " + shellQuote(args[1]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Download files from the internet. Usage: wget [url]";
+    }
+};
+
+class HexDumpCommand : public Command
+{
+private:
+    // "00000000  hh hh hh hh hh hh hh hh  hh hh hh hh hh hh hh hh  |................|\n"
+    static const size_t rowWidth = 79;
+    char hexPairs[256][2];
+
+    static bool parseSize(const std::string &text, uint64_t &value)
+    {
+        char *end = nullptr;
+        errno = 0;
+        value = strtoull(text.c_str(), &end, 0);
+        if (errno != 0 || end == text.c_str())
+            return false;
+        switch (*end)
+        {
+        case 'k': case 'K': value <<= 10; ++end; break;
+        case 'm': case 'M': value <<= 20; ++end; break;
+        case 'g': case 'G': value <<= 30; ++end; break;
+        }
+        return *end == '\0';
+    }
+
+    size_t formatOffset(char *out, uint64_t offset)
+    {
+        if (offset >> 32)
+            return sprintf(out, "%08llx", (unsigned long long)offset);
+        for (int i = 3; i >= 0; --i, offset >>= 8)
+            memcpy(out + i * 2, hexPairs[offset & 0xff], 2);
+        return 8;
+    }
+
+    // Full 16-byte rows: hex digits and the printable column are computed
+    // sixteen bytes at a time, then dropped into the fixed row layout.
+    size_t formatRow(char *out, uint64_t offset, const unsigned char *bytes)
+    {
+        size_t pos = formatOffset(out, offset);
+        char *hex = out + pos + 2;
+        memset(out + pos, ' ', 2);
+#ifdef __SSE2__
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes));
+        __m128i nibbleMask = _mm_set1_epi8(0x0f);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibbleMask);
+        __m128i lo = _mm_and_si128(v, nibbleMask);
+        __m128i nine = _mm_set1_epi8(9);
+        __m128i zero = _mm_set1_epi8('0');
+        __m128i letterGap = _mm_set1_epi8('a' - '0' - 10);
+        hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), letterGap));
+        lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), letterGap));
+        alignas(16) char digits[32];
+        _mm_store_si128(reinterpret_cast<__m128i *>(digits), _mm_unpacklo_epi8(hi, lo));
+        _mm_store_si128(reinterpret_cast<__m128i *>(digits + 16), _mm_unpackhi_epi8(hi, lo));
+        __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)),
+                                          _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+        __m128i ascii = _mm_or_si128(_mm_and_si128(printable, v),
+                                     _mm_andnot_si128(printable, _mm_set1_epi8('.')));
+        for (int i = 0; i < 16; ++i)
+        {
+            char *cell = hex + i * 3 + (i >= 8);
+            cell[0] = digits[i * 2];
+            cell[1] = digits[i * 2 + 1];
+            cell[2] = ' ';
+        }
+        hex[24] = ' ';
+        hex[49] = ' ';
+        hex[50] = '|';
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(hex + 51), ascii);
+#else
+        for (int i = 0; i < 16; ++i)
+        {
+            char *cell = hex + i * 3 + (i >= 8);
+            memcpy(cell, hexPairs[bytes[i]], 2);
+            cell[2] = ' ';
+            hex[51 + i] = (bytes[i] >= 0x20 && bytes[i] < 0x7f) ? bytes[i] : '.';
+        }
+        hex[24] = ' ';
+        hex[49] = ' ';
+        hex[50] = '|';
+#endif
+        hex[67] = '|';
+        hex[68] = '\n';
+        return pos + 2 + 69;
+    }
+
+    size_t formatPartialRow(char *out, uint64_t offset, const unsigned char *bytes, size_t count)
+    {
+        size_t pos = formatOffset(out, offset);
+        char *hex = out + pos + 2;
+        memset(out + pos, ' ', 2 + 50);
+        for (size_t i = 0; i < count; ++i)
+            memcpy(hex + i * 3 + (i >= 8), hexPairs[bytes[i]], 2);
+        hex[50] = '|';
+        for (size_t i = 0; i < count; ++i)
+            hex[51 + i] = (bytes[i] >= 0x20 && bytes[i] < 0x7f) ? bytes[i] : '.';
+        hex[51 + count] = '|';
+        hex[52 + count] = '\n';
+        return pos + 2 + 53 + count;
+    }
+
+public:
+    HexDumpCommand()
+    {
+        static const char digits[] = "0123456789abcdef";
+        for (int i = 0; i < 256; ++i)
+        {
+            hexPairs[i][0] = digits[i >> 4];
+            hexPairs[i][1] = digits[i & 0xf];
+        }
+    }
+    void execute(const std::vector<std::string> &args) override
+    {
+        uint64_t offset = 0, length = UINT64_MAX;
+        bool squeeze = true;
+        std::string path;
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if ((args[i] == "-s" || args[i] == "-n") && i + 1 < args.size())
+            {
+                if (!parseSize(args[i + 1], args[i] == "-s" ? offset : length))
+                {
+                    std::cout << "hexdump: invalid size " << args[i + 1] << "\n";
+                    return;
+                }
+                ++i;
+            }
+            else if (args[i] == "-v")
+                squeeze = false;
+            else if (args[i] == "-C")
+                continue;
+            else
+                path = args[i];
+        }
+        if (path.empty())
+        {
+            std::cout << "Usage: hexdump [-s offset] [-n length] [-v] [file]\n";
+            return;
+        }
+        MappedFile file;
+        if (!file.open(path, offset, length))
+        {
+            perror("hexdump");
+            return;
+        }
+
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(file.data());
+        size_t size = file.size();
+        std::vector<char> buffer(1 << 20);
+        size_t used = 0;
+        bool starred = false;
+        for (size_t pos = 0; pos < size; pos += 16)
+        {
+            if (buffer.size() - used < rowWidth + 16)
+            {
+                if (!OutputSink::shared().write(buffer.data(), used))
+                    return;
+                used = 0;
+            }
+            if (size - pos < 16)
+            {
+                used += formatPartialRow(&buffer[used], offset + pos, bytes + pos, size - pos);
+                break;
+            }
+            if (squeeze && pos > 0 && memcmp(bytes + pos, bytes + pos - 16, 16) == 0)
+            {
+                if (!starred)
+                    buffer[used++] = '*', buffer[used++] = '\n';
+                starred = true;
+                continue;
+            }
+            starred = false;
+            used += formatRow(&buffer[used], offset + pos, bytes + pos);
+        }
+        if (size > 0 || offset > 0)
+        {
+            used += formatOffset(&buffer[used], offset + size);
+            buffer[used++] = '\n';
+        }
+        OutputSink::shared().write(buffer.data(), used);
+    }
+    std::string helpText() override
+    {
+        return "Display file content in hexadecimal format. Usage: hexdump [-s offset] [-n length] [-v] [file]";
+    }
+};
+
+class PsCommand : public Command
+{
+protected:
+    struct Column
+    {
+        const char *name;
+        const char *header;
+        bool rightAlign;
+    };
+
+    static const std::vector<Column> &columns()
+    {
+        static const std::vector<Column> all = {
+            {"user", "USER", false}, {"pid", "PID", true}, {"ppid", "PPID", true}, {"uid", "UID", true},
+            {"pcpu", "%CPU", true}, {"pmem", "%MEM", true}, {"vsz", "VSZ", true}, {"rss", "RSS", true},
+            {"tty", "TTY", false}, {"stat", "STAT", false}, {"start", "START", false}, {"time", "TIME", true},
+            {"nlwp", "NLWP", true}, {"pri", "PRI", true}, {"ni", "NI", true}, {"comm", "COMMAND", false},
+            {"args", "COMMAND", false}};
+        return all;
+    }
+
+    struct Context
+    {
+        double uptime;
+        time_t now;
+        uint64_t memTotalKiB;
+    };
+
+    static double cpuPercent(const ProcessInfo &p, const Context &ctx)
+    {
+        double elapsed = ctx.uptime - (double)p.startTime / ProcessTable::ticksPerSecond();
+        if (elapsed <= 0)
+            return 0;
+        return 100.0 * (p.utime + p.stime) / ProcessTable::ticksPerSecond() / elapsed;
+    }
+
+    static double memPercent(const ProcessInfo &p, const Context &ctx)
+    {
+        return ctx.memTotalKiB ? 100.0 * p.rssPages * ProcessTable::pageSize() / 1024 / ctx.memTotalKiB : 0;
+    }
+
+    static std::string value(const std::string &column, const ProcessInfo &p, const Context &ctx)
+    {
+        char buffer[64];
+        if (column == "user")
+            return ProcessTable::userName(p.uid);
+        if (column == "pid")
+            return std::to_string(p.pid);
+        if (column == "ppid")
+            return std::to_string(p.ppid);
+        if (column == "uid")
+            return std::to_string(p.uid);
+        if (column == "pcpu")
+        {
+            snprintf(buffer, sizeof(buffer), "%.1f", cpuPercent(p, ctx));
+            return buffer;
+        }
+        if (column == "pmem")
+        {
+            snprintf(buffer, sizeof(buffer), "%.1f", memPercent(p, ctx));
+            return buffer;
+        }
+        if (column == "vsz")
+            return std::to_string(p.vsize / 1024);
+        if (column == "rss")
+            return std::to_string(p.rssPages * ProcessTable::pageSize() / 1024);
+        if (column == "tty")
+            return ProcessTable::ttyName(p.tty);
+        if (column == "stat")
+            return std::string(1, p.state) + (p.nice < 0 ? "<" : p.nice > 0 ? "N" : "") + (p.threads > 1 ? "l" : "");
+        if (column == "start")
+        {
+            time_t started = ctx.now - (time_t)(ctx.uptime - (double)p.startTime / ProcessTable::ticksPerSecond());
+            struct tm tm, today;
+            localtime_r(&started, &tm);
+            localtime_r(&ctx.now, &today);
+            bool sameDay = tm.tm_yday == today.tm_yday && tm.tm_year == today.tm_year;
+            strftime(buffer, sizeof(buffer), sameDay ? "%H:%M" : tm.tm_year == today.tm_year ? "%b%d" : "%Y", &tm);
+            return buffer;
+        }
+        if (column == "time")
+        {
+            uint64_t seconds = (p.utime + p.stime) / ProcessTable::ticksPerSecond();
+            snprintf(buffer, sizeof(buffer), "%llu:%02llu", (unsigned long long)seconds / 60, (unsigned long long)seconds % 60);
+            return buffer;
+        }
+        if (column == "nlwp")
+            return std::to_string(p.threads);
+        if (column == "pri")
+            return std::to_string(p.priority);
+        if (column == "ni")
+            return std::to_string(p.nice);
+        if (column == "comm")
+            return p.comm;
+        if (column == "args")
+            return p.cmdline.empty() ? std::string("[") + p.comm + "]" : p.cmdline;
+        return "";
+    }
+
+    static bool less(const std::string &column, const ProcessInfo &a, const ProcessInfo &b, const Context &ctx)
+    {
+        if (column == "pid") return a.pid < b.pid;
+        if (column == "ppid") return a.ppid < b.ppid;
+        if (column == "uid") return a.uid < b.uid;
+        if (column == "pcpu") return cpuPercent(a, ctx) < cpuPercent(b, ctx);
+        if (column == "pmem" || column == "rss") return a.rssPages < b.rssPages;
+        if (column == "vsz") return a.vsize < b.vsize;
+        if (column == "time") return a.utime + a.stime < b.utime + b.stime;
+        if (column == "start") return a.startTime < b.startTime;
+        if (column == "nlwp") return a.threads < b.threads;
+        if (column == "ni") return a.nice < b.nice;
+        if (column == "pri") return a.priority < b.priority;
+        return value(column, a, ctx) < value(column, b, ctx);
+    }
+
+    static std::vector<std::string> split(const std::string &text)
+    {
+        std::vector<std::string> parts;
+        std::istringstream stream(text);
+        std::string part;
+        while (getline(stream, part, ','))
+        {
+            if (!part.empty())
+                parts.push_back(part);
+        }
+        return parts;
+    }
+
+    void print(const std::vector<std::string> &args, const std::string &defaultColumns)
+    {
+        std::vector<std::string> selected = split(defaultColumns);
+        std::vector<std::string> sortKeys;
+        std::set<std::string> users, commands;
+        std::set<int> pids;
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if (args[i] == "aux" || args[i] == "-ef" || args[i] == "-e")
+                continue;
+            if (i + 1 >= args.size())
+            {
+                std::cout << "Usage: " << helpText().substr(helpText().find("Usage: ") + 7) << "\n";
+                return;
+            }
+            if (args[i] == "-o")
+                selected = split(args[++i]);
+            else if (args[i] == "--sort")
+                sortKeys = split(args[++i]);
+            else if (args[i] == "-u")
+                for (auto &user : split(args[++i]))
+                    users.insert(user);
+            else if (args[i] == "-p")
+                for (auto &pid : split(args[++i]))
+                    pids.insert(atoi(pid.c_str()));
+            else if (args[i] == "-C")
+                for (auto &command : split(args[++i]))
+                    commands.insert(command);
+            else
+            {
+                std::cout << "ps: unknown option " << args[i] << "\n";
+                return;
+            }
+        }
+        for (auto &column : selected)
+        {
+            auto known = std::find_if(columns().begin(), columns().end(), [&](const Column &c) { return column == c.name; });
+            if (known == columns().end())
+            {
+                std::cout << "ps: unknown column " << column << "\n";
+                return;
+            }
+        }
+
+        bool needCmdline = std::find(selected.begin(), selected.end(), "args") != selected.end();
+        std::vector<ProcessInfo> processes = ProcessTable::scan(needCmdline);
+        Context ctx;
+        struct timespec boot;
+        clock_gettime(CLOCK_BOOTTIME, &boot);
+        ctx.uptime = boot.tv_sec + boot.tv_nsec / 1e9;
+        ctx.now = time(nullptr);
+        struct sysinfo si;
+        ctx.memTotalKiB = sysinfo(&si) == 0 ? (uint64_t)si.totalram * si.mem_unit / 1024 : 0;
+
+        processes.erase(std::remove_if(processes.begin(), processes.end(), [&](const ProcessInfo &p) {
+                            return (!pids.empty() && !pids.count(p.pid)) ||
+                                   (!commands.empty() && !commands.count(p.comm)) ||
+                                   (!users.empty() && !users.count(ProcessTable::userName(p.uid)) &&
+                                    !users.count(std::to_string(p.uid)));
+                        }),
+                        processes.end());
+        if (!sortKeys.empty())
+        {
+            std::stable_sort(processes.begin(), processes.end(), [&](const ProcessInfo &a, const ProcessInfo &b) {
+                for (auto key : sortKeys)
+                {
+                    bool descending = key[0] == '-';
+                    if (key[0] == '-' || key[0] == '+')
+                        key.erase(0, 1);
+                    if (less(key, a, b, ctx))
+                        return !descending;
+                    if (less(key, b, a, ctx))
+                        return descending;
+                }
+                return false;
+            });
+        }
+
+        std::vector<std::vector<std::string>> rows;
+        rows.reserve(processes.size() + 1);
+        std::vector<std::string> header;
+        std::vector<bool> rightAlign;
+        for (auto &column : selected)
+        {
+            auto known = std::find_if(columns().begin(), columns().end(), [&](const Column &c) { return column == c.name; });
+            header.push_back(known->header);
+            rightAlign.push_back(known->rightAlign);
+        }
+        rows.push_back(header);
+        for (auto &p : processes)
+        {
+            std::vector<std::string> row;
+            for (auto &column : selected)
+                row.push_back(value(column, p, ctx));
+            rows.push_back(row);
+        }
+        std::vector<size_t> widths(selected.size(), 0);
+        for (auto &row : rows)
+        {
+            for (size_t c = 0; c + 1 < row.size(); ++c)
+                widths[c] = std::max(widths[c], row[c].size());
+        }
+        std::string out;
+        for (auto &row : rows)
+        {
+            for (size_t c = 0; c < row.size(); ++c)
+            {
+                if (c > 0)
+                    out += ' ';
+                if (c + 1 == row.size())
+                    out += row[c];
+                else if (rightAlign[c])
+                    out.append(widths[c] - row[c].size(), ' ').append(row[c]);
+                else
+                    out.append(row[c]).append(widths[c] - row[c].size(), ' ');
+            }
+            out += '\n';
+        }
+        std::cout << out;
+    }
+
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        print(args, "user,pid,pcpu,pmem,vsz,rss,tty,stat,start,time,args");
+    }
+    std::string helpText() override
+    {
+        return "Display currently running processes. Usage: ps [-o cols] [--sort [-]col,...] [-u users] [-p pids] [-C names]";
+    }
+};
+
+class NetstatCommand : public Command
+{
+private:
+    // Indexed by the kernel's TCP state numbers (TCP_ESTABLISHED == 1 ...).
+    static constexpr const char *stateNames[] = {"",          "ESTABLISHED", "SYN_SENT", "SYN_RECV",
+                                                 "FIN_WAIT1", "FIN_WAIT2",   "TIME_WAIT", "CLOSE",
+                                                 "CLOSE_WAIT", "LAST_ACK",   "LISTEN",    "CLOSING"};
+    static const int stateCount = 12;
+
+    static int parseState(std::string name)
+    {
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return c == '-' ? '_' : toupper(c); });
+        for (int state = 1; state < stateCount; ++state)
+        {
+            if (name == stateNames[state])
+                return state;
+        }
+        return -1;
+    }
+
+    // inet_diag bytecode accepting sockets whose source/destination port
+    // equals the requested one. Rejecting ops jump past the end of the
+    // program, which the kernel treats as "no match".
+    static std::vector<char> portFilter(int sport, int dport)
+    {
+        std::vector<std::pair<int, int>> conditions;
+        if (sport >= 0)
+        {
+            conditions.push_back({INET_DIAG_BC_S_GE, sport});
+            conditions.push_back({INET_DIAG_BC_S_LE, sport});
+        }
+        if (dport >= 0)
+        {
+            conditions.push_back({INET_DIAG_BC_D_GE, dport});
+            conditions.push_back({INET_DIAG_BC_D_LE, dport});
+        }
+        const int step = 2 * sizeof(struct inet_diag_bc_op);
+        int length = conditions.size() * step;
+        std::vector<char> program(length);
+        for (size_t i = 0; i < conditions.size(); ++i)
+        {
+            struct inet_diag_bc_op ops[2] = {};
+            ops[0].code = conditions[i].first;
+            ops[0].yes = step;
+            ops[0].no = length - i * step + 4;
+            ops[1].no = conditions[i].second;
+            memcpy(program.data() + i * step, ops, sizeof(ops));
+        }
+        return program;
+    }
+
+    static void appendEndpoint(std::string &out, int family, const uint32_t *address, uint16_t port)
+    {
+        char text[INET6_ADDRSTRLEN + 8];
+        inet_ntop(family, address, text, sizeof(text));
+        size_t length = strlen(text);
+        text[length++] = ':';
+        if (port)
+            length += snprintf(text + length, sizeof(text) - length, "%u", port);
+        else
+            text[length++] = '*';
+        out.append(text, length);
+        if (length < 24)
+            out.append(24 - length, ' ');
+        else
+            out += ' ';
+    }
+
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        bool tcp = false, udp = false, listening = false, all = false, summary = false;
+        uint32_t states = 0;
+        int sport = -1, dport = -1;
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            const std::string &arg = args[i];
+            if (arg == "--state" && i + 1 < args.size())
+            {
+                int state = parseState(args[++i]);
+                if (state < 0)
+                {
+                    std::cout << "netstat: unknown state: " << args[i] << "\n";
+                    return;
+                }
+                states |= 1u << state;
+            }
+            else if (arg == "--sport" && i + 1 < args.size())
+                sport = atoi(args[++i].c_str());
+            else if (arg == "--dport" && i + 1 < args.size())
+                dport = atoi(args[++i].c_str());
+            else if (arg.size() > 1 && arg[0] == '-' && arg[1] != '-' &&
+                     arg.find_first_not_of("tulans", 1) == std::string::npos)
+            {
+                tcp |= arg.find('t') != std::string::npos;
+                udp |= arg.find('u') != std::string::npos;
+                listening |= arg.find('l') != std::string::npos;
+                all |= arg.find('a') != std::string::npos;
+                summary |= arg.find('s') != std::string::npos;
+            }
+            else
+            {
+                std::cout << "Usage: netstat [-tulans] [--state name] [--sport port] [--dport port]\n";
+                return;
+            }
+        }
+        if (args.size() == 1)
+            tcp = udp = listening = true;
+        if (!tcp && !udp)
+            tcp = udp = true;
+
+        std::vector<char> bytecode = portFilter(sport, dport);
+        std::string out;
+        out.reserve(1 << 20);
+        uint64_t counts[stateCount] = {};
+        if (!summary)
+        {
+            out += all ? "Active Internet connections (servers and established)\n"
+                       : listening ? "Active Internet connections (only servers)\n"
+                                   : "Active Internet connections (w/o servers)\n";
+            out += "Proto Recv-Q Send-Q Local Address           Foreign Address         State\n";
+        }
+
+        for (int protocol : {IPPROTO_TCP, IPPROTO_UDP})
+        {
+            if ((protocol == IPPROTO_TCP && !tcp) || (protocol == IPPROTO_UDP && !udp))
+                continue;
+            // Unconnected UDP sockets sit in TCP_CLOSE; they are the "servers".
+            uint32_t listenState = protocol == IPPROTO_TCP ? 1u << 10 : 1u << 7;
+            uint32_t mask = states ? states : all ? ~0u : listening ? listenState : ~0u & ~listenState;
+            for (int family : {AF_INET, AF_INET6})
+            {
+                std::vector<char> request(NLMSG_SPACE(sizeof(struct inet_diag_req_v2)) +
+                                          (bytecode.empty() ? 0 : RTA_SPACE(bytecode.size())));
+                struct nlmsghdr *header = (struct nlmsghdr *)request.data();
+                header->nlmsg_len = request.size();
+                header->nlmsg_type = SOCK_DIAG_BY_FAMILY;
+                struct inet_diag_req_v2 *diag = (struct inet_diag_req_v2 *)NLMSG_DATA(header);
+                diag->sdiag_family = family;
+                diag->sdiag_protocol = protocol;
+                diag->idiag_states = mask;
+                if (!bytecode.empty())
+                {
+                    struct rtattr *attr = (struct rtattr *)(request.data() + NLMSG_SPACE(sizeof(*diag)));
+                    attr->rta_type = INET_DIAG_REQ_BYTECODE;
+                    attr->rta_len = RTA_LENGTH(bytecode.size());
+                    memcpy(RTA_DATA(attr), bytecode.data(), bytecode.size());
+                }
+                const char *proto = protocol == IPPROTO_TCP ? (family == AF_INET ? "tcp " : "tcp6")
+                                                            : (family == AF_INET ? "udp " : "udp6");
+                bool ok = netlinkDump(NETLINK_SOCK_DIAG, header, [&](const struct nlmsghdr *message) {
+                    if (message->nlmsg_type != SOCK_DIAG_BY_FAMILY)
+                        return;
+                    const struct inet_diag_msg *socket = (const struct inet_diag_msg *)NLMSG_DATA(message);
+                    int state = socket->idiag_state < stateCount ? socket->idiag_state : 0;
+                    ++counts[state];
+                    if (summary)
+                        return;
+                    char queues[48];
+                    snprintf(queues, sizeof(queues), "%s %6u %6u ", proto, socket->idiag_rqueue, socket->idiag_wqueue);
+                    out += queues;
+                    appendEndpoint(out, family, socket->id.idiag_src, ntohs(socket->id.idiag_sport));
+                    appendEndpoint(out, family, socket->id.idiag_dst, ntohs(socket->id.idiag_dport));
+                    if (protocol == IPPROTO_TCP || state != 7)
+                        out += stateNames[state];
+                    out += '\n';
+                    if (out.size() > (1 << 20) - 256)
+                    {
+                        std::cout << out;
+                        out.clear();
+                    }
+                });
+                // A kernel without IPv6 or UDP diag support is not an error.
+                if (!ok && errno != ENOENT && errno != EAFNOSUPPORT)
+                    perror("netstat: sock_diag");
+            }
+        }
+        if (summary)
+        {
+            for (int state = 1; state < stateCount; ++state)
+            {
+                if (counts[state])
+                    out += std::string(stateNames[state]) + " " + std::to_string(counts[state]) + "\n";
+            }
+        }
+        std::cout << out;
+    }
+    std::string helpText() override
+    {
+        return "Lists TCP/UDP sockets via sock_diag netlink (default -tuln). Usage: netstat [-tulans] [--state name] [--sport port] [--dport port]";
+    }
+};
+
+class ShutdownCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() > 1 && args[1] == "reboot")
+        {
+            system("reboot");
+        }
+        else
+        {
+            system("shutdown now");
+        }
+    }
+    std::string helpText() override
+    {
+        return "Shut down or reboot the system. Usage: shutdown [reboot]";
+    }
+};
+
+class TailCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: tail [file]\n";
+            return;
+        }
+        std::string command = "tail -f " + shellQuote(args[1]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Follows the tail of a file. Usage: tail [file]";
+    }
+};
+
+class NanoCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: nano [file]\n";
+            return;
+        }
+        std::string command = "nano " + shellQuote(args[1]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Open a file in the Nano editor. Usage: nano [file]";
+    }
+};
+
+// Static file server run inside the shell process. Every worker thread owns
+// an epoll set; the listening socket is shared with EPOLLEXCLUSIVE so each
+// connection is accepted by, and stays with, a single worker.
+class HttpServer
+{
+private:
+    struct Connection
+    {
+        int fd = -1;
+        std::string in;
+        std::string out;
+        size_t outSent = 0;
+        int file = -1;
+        off_t fileOffset = 0;
+        uint64_t fileRemaining = 0;
+        bool keepAlive = true;
+        bool writing = false;
+        time_t lastActive = 0;
+    };
+
+    static const size_t maxHeaderBytes = 32 * 1024;
+    static const int idleTimeout = 60;
+
+    int port;
+    std::string root;
+    int rootFd = -1;
+    int listenFd = -1;
+    int stopFd = -1;
+    std::vector<std::thread> workers;
+    std::atomic<uint64_t> requests{0};
+    std::atomic<int> openConnections{0};
+
+    static std::string urlDecode(const std::string &text)
+    {
+        std::string out;
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            if (text[i] == '%' && i + 2 < text.size() && isxdigit(text[i + 1]) && isxdigit(text[i + 2]))
+            {
+                out += (char)strtol(text.substr(i + 1, 2).c_str(), nullptr, 16);
+                i += 2;
+            }
+            else
+            {
+                out += text[i];
+            }
+        }
+        return out;
+    }
+
+    static std::string htmlEscape(const std::string &text)
+    {
+        std::string out;
+        for (char c : text)
+        {
+            switch (c)
+            {
+            case '<': out += "&lt;"; break;
+            case '>': out += "&gt;"; break;
+            case '&': out += "&amp;"; break;
+            case '"': out += "&quot;"; break;
+            default: out += c;
+            }
+        }
+        return out;
+    }
+
+    static std::string httpDate(time_t when)
+    {
+        char buffer[64];
+        struct tm tm;
+        gmtime_r(&when, &tm);
+        strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        return buffer;
+    }
+
+    static const char *contentType(const std::string &path)
+    {
+        static const std::map<std::string, const char *> types = {
+            {"html", "text/html; charset=utf-8"}, {"htm", "text/html; charset=utf-8"},
+            {"txt", "text/plain; charset=utf-8"}, {"log", "text/plain; charset=utf-8"},
+            {"css", "text/css"}, {"js", "application/javascript"}, {"json", "application/json"},
+            {"xml", "application/xml"}, {"png", "image/png"}, {"jpg", "image/jpeg"},
+            {"jpeg", "image/jpeg"}, {"gif", "image/gif"}, {"svg", "image/svg+xml"},
+            {"pdf", "application/pdf"}, {"gz", "application/gzip"}, {"tgz", "application/gzip"},
+            {"tar", "application/x-tar"}, {"zip", "application/zip"}};
+        size_t dot = path.rfind('.');
+        if (dot != std::string::npos && path.find('/', dot) == std::string::npos)
+        {
+            std::string ext = path.substr(dot + 1);
+            std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+            auto it = types.find(ext);
+            if (it != types.end())
+                return it->second;
+        }
+        return "application/octet-stream";
+    }
+
+    static void respond(Connection &c, int status, const char *reason, const std::string &headers,
+                        const std::string &body, bool includeBody = true)
+    {
+        c.out = "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n" +
+                "Server: dsh\r\nDate: " + httpDate(time(nullptr)) + "\r\n" + headers +
+                "Connection: " + (c.keepAlive ? "keep-alive" : "close") + "\r\n\r\n";
+        if (includeBody)
+            c.out += body;
+    }
+
+    static void respondError(Connection &c, int status, const char *reason, bool includeBody = true)
+    {
+        std::string body = std::to_string(status) + " " + reason + "\n";
+        respond(c, status, reason,
+                "Content-Type: text/plain\r\nContent-Length: " + std::to_string(body.size()) + "\r\n", body, includeBody);
+    }
+
+    std::string listing(int dirFd, const std::string &urlPath)
+    {
+        std::vector<std::string> names;
+        DIR *dir = fdopendir(dup(dirFd));
+        if (dir)
+        {
+            while (struct dirent *ent = readdir(dir))
+            {
+                if (ent->d_name[0] == '.')
+                    continue;
+                std::string name = ent->d_name;
+                struct stat st;
+                if (fstatat(dirFd, ent->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode))
+                    name += "/";
+                names.push_back(name);
+            }
+            closedir(dir);
+        }
+        std::sort(names.begin(), names.end());
+        std::string html = "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>Index of " + htmlEscape(urlPath) +
+                           "</title></head><body>\n<h1>Index of " + htmlEscape(urlPath) + "</h1>\n<hr>\n<ul>\n";
+        for (auto &name : names)
+            html += "<li><a href=\"" + htmlEscape(name) + "\">" + htmlEscape(name) + "</a></li>\n";
+        return html + "</ul>\n<hr>\n</body></html>\n";
+    }
+
+    void handleRequest(Connection &c, const std::string &head)
+    {
+        ++requests;
+        std::istringstream lines(head);
+        std::string requestLine;
+        getline(lines, requestLine);
+        std::istringstream parts(requestLine);
+        std::string method, target, version;
+        parts >> method >> target >> version;
+        std::map<std::string, std::string> headers;
+        std::string line;
+        while (getline(lines, line))
+        {
+            size_t colon = line.find(':');
+            if (colon == std::string::npos)
+                continue;
+            std::string name = line.substr(0, colon);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            size_t start = line.find_first_not_of(" \t", colon + 1);
+            size_t end = line.find_last_not_of(" \t\r");
+            headers[name] = start == std::string::npos ? "" : line.substr(start, end - start + 1);
+        }
+        std::string connection = headers["connection"];
+        std::transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+        c.keepAlive = version == "HTTP/1.1" ? connection != "close" : connection == "keep-alive";
+
+        bool head_only = method == "HEAD";
+        if (version.compare(0, 5, "HTTP/") != 0 || target.empty() || target[0] != '/')
+        {
+            c.keepAlive = false;
+            respondError(c, 400, "Bad Request");
+            return;
+        }
+        if (method != "GET" && !head_only)
+        {
+            c.keepAlive = false;
+            respondError(c, 405, "Method Not Allowed");
+            return;
+        }
+
+        std::string urlPath = urlDecode(target.substr(0, target.find_first_of("?#")));
+        std::string relative = ".";
+        std::istringstream components(urlPath);
+        std::string component;
+        while (getline(components, component, '/'))
+        {
+            if (component == "..")
+            {
+                respondError(c, 403, "Forbidden", !head_only);
+                return;
+            }
+            if (!component.empty() && component != ".")
+                relative += "/" + component;
+        }
+
+        int fd = openat(rootFd, relative.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            if (fd >= 0)
+                close(fd);
+            respondError(c, 404, "Not Found", !head_only);
+            return;
+        }
+        if (S_ISDIR(st.st_mode))
+        {
+            if (urlPath.back() != '/')
+            {
+                close(fd);
+                respond(c, 301, "Moved Permanently",
+                        "Location: " + target.substr(0, target.find_first_of("?#")) + "/\r\nContent-Length: 0\r\n", "");
+                return;
+            }
+            int index = openat(fd, "index.html", O_RDONLY | O_CLOEXEC);
+            if (index < 0)
+            {
+                std::string body = listing(fd, urlPath);
+                close(fd);
+                respond(c, 200, "OK",
+                        "Content-Type: text/html; charset=utf-8\r\nContent-Length: " + std::to_string(body.size()) + "\r\n",
+                        body, !head_only);
+                return;
+            }
+            close(fd);
+            fd = index;
+            relative += "/index.html";
+            fstat(fd, &st);
+        }
+        if (!S_ISREG(st.st_mode))
+        {
+            close(fd);
+            respondError(c, 403, "Forbidden", !head_only);
+            return;
+        }
+
+        uint64_t size = st.st_size, first = 0, last = size ? size - 1 : 0;
+        bool partial = false;
+        std::string range = headers["range"];
+        if (range.compare(0, 6, "bytes=") == 0 && range.find(',') == std::string::npos)
+        {
+            std::string spec = range.substr(6);
+            size_t dash = spec.find('-');
+            bool valid = dash != std::string::npos;
+            if (valid && dash == 0)
+            {
+                uint64_t suffix = strtoull(spec.c_str() + 1, nullptr, 10);
+                valid = suffix > 0 && size > 0;
+                first = size - std::min(suffix, size);
+            }
+            else if (valid)
+            {
+                first = strtoull(spec.c_str(), nullptr, 10);
+                if (dash + 1 < spec.size())
+                    last = std::min<uint64_t>(strtoull(spec.c_str() + dash + 1, nullptr, 10), size - 1);
+                valid = first < size && first <= last;
+            }
+            if (!valid)
+            {
+                close(fd);
+                respond(c, 416, "Range Not Satisfiable",
+                        "Content-Range: bytes */" + std::to_string(size) + "\r\nContent-Length: 0\r\n", "");
+                return;
+            }
+            partial = true;
+        }
+
+        uint64_t length = size ? last - first + 1 : 0;
+        std::string extra = std::string("Content-Type: ") + contentType(relative) + "\r\n" +
+                            "Content-Length: " + std::to_string(length) + "\r\n" +
+                            "Last-Modified: " + httpDate(st.st_mtime) + "\r\n" +
+                            "Accept-Ranges: bytes\r\n";
+        if (partial)
+            extra += "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(size) + "\r\n";
+        respond(c, partial ? 206 : 200, partial ? "Partial Content" : "OK", extra, "");
+        if (head_only || length == 0)
+        {
+            close(fd);
+            return;
+        }
+        c.file = fd;
+        c.fileOffset = first;
+        c.fileRemaining = length;
+    }
+
+    void closeFile(Connection &c)
+    {
+        if (c.file >= 0)
+            close(c.file);
+        c.file = -1;
+        c.fileRemaining = 0;
+    }
+
+    void setWriting(int epfd, Connection &c, bool writing)
+    {
+        if (c.writing == writing)
+            return;
+        epoll_event ev{};
+        ev.events = writing ? EPOLLOUT : EPOLLIN;
+        ev.data.fd = c.fd;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+        c.writing = writing;
+    }
+
+    // Pushes the pending response out: buffered headers first, then the
+    // file body with sendfile. Returns false when the connection is done.
+    bool flush(int epfd, Connection &c)
+    {
+        while (c.outSent < c.out.size())
+        {
+            ssize_t n = send(c.fd, c.out.data() + c.outSent, c.out.size() - c.outSent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN)
+            {
+                setWriting(epfd, c, true);
+                return true;
+            }
+            if (n <= 0)
+                return false;
+            c.outSent += n;
+        }
+        c.out.clear();
+        c.outSent = 0;
+        while (c.fileRemaining > 0)
+        {
+            ssize_t n = sendfile(c.fd, c.file, &c.fileOffset, std::min<uint64_t>(c.fileRemaining, 1 << 20));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN)
+            {
+                setWriting(epfd, c, true);
+                return true;
+            }
+            if (n <= 0)
+                return false;
+            c.fileRemaining -= n;
+        }
+        closeFile(c);
+        if (!c.keepAlive)
+            return false;
+        setWriting(epfd, c, false);
+        return true;
+    }
+
+    bool busy(const Connection &c)
+    {
+        return !c.out.empty() || c.file >= 0;
+    }
+
+    bool process(int epfd, Connection &c)
+    {
+        while (!busy(c))
+        {
+            size_t end = c.in.find("\r\n\r\n");
+            if (end == std::string::npos)
+            {
+                if (c.in.size() <= maxHeaderBytes)
+                    return true;
+                c.keepAlive = false;
+                respondError(c, 431, "Request Header Fields Too Large");
+                return flush(epfd, c);
+            }
+            std::string head = c.in.substr(0, end);
+            c.in.erase(0, end + 4);
+            handleRequest(c, head);
+            if (!flush(epfd, c))
+                return false;
+        }
+        return true;
+    }
+
+    bool onReadable(int epfd, Connection &c)
+    {
+        char buffer[16384];
+        while (true)
+        {
+            ssize_t n = recv(c.fd, buffer, sizeof(buffer), 0);
+            if (n > 0)
+            {
+                c.in.append(buffer, n);
+                if (c.in.size() > maxHeaderBytes * 4)
+                    break;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN)
+                break;
+            return false;
+        }
+        return process(epfd, c);
+    }
+
+    void workerLoop()
+    {
+        sigset_t pipeMask;
+        sigemptyset(&pipeMask);
+        sigaddset(&pipeMask, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipeMask, nullptr);
+
+        int epfd = epoll_create1(EPOLL_CLOEXEC);
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.fd = listenFd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, listenFd, &ev);
+        ev.events = EPOLLIN;
+        ev.data.fd = stopFd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, stopFd, &ev);
+
+        std::unordered_map<int, Connection> connections;
+        auto drop = [&](int fd) {
+            auto it = connections.find(fd);
+            if (it == connections.end())
+                return;
+            closeFile(it->second);
+            close(fd);
+            connections.erase(it);
+            --openConnections;
+        };
+
+        epoll_event events[128];
+        time_t lastSweep = time(nullptr);
+        bool running = true;
+        while (running)
+        {
+            int n = epoll_wait(epfd, events, 128, 1000);
+            time_t now = time(nullptr);
+            for (int i = 0; i < n; ++i)
+            {
+                int fd = events[i].data.fd;
+                if (fd == stopFd)
+                {
+                    running = false;
+                    break;
+                }
+                if (fd == listenFd)
+                {
+                    int client;
+                    while ((client = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                    {
+                        int one = 1;
+                        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                        Connection &c = connections[client];
+                        c.fd = client;
+                        c.lastActive = now;
+                        epoll_event cev{};
+                        cev.events = EPOLLIN;
+                        cev.data.fd = client;
+                        epoll_ctl(epfd, EPOLL_CTL_ADD, client, &cev);
+                        ++openConnections;
+                    }
+                    continue;
+                }
+                auto it = connections.find(fd);
+                if (it == connections.end())
+                    continue;
+                Connection &c = it->second;
+                c.lastActive = now;
+                bool keep;
+                if (events[i].events & (EPOLLERR | EPOLLHUP))
+                    keep = false;
+                else if (c.writing)
+                    keep = flush(epfd, c) && process(epfd, c);
+                else
+                    keep = onReadable(epfd, c);
+                if (!keep)
+                    drop(fd);
+            }
+            if (now - lastSweep >= 1)
+            {
+                lastSweep = now;
+                std::vector<int> idle;
+                for (auto &entry : connections)
+                {
+                    if (now - entry.second.lastActive > idleTimeout)
+                        idle.push_back(entry.first);
+                }
+                for (int fd : idle)
+                    drop(fd);
+            }
+        }
+        std::vector<int> remaining;
+        for (auto &entry : connections)
+            remaining.push_back(entry.first);
+        for (int fd : remaining)
+            drop(fd);
+        close(epfd);
+    }
+
+public:
+    HttpServer(int port, const std::string &root) : port(port), root(root)
+    {
+    }
+    ~HttpServer()
+    {
+        stop();
+    }
+
+    bool start(size_t threadCount)
+    {
+        rootFd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (rootFd < 0)
+        {
+            perror("http");
+            return false;
+        }
+        listenFd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int family = AF_INET6;
+        if (listenFd < 0)
+        {
+            listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            family = AF_INET;
+        }
+        int one = 1, zero = 0;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        int rc;
+        if (family == AF_INET6)
+        {
+            setsockopt(listenFd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+            sockaddr_in6 addr{};
+            addr.sin6_family = AF_INET6;
+            addr.sin6_addr = in6addr_any;
+            addr.sin6_port = htons(port);
+            rc = bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+        }
+        else
+        {
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_ANY);
+            addr.sin_port = htons(port);
+            rc = bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+        }
+        if (rc != 0 || listen(listenFd, SOMAXCONN) != 0)
+        {
+            perror("http");
+            close(listenFd);
+            close(rootFd);
+            listenFd = rootFd = -1;
+            return false;
+        }
+        stopFd = eventfd(0, EFD_CLOEXEC);
+        if (threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t i = 0; i < threadCount; ++i)
+            workers.emplace_back(&HttpServer::workerLoop, this);
+        return true;
+    }
+
+    void stop()
+    {
+        if (stopFd >= 0)
+        {
+            uint64_t one = 1;
+            if (write(stopFd, &one, sizeof(one)) < 0)
+                perror("http");
+        }
+        for (auto &worker : workers)
+            worker.join();
+        workers.clear();
+        for (int *fd : {&listenFd, &stopFd, &rootFd})
+        {
+            if (*fd >= 0)
+                close(*fd);
+            *fd = -1;
+        }
+    }
+
+    void printStatus()
+    {
+        std::cout << "port " << port << ": serving " << root << " with " << workers.size() << " threads, "
+                  << requests << " requests, " << openConnections << " open connections\n";
+    }
+};
+
+class HttpCommand : public Command
+{
+private:
+    std::map<int, std::unique_ptr<HttpServer>> servers;
+
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() > 1 && args[1] == "status")
+        {
+            if (servers.empty())
+                std::cout << "No HTTP servers running\n";
+            for (auto &server : servers)
+                server.second->printStatus();
+            return;
+        }
+        if (args.size() > 1 && args[1] == "stop")
+        {
+            if (args.size() > 2)
+                servers.erase(atoi(args[2].c_str()));
+            else
+                servers.clear();
+            return;
+        }
+
+        int port = 8000; // Default port
+        std::string directory = ".";
+        size_t threads = 0;
+        std::vector<std::string> positional;
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if (args[i] == "-t" && i + 1 < args.size())
+                threads = atoi(args[++i].c_str());
+            else
+                positional.push_back(args[i]);
+        }
+        if (positional.size() > 0)
+            port = atoi(positional[0].c_str());
+        if (positional.size() > 1)
+            directory = positional[1];
+        if (port <= 0 || port > 65535)
+        {
+            std::cout << "Usage: http [port] [directory] [-t threads] | http status | http stop [port]\n";
+            return;
+        }
+        if (servers.count(port))
+        {
+            std::cout << "Already serving on port " << port << "\n";
+            return;
+        }
+        char *resolved = realpath(directory.c_str(), nullptr);
+        std::unique_ptr<HttpServer> server(new HttpServer(port, resolved ? resolved : directory));
+        free(resolved);
+        if (!server->start(threads))
+            return;
+        std::cout << "Serving " << directory << " on port " << port << " in the background (stop with: http stop " << port << ")\n";
+        servers[port] = std::move(server);
+    }
+    std::string helpText() override
+    {
+        return "Starts a background HTTP file server. Usage: http [port] [directory] [-t threads] | http status | http stop [port]";
+    }
+};
+
+class ChmodCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 3)
+        {
+            std::cout << "Usage: chmod [permissions] [file]\n";
+            return;
+        }
+        std::string command = "chmod " + shellQuote(args[1]) + " " + shellQuote(args[2]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Changes file permissions. Usage: chmod [permissions] [file]";
+    }
+};
+
+class ChownCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 3)
+        {
+            std::cout << "Usage: chown [owner][:group] [file]\n";
+            return;
+        }
+        std::string command = "chown " + shellQuote(args[1]) + " " + shellQuote(args[2]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Changes file owner and group. Usage: chown [owner][:group] [file]";
+    }
+};
+
+class SortCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: sort [file]\n";
+            return;
+        }
+        std::string command = "sort " + shellQuote(args[1]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Sorts the contents of a file. Usage: sort [file]";
+    }
+};
+
+class UniqCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: uniq [file]\n";
+            return;
+        }
+        std::string command = "uniq " + shellQuote(args[1]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Filters or reports repeated lines in a file. Usage: uniq [file]";
+    }
+};
+
+class WcCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: wc [file]\n";
+            return;
+        }
+        std::string command = "wc " + shellQuote(args[1]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Counts lines, words, and characters in a file. Usage: wc [file]";
+    }
+};
+
+class DfCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::vector<std::string> options(args);
+        bool json = Report::wantsJson(options);
+        bool human = true;
+        std::vector<std::string> paths;
+        for (size_t i = 1; i < options.size(); ++i)
+        {
+            if (options[i] == "-h")
+                human = true;
+            else if (options[i] == "-k")
+                human = false;
+            else
+                paths.push_back(options[i]);
+        }
+
+        struct Mount
+        {
+            std::string source, target, type;
+        };
+        std::vector<Mount> mounts;
+        FILE *table = setmntent("/proc/self/mounts", "r");
+        if (!table)
+        {
+            perror("df");
+            return;
+        }
+        while (struct mntent *entry = getmntent(table))
+            mounts.push_back({entry->mnt_fsname, entry->mnt_dir, entry->mnt_type});
+        endmntent(table);
+
+        if (!paths.empty())
+        {
+            // Keep the longest mount point that contains each path.
+            std::vector<Mount> selected;
+            for (auto &path : paths)
+            {
+                char *resolved = realpath(path.c_str(), nullptr);
+                if (!resolved)
+                {
+                    perror(("df: " + path).c_str());
+                    continue;
+                }
+                std::string full = resolved;
+                free(resolved);
+                const Mount *best = nullptr;
+                for (auto &mount : mounts)
+                {
+                    const std::string &dir = mount.target;
+                    bool contains = full.compare(0, dir.size(), dir) == 0 &&
+                                    (full.size() == dir.size() || full[dir.size()] == '/' || dir == "/");
+                    if (contains && (!best || dir.size() >= best->target.size()))
+                        best = &mount;
+                }
+                if (best)
+                    selected.push_back(*best);
+            }
+            mounts = selected;
+        }
+
+        Report report;
+        for (auto &mount : mounts)
+        {
+            struct statvfs vfs;
+            if (statvfs(mount.target.c_str(), &vfs) != 0 || (vfs.f_blocks == 0 && paths.empty()))
+                continue;
+            uint64_t size = (uint64_t)vfs.f_blocks * vfs.f_frsize;
+            uint64_t avail = (uint64_t)vfs.f_bavail * vfs.f_frsize;
+            uint64_t used = size - (uint64_t)vfs.f_bfree * vfs.f_frsize;
+            double percent = used + avail ? std::ceil(100.0 * used / (used + avail)) : 0;
+            auto shown = [human](uint64_t bytes) {
+                return human ? Report::humanSize(bytes, false) : std::to_string(bytes / 1024);
+            };
+            report.row()
+                .text("filesystem", "Filesystem", mount.source)
+                .text("type", "Type", mount.type)
+                .number("size", human ? "Size" : "1K-blocks", size, shown(size))
+                .number("used", "Used", used, shown(used))
+                .number("avail", human ? "Avail" : "Available", avail, shown(avail))
+                .number("use_percent", "Use%", percent, size ? std::to_string((int)percent) + "%" : "-")
+                .text("mounted_on", "Mounted on", mount.target);
+        }
+        if (json)
+            report.printJson(false);
+        else
+            report.printTable();
+    }
+    std::string helpText() override
+    {
+        return "Reports disk space usage. Usage: df [-h|-k] [--json] [path...]";
+    }
+};
+
+class PingCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: ping [host]\n";
+            return;
+        }
+        std::string command = "ping -c 4 " + shellQuote(args[1]); // Ping 4 times by default
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Checks network connectivity to a host. Usage: ping [host]";
+    }
+};
+
+class HashCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        PathCache &cache = PathCache::shared();
+        if (args.size() == 1)
+        {
+            auto &entries = cache.cached();
+            bool any = false;
+            for (auto &entry : entries)
+            {
+                if (entry.second.path.empty())
+                    continue;
+                if (!any)
+                    std::cout << "hits\tcommand\n";
+                any = true;
+                std::cout << std::setw(4) << entry.second.hits << "\t" << entry.second.path << "\n";
+            }
+            if (!any)
+                std::cout << "hash: hash table empty\n";
+            return;
+        }
+        if (args[1] == "-r")
+        {
+            cache.clear();
+            return;
+        }
+        bool forget = args[1] == "-d", print = args[1] == "-t";
+        size_t first = forget || print ? 2 : 1;
+        if (first >= args.size())
+        {
+            std::cout << "Usage: hash [-r] [-d name...] [-t name...] [name...]\n";
+            return;
+        }
+        for (size_t i = first; i < args.size(); ++i)
+        {
+            if (forget)
+            {
+                cache.forget(args[i]);
+                continue;
+            }
+            std::string path = cache.resolve(args[i]);
+            if (path.empty())
+                std::cout << "hash: " << args[i] << ": not found\n";
+            else if (print)
+                std::cout << path << "\n";
+        }
+    }
+    std::string helpText() override
+    {
+        return "Shows or resets the cached PATH lookups for external commands. Usage: hash [-r] [-d name...] [-t name...] [name...]";
+    }
+};
+
+class HistoryCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        size_t count = SIZE_MAX;
+        std::string query;
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if (args[i] == "-n" && i + 1 < args.size())
+                count = strtoul(args[++i].c_str(), nullptr, 10);
+            else
+                query += (query.empty() ? "" : " ") + args[i];
+        }
+        CommandHistory &history = CommandHistory::shared();
+        history.sync();
+        const auto &entries = history.all();
+        std::vector<size_t> shown;
+        for (ssize_t i = history.search(query, entries.size()); i >= 0 && shown.size() < count;
+             i = history.search(query, i))
+            shown.push_back(i);
+        std::string out;
+        char line[128];
+        for (auto it = shown.rbegin(); it != shown.rend(); ++it)
+        {
+            const CommandHistory::Entry &entry = entries[*it];
+            time_t start = entry.startMs / 1000;
+            struct tm tm;
+            localtime_r(&start, &tm);
+            char when[32];
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+            snprintf(line, sizeof(line), "%6zu  %s  %3d %7ums  ", *it + 1, when, entry.status, entry.durationMs);
+            out += line + entry.command + "\n";
+        }
+        std::cout << out;
+    }
+    std::string helpText() override
+    {
+        return "Shows the shared command history with time, exit status and duration. Usage: history [-n count] [text]";
+    }
+};
+
+class PromptCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() == 1)
+        {
+            std::cout << Prompt::shared().currentFormat() << "\n";
+            return;
+        }
+        std::string format;
+        for (size_t i = 1; i < args.size(); ++i)
+            format += (i > 1 ? " " : "") + args[i];
+        // An unquoted format cannot end in a space; add the customary one.
+        if (!format.empty() && format.back() != ' ')
+            format += ' ';
+        Prompt::shared().setFormat(format);
+    }
+    std::string helpText() override
+    {
+        return "Shows or sets the prompt format (%d cwd, %~ short cwd, %u user, %h host, %g git branch, %G branch and dirty flag, %s exit status, %t duration). Usage: prompt [format]";
+    }
+};
+
+class StatsCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::vector<std::string> options(args);
+        bool json = Report::wantsJson(options);
+        CommandStats &stats = CommandStats::shared();
+        if (options.size() == 2 && options[1] == "-r")
+        {
+            stats.reset();
+            return;
+        }
+        if (options.size() == 3 && options[1] == "-o")
+        {
+            if (!stats.dump(options[2]))
+                perror(("stats: " + options[2]).c_str());
+            return;
+        }
+        if (options.size() == 2 && options[1][0] != '-')
+        {
+            auto it = stats.all().find(options[1]);
+            if (it == stats.all().end())
+            {
+                std::cout << "stats: no samples for " << options[1] << "\n";
+                return;
+            }
+            Report report;
+            for (auto &bucket : it->second.latency.buckets())
+            {
+                report.row()
+                    .number("from_us", "FROM", std::get<0>(bucket), CommandStats::formatMicros(std::get<0>(bucket)))
+                    .number("to_us", "TO", std::get<1>(bucket), CommandStats::formatMicros(std::get<1>(bucket)))
+                    .number("count", "COUNT", std::get<2>(bucket));
+            }
+            if (json)
+                report.printJson(false);
+            else
+                report.printTable();
+            return;
+        }
+        if (options.size() != 1)
+        {
+            std::cout << "Usage: stats [--json] [-r] [-o file] [command]\n";
+            return;
+        }
+        Report report = stats.report();
+        if (json)
+            report.printJson(false);
+        else
+            report.printTable();
+    }
+    std::string helpText() override
+    {
+        return "Shows per-command latency percentiles, CPU time and max RSS (command name for its histogram, -r resets, -o writes JSON). Usage: stats [--json] [-r] [-o file] [command]";
+    }
+};
+
+class TimeCommand : public Command
+{
+private:
+    CommandRegistry &registry;
+
+    struct Sample
+    {
+        uint64_t wall, user, system;
+        long maxRss, minorFaults, majorFaults, voluntary, involuntary, blocksIn, blocksOut;
+    };
+
+    static uint64_t percentile(std::vector<uint64_t> values, double q)
+    {
+        std::sort(values.begin(), values.end());
+        size_t rank = (size_t)std::ceil(q * values.size());
+        return values[std::min(values.size() - 1, rank ? rank - 1 : 0)];
+    }
+
+public:
+    explicit TimeCommand(CommandRegistry &commandRegistry) : registry(commandRegistry) {}
+
+    void execute(const std::vector<std::string> &args) override
+    {
+        size_t first = 1, repeat = 1;
+        if (args.size() > 2 && args[1] == "-n")
+        {
+            repeat = std::max(1L, atol(args[2].c_str()));
+            first = 3;
+        }
+        if (first >= args.size())
+        {
+            std::cout << "Usage: time [-n repeat] command [args...]\n";
+            return;
+        }
+        std::vector<std::string> command(args.begin() + first, args.end());
+        std::vector<Sample> samples;
+        int status = 0;
+        for (size_t run = 0; run < repeat; ++run)
+        {
+            struct rusage usage = {};
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            status = runCommand(registry, command, &usage);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            samples.push_back({(end.tv_sec - start.tv_sec) * 1000000ULL + (end.tv_nsec - start.tv_nsec) / 1000,
+                               CommandStats::micros(usage.ru_utime), CommandStats::micros(usage.ru_stime),
+                               usage.ru_maxrss, usage.ru_minflt, usage.ru_majflt, usage.ru_nvcsw, usage.ru_nivcsw,
+                               usage.ru_inblock, usage.ru_oublock});
+        }
+        std::cout << std::flush;
+
+        // dsh has no pipelines yet, so every command line is a single stage.
+        std::ostringstream out;
+        std::string stage;
+        for (auto &word : command)
+            stage += (stage.empty() ? "" : " ") + shellQuote(word);
+        out << "stage 1: " << stage << (status ? "  (exit " + std::to_string(status) + ")" : "") << "\n";
+        if (repeat == 1)
+        {
+            const Sample &s = samples[0];
+            out << "real    " << CommandStats::formatMicros(s.wall) << "\n"
+                << "user    " << CommandStats::formatMicros(s.user) << "\n"
+                << "sys     " << CommandStats::formatMicros(s.system) << "\n"
+                << "maxrss  " << Report::humanSize(s.maxRss * 1024ULL, false) << "\n"
+                << "faults  " << s.minorFaults << " minor, " << s.majorFaults << " major\n"
+                << "ctxsw   " << s.voluntary << " voluntary, " << s.involuntary << " involuntary\n"
+                << "io      " << s.blocksIn << " blocks in, " << s.blocksOut << " blocks out\n";
+            std::cerr << out.str();
+            return;
+        }
+        Report report;
+        auto summarize = [&](const char *name, const std::function<uint64_t(const Sample &)> &field, bool micros) {
+            std::vector<uint64_t> values;
+            for (auto &sample : samples)
+                values.push_back(field(sample));
+            auto shown = [micros](uint64_t value) {
+                return micros ? CommandStats::formatMicros(value) : std::to_string(value);
+            };
+            uint64_t low = percentile(values, 0), median = percentile(values, 0.5), p99 = percentile(values, 0.99);
+            report.row()
+                .text("metric", "", name)
+                .number("min", "min", low, shown(low))
+                .number("median", "median", median, shown(median))
+                .number("p99", "p99", p99, shown(p99));
+        };
+        summarize("real", [](const Sample &s) { return s.wall; }, true);
+        summarize("user", [](const Sample &s) { return s.user; }, true);
+        summarize("sys", [](const Sample &s) { return s.system; }, true);
+        summarize("maxrss KB", [](const Sample &s) { return (uint64_t)s.maxRss; }, false);
+        summarize("minor faults", [](const Sample &s) { return (uint64_t)s.minorFaults; }, false);
+        summarize("major faults", [](const Sample &s) { return (uint64_t)s.majorFaults; }, false);
+        summarize("vol ctxsw", [](const Sample &s) { return (uint64_t)s.voluntary; }, false);
+        summarize("invol ctxsw", [](const Sample &s) { return (uint64_t)s.involuntary; }, false);
+        summarize("blocks in", [](const Sample &s) { return (uint64_t)s.blocksIn; }, false);
+        summarize("blocks out", [](const Sample &s) { return (uint64_t)s.blocksOut; }, false);
+        out << repeat << " runs\n" << report.table();
+        std::cerr << out.str();
+    }
+    std::string helpText() override
+    {
+        return "Runs a command and reports wall, user and sys time, max RSS, page faults, context switches and block I/O; -n repeats it and reports min/median/p99. Usage: time [-n repeat] command [args...]";
+    }
+};
+
+class EnvCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() == 1)
+        {
+            system("printenv");
+        }
+        else if (args.size() == 4 && args[1] == "set")
+        {
+            setenv(args[2].c_str(), args[3].c_str(), 1);
+            if (args[2] == "PATH")
+                PathCache::shared().clear();
+        }
+        else if (args.size() == 2)
+        {
+            std::string value = getenv(args[1].c_str()) ? getenv(args[1].c_str()) : "Not set";
+            std::cout << args[1] << "=" << value << "\n";
+        }
+        else
+        {
+            std::cout << "Usage: env [set var value | var]\n";
+        }
+    }
+    std::string helpText() override
+    {
+        return "Displays, sets, or gets environment variables. Usage: env [set var value | var]";
+    }
+};
+
+class LnCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 3)
+        {
+            std::cout << "Usage: ln [target] [linkname]\n";
+            return;
+        }
+        std::string command = "ln -s " + shellQuote(args[1]) + " " + shellQuote(args[2]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Creates a symbolic link. Usage: ln [target] [linkname]";
+    }
+};
+
+class ChgrpCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 3)
+        {
+            std::cout << "Usage: chgrp [group] [file]\n";
+            return;
+        }
+        std::string command = "chgrp " + shellQuote(args[1]) + " " + shellQuote(args[2]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Changes the group ownership of a file. Usage: chgrp [group] [file]";
+    }
+};
+
+class UptimeCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::vector<std::string> options(args);
+        bool json = Report::wantsJson(options);
+        struct sysinfo si;
+        if (sysinfo(&si) != 0)
+        {
+            perror("uptime");
+            return;
+        }
+        double loads[3];
+        for (int i = 0; i < 3; ++i)
+            loads[i] = si.loads[i] / (double)(1 << SI_LOAD_SHIFT);
+        int users = countLoggedInUsers();
+        if (json)
+        {
+            Report report;
+            report.row()
+                .number("uptime_seconds", "", si.uptime)
+                .number("users", "", users)
+                .number("load1", "", loads[0])
+                .number("load5", "", loads[1])
+                .number("load15", "", loads[2]);
+            report.print(true);
+            return;
+        }
+        time_t now = time(nullptr);
+        struct tm tm;
+        localtime_r(&now, &tm);
+        char line[160];
+        snprintf(line, sizeof(line), " %02d:%02d:%02d up %s,  %d user%s,  load average: %.2f, %.2f, %.2f\n", tm.tm_hour,
+                 tm.tm_min, tm.tm_sec, formatUptime(si.uptime).c_str(), users, users == 1 ? "" : "s", loads[0], loads[1], loads[2]);
+        std::cout << line;
+    }
+    std::string helpText() override
+    {
+        return "Displays how long the system has been running. Usage: uptime [--json]";
+    }
+};
+
+class FreeCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::vector<std::string> options(args);
+        bool json = Report::wantsJson(options);
+        uint64_t divisor = 0; // 0 = human readable
+        for (size_t i = 1; i < options.size(); ++i)
+        {
+            if (options[i] == "-b")
+                divisor = 1;
+            else if (options[i] == "-k")
+                divisor = 1024;
+            else if (options[i] == "-m")
+                divisor = 1024 * 1024;
+            else if (options[i] == "-g")
+                divisor = 1024 * 1024 * 1024;
+            else if (options[i] == "-h")
+                divisor = 0;
+            else
+            {
+                std::cout << "Usage: free [-b|-k|-m|-g|-h] [--json]\n";
+                return;
+            }
+        }
+        std::map<std::string, uint64_t> mem = readMeminfo();
+        if (mem.empty())
+        {
+            perror("free: /proc/meminfo");
+            return;
+        }
+        uint64_t total = mem["MemTotal"], freeBytes = mem["MemFree"];
+        uint64_t cache = mem["Buffers"] + mem["Cached"] + mem["SReclaimable"];
+        uint64_t available = mem.count("MemAvailable") ? mem["MemAvailable"] : freeBytes;
+        uint64_t used = total > available ? total - available : 0;
+        uint64_t swapTotal = mem["SwapTotal"], swapFree = mem["SwapFree"];
+        auto shown = [divisor](uint64_t bytes) {
+            return divisor ? std::to_string(bytes / divisor) : Report::humanSize(bytes, true);
+        };
+
+        Report report;
+        report.row()
+            .text("type", "", "Mem:")
+            .number("total", "total", total, shown(total))
+            .number("used", "used", used, shown(used))
+            .number("free", "free", freeBytes, shown(freeBytes))
+            .number("shared", "shared", mem["Shmem"], shown(mem["Shmem"]))
+            .number("buff_cache", "buff/cache", cache, shown(cache))
+            .number("available", "available", available, shown(available));
+        report.row()
+            .text("type", "", "Swap:")
+            .number("total", "total", swapTotal, shown(swapTotal))
+            .number("used", "used", swapTotal - swapFree, shown(swapTotal - swapFree))
+            .number("free", "free", swapFree, shown(swapFree));
+        if (json)
+            report.printJson(false);
+        else
+            report.printTable();
+    }
+    std::string helpText() override
+    {
+        return "Displays the amount of free and used memory in the system. Usage: free [-b|-k|-m|-g|-h] [--json]";
+    }
+};
+
+class WhoCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::vector<std::string> options(args);
+        bool json = Report::wantsJson(options);
+        Report report;
+        std::string out;
+        setutxent();
+        while (struct utmpx *entry = getutxent())
+        {
+            if (entry->ut_type != USER_PROCESS)
+                continue;
+            std::string user(entry->ut_user, strnlen(entry->ut_user, sizeof(entry->ut_user)));
+            std::string line(entry->ut_line, strnlen(entry->ut_line, sizeof(entry->ut_line)));
+            std::string host(entry->ut_host, strnlen(entry->ut_host, sizeof(entry->ut_host)));
+            time_t login = entry->ut_tv.tv_sec;
+            char when[32];
+            struct tm tm;
+            localtime_r(&login, &tm);
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm);
+            report.row()
+                .text("user", "USER", user)
+                .text("line", "LINE", line)
+                .number("login_time", "TIME", login, when)
+                .text("host", "HOST", host);
+            char formatted[256];
+            snprintf(formatted, sizeof(formatted), "%-8s %-12s %s%s%s%s\n", user.c_str(), line.c_str(), when,
+                     host.empty() ? "" : " (", host.c_str(), host.empty() ? "" : ")");
+            out += formatted;
+        }
+        endutxent();
+        if (json)
+            report.printJson(false);
+        else
+            std::cout << out;
+    }
+    std::string helpText() override
+    {
+        return "Displays who is logged on. Usage: who [--json]";
+    }
+};
+
+class TracerouteCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: traceroute [host]\n";
+            return;
+        }
+        std::string command = "traceroute " + shellQuote(args[1]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Traces the route packets take to a network host. Usage: traceroute [host]";
+    }
+};
+
+class BashCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::string command = "bash ";
+        for (int i = 1; i < args.size(); i++)
+        {
+            command += shellQuote(args[i]) + " ";
+        }
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Executes a bash script or command. Usage: bash [command]";
+    }
+};
+
+class GzipCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 3)
+        {
+            std::cout << "Usage: gzip [option] [file]\n";
+            return;
+        }
+        std::string command = "gzip " + shellQuote(args[1]) + " " + shellQuote(args[2]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Compress or decompress files using gzip. Usage: gzip [option] [file]";
+    }
+};
+
+int parseSignal(std::string name)
+{
+    static const std::map<std::string, int> signals = {
+        {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"ILL", SIGILL}, {"TRAP", SIGTRAP},
+        {"ABRT", SIGABRT}, {"BUS", SIGBUS}, {"FPE", SIGFPE}, {"KILL", SIGKILL}, {"USR1", SIGUSR1},
+        {"SEGV", SIGSEGV}, {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+        {"CHLD", SIGCHLD}, {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN},
+        {"TTOU", SIGTTOU}, {"URG", SIGURG}, {"XCPU", SIGXCPU}, {"XFSZ", SIGXFSZ}, {"VTALRM", SIGVTALRM},
+        {"PROF", SIGPROF}, {"WINCH", SIGWINCH}, {"IO", SIGIO}, {"PWR", SIGPWR}, {"SYS", SIGSYS}};
+    if (!name.empty() && isdigit(name[0]))
+        return atoi(name.c_str());
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    if (name.compare(0, 3, "SIG") == 0)
+        name.erase(0, 3);
+    auto it = signals.find(name);
+    return it == signals.end() ? -1 : it->second;
+}
+
+class KillCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        int signal = SIGTERM;
+        size_t i = 1;
+        if (i < args.size() && args[i] == "-s" && i + 1 < args.size())
+        {
+            signal = parseSignal(args[i + 1]);
+            i += 2;
+        }
+        else if (i < args.size() && args[i].size() > 1 && args[i][0] == '-')
+        {
+            signal = parseSignal(args[i].substr(1));
+            ++i;
+        }
+        if (i >= args.size() || signal < 0)
+        {
+            std::cout << "Usage: kill [-signal] [pid...]\n";
+            return;
+        }
+        for (; i < args.size(); ++i)
+        {
+            // atoi would turn "%1" or a name into 0, which signals our whole
+            // process group; only explicit numbers get through.
+            char *end = nullptr;
+            errno = 0;
+            long pid = strtol(args[i].c_str(), &end, 10);
+            if (args[i].empty() || *end != '\0' || errno == ERANGE || pid != (pid_t)pid)
+            {
+                std::cout << "kill: " << args[i] << ": arguments must be process IDs\n";
+                continue;
+            }
+            if (kill((pid_t)pid, signal) != 0)
+                perror(("kill " + args[i]).c_str());
+        }
+    }
+    std::string helpText() override
+    {
+        return "Send a signal to a process. Usage: kill [-signal] [pid...]";
+    }
+};
+
+class PkillCommand : public Command
+{
+private:
+    bool listOnly;
+
+public:
+    explicit PkillCommand(bool listOnly) : listOnly(listOnly)
+    {
+    }
+    void execute(const std::vector<std::string> &args) override
+    {
+        int signal = SIGTERM;
+        bool fullCommand = false, exact = false;
+        std::string user, pattern;
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if (args[i] == "-f")
+                fullCommand = true;
+            else if (args[i] == "-x")
+                exact = true;
+            else if (args[i] == "-u" && i + 1 < args.size())
+                user = args[++i];
+            else if (!listOnly && args[i].size() > 1 && args[i][0] == '-' && pattern.empty())
+                signal = parseSignal(args[i].substr(1));
+            else
+                pattern = args[i];
+        }
+        if (pattern.empty() || signal < 0)
+        {
+            std::cout << "Usage: " << helpText().substr(helpText().find("Usage: ") + 7) << "\n";
+            return;
+        }
+        regex_t regex;
+        std::string anchored = exact ? "^(" + pattern + ")$" : pattern;
+        if (regcomp(&regex, anchored.c_str(), REG_EXTENDED | REG_NOSUB) != 0)
+        {
+            std::cout << "Invalid pattern: " << pattern << "\n";
+            return;
+        }
+        int self = getpid();
+        int matched = 0;
+        for (auto &p : ProcessTable::scan(fullCommand))
+        {
+            if (p.pid == self || (!user.empty() && ProcessTable::userName(p.uid) != user && std::to_string(p.uid) != user))
+                continue;
+            const char *subject = fullCommand && !p.cmdline.empty() ? p.cmdline.c_str() : p.comm;
+            if (regexec(&regex, subject, 0, nullptr, 0) != 0)
+                continue;
+            ++matched;
+            if (listOnly)
+                std::cout << p.pid << "\n";
+            else if (kill(p.pid, signal) != 0)
+                perror(("pkill " + std::to_string(p.pid)).c_str());
+        }
+        regfree(&regex);
+        if (matched == 0 && !listOnly)
+            std::cout << "No matching processes\n";
+    }
+    std::string helpText() override
+    {
+        if (listOnly)
+            return "Lists pids of processes matching a pattern. Usage: pgrep [-f] [-x] [-u user] [pattern]";
+        return "Signals processes matching a pattern. Usage: pkill [-signal] [-f] [-x] [-u user] [pattern]";
+    }
+};
+
+class AwkCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::string command = "awk ";
+        for (int i = 1; i < args.size(); i++)
+        {
+            command += shellQuote(args[i]) + " ";
+        }
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Program for pattern scanning and processing. Usage: awk [program] [file...]";
+    }
+};
+
+class UnameCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::vector<std::string> options(args);
+        bool json = Report::wantsJson(options);
+        struct utsname names;
+        if (uname(&names) != 0)
+        {
+            perror("uname");
+            return;
+        }
+        if (json)
+        {
+            Report report;
+            report.row()
+                .text("kernel_name", "", names.sysname)
+                .text("nodename", "", names.nodename)
+                .text("kernel_release", "", names.release)
+                .text("kernel_version", "", names.version)
+                .text("machine", "", names.machine)
+                .text("operating_system", "", "GNU/Linux");
+            report.print(true);
+            return;
+        }
+        std::string flags;
+        for (size_t i = 1; i < options.size(); ++i)
+        {
+            if (options[i].size() < 2 || options[i][0] != '-' ||
+                options[i].find_first_not_of("asnrvmo", 1) != std::string::npos)
+            {
+                std::cout << "Usage: uname [-asnrvmo] [--json]\n";
+                return;
+            }
+            flags += options[i].substr(1);
+        }
+        if (flags.empty())
+            flags = "s";
+        if (flags.find('a') != std::string::npos)
+            flags = "snrvmo";
+        std::vector<std::string> parts;
+        for (char flag : std::string("snrvmo"))
+        {
+            if (flags.find(flag) == std::string::npos)
+                continue;
+            switch (flag)
+            {
+            case 's': parts.push_back(names.sysname); break;
+            case 'n': parts.push_back(names.nodename); break;
+            case 'r': parts.push_back(names.release); break;
+            case 'v': parts.push_back(names.version); break;
+            case 'm': parts.push_back(names.machine); break;
+            case 'o': parts.push_back("GNU/Linux"); break;
+            }
+        }
+        for (size_t i = 0; i < parts.size(); ++i)
+            std::cout << (i ? " " : "") << parts[i];
+        std::cout << "\n";
+    }
+    std::string helpText() override
+    {
+        return "Prints system information. Usage: uname [-asnrvmo] [--json]";
+    }
+};
+
+class LessCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: less [file]\n";
+            return;
+        }
+        std::string command = "less " + shellQuote(args[1]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "View file contents interactively. Usage: less [file]";
+    }
+};
+
+class DateCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::vector<std::string> options(args);
+        bool json = Report::wantsJson(options);
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        struct tm tm;
+        localtime_r(&now.tv_sec, &tm);
+        char buffer[256];
+        if (json)
+        {
+            strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S%z", &tm);
+            Report report;
+            report.row()
+                .number("epoch_seconds", "", now.tv_sec)
+                .number("nanoseconds", "", now.tv_nsec)
+                .text("iso8601", "", buffer)
+                .text("timezone", "", tm.tm_zone ? tm.tm_zone : "");
+            report.print(true);
+            return;
+        }
+        if (options.size() == 1 || (options.size() == 2 && options[1][0] == '+'))
+        {
+            std::string format = options.size() == 2 ? options[1].substr(1) : "%a %b %e %H:%M:%S %Z %Y";
+            size_t length = strftime(buffer, sizeof(buffer), format.c_str(), &tm);
+            std::cout << std::string(buffer, length) << "\n";
+            return;
+        }
+        std::string value;
+        for (size_t i = 1; i < options.size(); ++i)
+            value += (i > 1 ? " " : "") + options[i];
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+            value = value.substr(1, value.size() - 2);
+        struct tm wanted = {};
+        const char *end = strptime(value.c_str(), "%Y-%m-%d %H:%M:%S", &wanted);
+        if (!end || *end)
+        {
+            std::cout << "Usage: date [+format] [--json] [\"YYYY-MM-DD HH:MM:SS\"]\n";
+            return;
+        }
+        wanted.tm_isdst = -1;
+        struct timespec when = {mktime(&wanted), 0};
+        if (clock_settime(CLOCK_REALTIME, &when) != 0)
+        {
+            perror("date: cannot set date");
+            return;
+        }
+        strftime(buffer, sizeof(buffer), "%a %b %e %H:%M:%S %Z %Y", &wanted);
+        std::cout << buffer << "\n";
+    }
+    std::string helpText() override
+    {
+        return "Displays or sets the system date and time. Usage: date [+format] [--json] [\"YYYY-MM-DD HH:MM:SS\"]";
+    }
+};
+
+class MountCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 3)
+        {
+            std::cout << "Usage: mount [source] [target]\n";
+            return;
+        }
+        std::string command = "mount " + shellQuote(args[1]) + " " + shellQuote(args[2]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Mounts filesystems. Usage: mount [source] [target]";
+    }
+};
+
+class UmountCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: umount [target]\n";
+            return;
+        }
+        std::string command = "umount " + shellQuote(args[1]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Unmounts filesystems. Usage: umount [target]";
+    }
+};
+
+class InitCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: init [runlevel]\n";
+            return;
+        }
+        std::string command = "init " + shellQuote(args[1]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Changes the runlevel of the system. Usage: init [runlevel]";
+    }
+};
+
+class LastCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        system("last");
+    }
+    std::string helpText() override
+    {
+        return "Shows a list of last logged in users. Usage: last";
+    }
+};
+
+class NmapCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::string command = "nmap ";
+        for (int i = 1; i < args.size(); i++)
+        {
+            command += shellQuote(args[i]) + " ";
+        }
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Network exploration tool and security scanner. Usage: nmap [options]";
+    }
+};
+
+class PsAuxCommand : public PsCommand
+{
+public:
+    std::string helpText() override
+    {
+        return "Detailed view of currently running processes. Usage: psaux [-o cols] [--sort [-]col,...] [-u users] [-p pids] [-C names]";
+    }
+};
+
+class TcpdumpCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::string command = "tcpdump ";
+        for (int i = 1; i < args.size(); i++)
+        {
+            command += shellQuote(args[i]) + " ";
+        }
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Command-line packet analyzer. Usage: tcpdump [options]";
+    }
+};
+
+class TouchCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: touch [file]\n";
+            return;
+        }
+        std::string command = "touch " + shellQuote(args[1]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Updates the access and modification times of a file. Usage: touch [file]";
+    }
+};
+
+class ManCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: man [command]\n";
+            return;
+        }
+        std::string command = "man " + shellQuote(args[1]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Displays user manual of any command. Usage: man [command]";
+    }
+};
+
+// Local rsync: trees are compared by size and mtime in parallel, new files
+// are copied with copy_file_range, and changed files go through the rsync
+// block-matching algorithm (rolling weak checksum, SHA-256 on weak hits)
+// against the old destination so only the changed blocks are written.
+// Remote paths and options this builtin does not know go to the real rsync.
+class RsyncCommand : public Command
+{
+private:
+    struct Entry
+    {
+        std::string path; // relative to the source root, "" for the root
+        struct stat st;
+        enum
+        {
+            Skip,
+            Create,
+            Update
+        } action = Skip;
+        bool ownerDiffers = false;
+        bool replace = false; // the destination exists with another file type
+    };
+
+    struct Options
+    {
+        bool recursive = false;
+        bool verbose = false;
+        bool dryRun = false;
+        bool remove = false;
+        bool stats = false;
+        bool owner = false;
+        bool group = false;
+        bool devices = false;
+    };
+
+    struct Totals
+    {
+        std::atomic<uint64_t> created{0}, updated{0}, skipped{0}, removed{0};
+        std::atomic<uint64_t> literal{0}, matched{0};
+    };
+
+    // A run of the new file: bytes copied from `offset` of the old
+    // destination, or taken literally from `offset` of the source.
+    struct Op
+    {
+        bool copy;
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    typedef std::array<unsigned char, 16> Digest;
+
+    static std::string join(const std::string &root, const std::string &path)
+    {
+        return path.empty() ? root : root + "/" + path;
+    }
+
+    static Digest strongHash(const char *data, size_t length)
+    {
+        static const EVP_MD *md = EVP_sha256();
+        unsigned char full[EVP_MAX_MD_SIZE];
+        unsigned int size;
+        EVP_Digest(data, length, full, &size, md, nullptr);
+        Digest digest;
+        memcpy(digest.data(), full, digest.size());
+        return digest;
+    }
+
+    // rsync's block size heuristic: about sqrt(size), at least 700 bytes.
+    static size_t blockSize(uint64_t size)
+    {
+        size_t block = (size_t)std::sqrt((double)size) & ~(size_t)7;
+        return std::min<size_t>(std::max<size_t>(block, 700), 1 << 17);
+    }
+
+    static uint32_t weakSum(const unsigned char *data, size_t length, uint32_t &a, uint32_t &b)
+    {
+        a = b = 0;
+        for (size_t i = 0; i < length; ++i)
+        {
+            a += data[i];
+            b += (uint32_t)(length - i) * data[i];
+        }
+        return (a & 0xffff) | (b << 16);
+    }
+
+    static void walk(const std::string &root, const std::string &path, std::vector<Entry> &entries)
+    {
+        DIR *dir = opendir(join(root, path).c_str());
+        if (!dir)
+        {
+            perror(join(root, path).c_str());
+            return;
+        }
+        std::vector<std::string> names;
+        while (struct dirent *ent = readdir(dir))
+        {
+            if (strcmp(ent->d_name, ".") && strcmp(ent->d_name, ".."))
+                names.push_back(ent->d_name);
+        }
+        std::sort(names.begin(), names.end());
+        for (auto &name : names)
+        {
+            Entry entry;
+            entry.path = path.empty() ? name : path + "/" + name;
+            if (fstatat(dirfd(dir), name.c_str(), &entry.st, AT_SYMLINK_NOFOLLOW) != 0)
+                continue;
+            entries.push_back(entry);
+            if (S_ISDIR(entry.st.st_mode))
+                walk(root, entry.path, entries);
+        }
+        closedir(dir);
+    }
+
+    // Computes how to build `source` out of blocks of `basis`.
+    static std::vector<Op> delta(const MappedFile &basis, const MappedFile &source)
+    {
+        const unsigned char *old = reinterpret_cast<const unsigned char *>(basis.data());
+        const unsigned char *data = reinterpret_cast<const unsigned char *>(source.data());
+        size_t block = blockSize(basis.size());
+        size_t blocks = basis.size() / block;
+        std::unordered_map<uint32_t, std::vector<uint32_t>> table;
+        table.reserve(blocks);
+        for (size_t i = 0; i < blocks; ++i)
+        {
+            uint32_t a, b;
+            table[weakSum(old + i * block, block, a, b)].push_back(i);
+        }
+        std::vector<Digest> hashes(blocks);
+        std::vector<bool> hashed(blocks);
+
+        std::vector<Op> ops;
+        auto emit = [&](bool copy, uint64_t offset, uint64_t length) {
+            if (!ops.empty() && ops.back().copy == copy && ops.back().offset + ops.back().length == offset)
+                ops.back().length += length;
+            else if (length > 0)
+                ops.push_back({copy, offset, length});
+        };
+        size_t size = source.size(), pos = 0, literalStart = 0;
+        uint32_t a = 0, b = 0;
+        bool rolling = false;
+        while (blocks > 0 && pos + block <= size)
+        {
+            if (!rolling)
+                weakSum(data + pos, block, a, b);
+            rolling = true;
+            auto it = table.find((a & 0xffff) | (b << 16));
+            if (it != table.end())
+            {
+                Digest digest = strongHash((const char *)data + pos, block);
+                // Prefer the block at the same offset so unchanged regions
+                // of an in-place update need no write at all.
+                int64_t found = -1;
+                for (uint32_t index : it->second)
+                {
+                    if (!hashed[index])
+                    {
+                        hashes[index] = strongHash((const char *)old + (size_t)index * block, block);
+                        hashed[index] = true;
+                    }
+                    if (hashes[index] == digest && (found < 0 || (uint64_t)index * block == pos))
+                        found = index;
+                }
+                if (found >= 0)
+                {
+                    emit(false, literalStart, pos - literalStart);
+                    emit(true, (uint64_t)found * block, block);
+                    pos += block;
+                    literalStart = pos;
+                    rolling = false;
+                    continue;
+                }
+            }
+            if (pos + block < size)
+            {
+                uint32_t out = data[pos], in = data[pos + block];
+                a += in - out;
+                b += a - (uint32_t)block * out;
+            }
+            ++pos;
+        }
+        emit(false, literalStart, size - literalStart);
+        return ops;
+    }
+
+    static bool finishFile(int fd, const struct stat &st)
+    {
+        struct timespec times[2] = {st.st_atim, st.st_mtim};
+        bool ok = fchmod(fd, st.st_mode & 07777) == 0 && futimens(fd, times) == 0;
+        return close(fd) == 0 && ok;
+    }
+
+    static bool copyNew(const std::string &from, const std::string &to, const struct stat &st, Totals &totals)
+    {
+        int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0)
+            return false;
+        std::string temp = to + ".dsh-rsync.XXXXXX";
+        int out = mkostemp(&temp[0], O_CLOEXEC);
+        if (out < 0)
+        {
+            close(in);
+            return false;
+        }
+        bool ok = copyFileData(in, out, st.st_size);
+        close(in);
+        ok = finishFile(out, st) && ok && rename(temp.c_str(), to.c_str()) == 0;
+        if (!ok)
+            unlink(temp.c_str());
+        else
+            totals.literal += st.st_size;
+        return ok;
+    }
+
+    static bool update(const std::string &from, const std::string &to, const struct stat &st, Totals &totals)
+    {
+        MappedFile basis, source;
+        if (!basis.open(to) || !source.open(from))
+            return false;
+        if (basis.size() == 0)
+            return copyNew(from, to, st, totals);
+        std::vector<Op> ops = delta(basis, source);
+        uint64_t literal = 0, matched = 0;
+        bool aligned = true;
+        for (size_t i = 0, at = 0; i < ops.size(); at += ops[i++].length)
+        {
+            (ops[i].copy ? matched : literal) += ops[i].length;
+            aligned &= !ops[i].copy || ops[i].offset == at;
+        }
+        totals.literal += literal;
+        totals.matched += matched;
+
+        // Matches that stayed in place: patch the destination directly and
+        // write only the literal runs.
+        if (aligned)
+        {
+            int fd = open(to.c_str(), O_WRONLY | O_CLOEXEC);
+            if (fd < 0)
+                return false;
+            bool ok = true;
+            for (size_t i = 0, at = 0; ok && i < ops.size(); at += ops[i++].length)
+            {
+                if (ops[i].copy)
+                    continue;
+                for (uint64_t done = 0; ok && done < ops[i].length;)
+                {
+                    ssize_t n = pwrite(fd, source.data() + ops[i].offset + done, ops[i].length - done, at + done);
+                    ok = n > 0;
+                    done += std::max<ssize_t>(n, 0);
+                }
+            }
+            ok = ok && ftruncate(fd, source.size()) == 0;
+            return finishFile(fd, st) && ok;
+        }
+
+        // Data moved around: assemble a new file from ranges of the old one
+        // (copy_file_range, so reflink-capable file systems share extents)
+        // and the literal runs, then rename it over the destination.
+        int old = open(to.c_str(), O_RDONLY | O_CLOEXEC);
+        std::string temp = to + ".dsh-rsync.XXXXXX";
+        int out = old < 0 ? -1 : mkostemp(&temp[0], O_CLOEXEC);
+        if (out < 0)
+        {
+            if (old >= 0)
+                close(old);
+            return false;
+        }
+        bool ok = true;
+        for (auto &op : ops)
+        {
+            if (!op.copy)
+            {
+                ok = ok && writeAll(out, source.data() + op.offset, op.length);
+                continue;
+            }
+            ok = ok && lseek(old, op.offset, SEEK_SET) == (off_t)op.offset && copyFileData(old, out, op.length);
+        }
+        close(old);
+        ok = finishFile(out, st) && ok && rename(temp.c_str(), to.c_str()) == 0;
+        if (!ok)
+            unlink(temp.c_str());
+        return ok;
+    }
+
+    static bool isSpecial(mode_t mode)
+    {
+        return S_ISFIFO(mode) || S_ISSOCK(mode) || S_ISCHR(mode) || S_ISBLK(mode);
+    }
+
+    static std::string linkTarget(const std::string &path)
+    {
+        char link[PATH_MAX];
+        ssize_t n = readlink(path.c_str(), link, sizeof(link));
+        return std::string(link, std::max<ssize_t>(n, 0));
+    }
+
+    static bool removeTree(const std::string &path)
+    {
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            DIR *dir = opendir(path.c_str());
+            if (!dir)
+                return false;
+            while (struct dirent *ent = readdir(dir))
+            {
+                if (strcmp(ent->d_name, ".") && strcmp(ent->d_name, ".."))
+                    removeTree(path + "/" + ent->d_name);
+            }
+            closedir(dir);
+            return rmdir(path.c_str()) == 0;
+        }
+        return unlink(path.c_str()) == 0;
+    }
+
+    // Deletes destination entries that have no counterpart in the source.
+    static void removeExtraneous(const std::string &dstRoot, const std::vector<Entry> &entries, const Options &options,
+                                 Totals &totals)
+    {
+        std::set<std::string> wanted;
+        for (auto &entry : entries)
+            wanted.insert(entry.path);
+        std::set<std::string> removed;
+        std::vector<Entry> existing;
+        walk(dstRoot, "", existing);
+        for (auto &entry : existing)
+        {
+            // Children of a removed directory went with it.
+            bool parentGone = false;
+            for (size_t slash = entry.path.find('/'); !parentGone && slash != std::string::npos;
+                 slash = entry.path.find('/', slash + 1))
+                parentGone = removed.count(entry.path.substr(0, slash)) > 0;
+            if (wanted.count(entry.path) || parentGone)
+                continue;
+            if (options.verbose || options.dryRun)
+                std::cout << "deleting " << entry.path << (S_ISDIR(entry.st.st_mode) ? "/" : "") << "\n";
+            if (!options.dryRun && !removeTree(join(dstRoot, entry.path)))
+                perror(join(dstRoot, entry.path).c_str());
+            ++totals.removed;
+            if (S_ISDIR(entry.st.st_mode))
+                removed.insert(entry.path);
+        }
+    }
+
+    void sync(const std::string &srcArg, const std::string &dstArg, const Options &options)
+    {
+        struct timespec started, finished;
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        Entry root;
+        if (lstat(srcArg.c_str(), &root.st) != 0)
+        {
+            perror(srcArg.c_str());
+            return;
+        }
+        std::string srcRoot = srcArg, dstRoot = dstArg;
+        while (srcRoot.size() > 1 && srcRoot.back() == '/')
+            srcRoot.pop_back();
+        while (dstRoot.size() > 1 && dstRoot.back() == '/')
+            dstRoot.pop_back();
+        std::string base = srcRoot.substr(srcRoot.rfind('/') + 1);
+        struct stat dstStat;
+        bool dstIsDir = stat(dstRoot.c_str(), &dstStat) == 0 && S_ISDIR(dstStat.st_mode);
+        std::vector<Entry> entries;
+        if (S_ISDIR(root.st.st_mode))
+        {
+            if (!options.recursive)
+            {
+                std::cout << "skipping directory " << srcArg << "\n";
+                return;
+            }
+            // "src/" syncs the contents of src, "src" the directory itself.
+            if (srcArg.back() != '/')
+            {
+                if (!dstIsDir && !options.dryRun && mkdir(dstRoot.c_str(), 0755) != 0)
+                {
+                    perror(dstRoot.c_str());
+                    return;
+                }
+                dstRoot = join(dstRoot, base);
+            }
+            entries.push_back(root);
+            walk(srcRoot, "", entries);
+        }
+        else
+        {
+            if (dstIsDir || dstArg.back() == '/')
+                dstRoot = join(dstRoot, base);
+            entries.push_back(root);
+        }
+
+        // Compare against the destination in parallel: one lstat per entry.
+        Totals totals;
+        ThreadPool pool;
+        size_t chunk = std::max<size_t>(64, entries.size() / (pool.size() * 4) + 1);
+        for (size_t begin = 0; begin < entries.size(); begin += chunk)
+        {
+            pool.submit([&, begin] {
+                for (size_t i = begin; i < std::min(entries.size(), begin + chunk); ++i)
+                {
+                    Entry &entry = entries[i];
+                    struct stat st;
+                    if (lstat(join(dstRoot, entry.path).c_str(), &st) != 0)
+                        entry.action = Entry::Create;
+                    else if ((st.st_mode & S_IFMT) != (entry.st.st_mode & S_IFMT))
+                    {
+                        entry.action = Entry::Create;
+                        entry.replace = true;
+                    }
+                    else if (S_ISREG(entry.st.st_mode) &&
+                             (!S_ISREG(st.st_mode) || st.st_size != entry.st.st_size ||
+                              st.st_mtim.tv_sec != entry.st.st_mtim.tv_sec ||
+                              st.st_mtim.tv_nsec != entry.st.st_mtim.tv_nsec))
+                        entry.action = S_ISREG(st.st_mode) ? Entry::Update : Entry::Create;
+                    else if (S_ISLNK(entry.st.st_mode) &&
+                             (!S_ISLNK(st.st_mode) || linkTarget(join(srcRoot, entry.path)) !=
+                                                          linkTarget(join(dstRoot, entry.path))))
+                        entry.action = Entry::Create;
+                    else if (isSpecial(entry.st.st_mode) &&
+                             st.st_rdev != entry.st.st_rdev)
+                        entry.action = Entry::Create;
+                    entry.ownerDiffers = (options.owner && st.st_uid != entry.st.st_uid) ||
+                                         (options.group && st.st_gid != entry.st.st_gid);
+                }
+            });
+        }
+        pool.wait();
+
+        // Directories and symlinks first, in tree order, then file data in
+        // parallel.
+        std::vector<std::string> lines(entries.size());
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            Entry &entry = entries[i];
+            std::string target = join(dstRoot, entry.path);
+            if (entry.action == Entry::Skip)
+            {
+                ++totals.skipped;
+                continue;
+            }
+            std::string shown = entry.path.empty() ? (srcArg.back() == '/' ? "." : base) : entry.path;
+            if (S_ISDIR(entry.st.st_mode))
+                shown += "/";
+            // Whatever sits there now has the wrong type; clear it first.
+            if (entry.replace && !options.dryRun && !(isSpecial(entry.st.st_mode) && !options.devices) &&
+                !removeTree(target))
+                perror(target.c_str());
+            if (S_ISDIR(entry.st.st_mode))
+            {
+                if (!options.dryRun && mkdir(target.c_str(), 0700) != 0 && errno != EEXIST)
+                    perror(target.c_str());
+                lines[i] = shown;
+            }
+            else if (S_ISLNK(entry.st.st_mode))
+            {
+                std::string link = linkTarget(join(srcRoot, entry.path));
+                if (!link.empty() && !options.dryRun)
+                {
+                    unlink(target.c_str());
+                    if (symlink(link.c_str(), target.c_str()) != 0)
+                        perror(target.c_str());
+                }
+                lines[i] = shown + " -> " + link;
+                ++totals.created;
+            }
+            else if (isSpecial(entry.st.st_mode))
+            {
+                if (!options.devices)
+                {
+                    lines[i] = "rsync: skipping non-regular file " + shown;
+                    entry.action = Entry::Skip;
+                    ++totals.skipped;
+                    continue;
+                }
+                lines[i] = shown;
+                ++totals.created;
+                if (options.dryRun)
+                    continue;
+                unlink(target.c_str());
+                struct timespec times[2] = {entry.st.st_atim, entry.st.st_mtim};
+                if (mknod(target.c_str(), entry.st.st_mode & (S_IFMT | 07777), entry.st.st_rdev) != 0)
+                    perror(target.c_str());
+                else
+                    utimensat(AT_FDCWD, target.c_str(), times, AT_SYMLINK_NOFOLLOW);
+            }
+            else if (S_ISREG(entry.st.st_mode))
+            {
+                lines[i] = shown;
+                (entry.action == Entry::Create ? totals.created : totals.updated)++;
+                if (options.dryRun)
+                    continue;
+                pool.submit([&, i, target] {
+                    Entry &file = entries[i];
+                    std::string source = join(srcRoot, file.path);
+                    bool ok = file.action == Entry::Create ? copyNew(source, target, file.st, totals)
+                                                           : update(source, target, file.st, totals);
+                    if (!ok)
+                        lines[i] = "rsync: " + target + ": " + strerror(errno);
+                });
+            }
+        }
+        pool.wait();
+
+        if (options.remove && S_ISDIR(root.st.st_mode))
+            removeExtraneous(dstRoot, entries, options, totals);
+        // Ownership, then directory permissions and times, deepest first,
+        // since filling a directory changes its mtime.
+        for (size_t i = entries.size(); i-- > 0 && !options.dryRun;)
+        {
+            const Entry &entry = entries[i];
+            std::string target = join(dstRoot, entry.path);
+            bool chowned = (options.owner || options.group) && (entry.action != Entry::Skip || entry.ownerDiffers) &&
+                           lchown(target.c_str(), options.owner ? entry.st.st_uid : (uid_t)-1,
+                                  options.group ? entry.st.st_gid : (gid_t)-1) == 0;
+            // chown drops set-id bits, so files that had them get their mode again.
+            if (chowned && S_ISREG(entry.st.st_mode) && (entry.st.st_mode & 06000))
+                chmod(target.c_str(), entry.st.st_mode & 07777);
+            if (S_ISDIR(entry.st.st_mode))
+            {
+                struct timespec times[2] = {entry.st.st_atim, entry.st.st_mtim};
+                chmod(target.c_str(), entry.st.st_mode & 07777);
+                utimensat(AT_FDCWD, target.c_str(), times, 0);
+            }
+        }
+
+        for (auto &line : lines)
+        {
+            if (line.compare(0, 7, "rsync: ") == 0)
+                std::cerr << line << "\n";
+            else if (!line.empty() && (options.verbose || options.dryRun))
+                std::cout << line << "\n";
+        }
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        uint64_t micros = (finished.tv_sec - started.tv_sec) * 1000000ULL + (finished.tv_nsec - started.tv_nsec) / 1000;
+        if (options.verbose || options.stats)
+        {
+            std::cout << entries.size() << " entries: " << totals.created << " created, " << totals.updated
+                      << " updated, " << totals.skipped << " unchanged, " << totals.removed << " deleted\n"
+                      << Report::humanSize(totals.literal, true) << " written, "
+                      << Report::humanSize(totals.matched, true) << " matched in place or reused, "
+                      << CommandStats::formatMicros(micros) << (options.dryRun ? " (dry run)" : "") << "\n";
+        }
+    }
+
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        Options options;
+        std::vector<std::string> paths;
+        bool native = true;
+        for (size_t i = 1; i < args.size() && native; ++i)
+        {
+            const std::string &arg = args[i];
+            if (arg == "--delete")
+                options.remove = true;
+            else if (arg == "--stats")
+                options.stats = true;
+            else if (arg == "--dry-run")
+                options.dryRun = true;
+            else if (arg.size() > 1 && arg[0] == '-' && arg[1] != '-')
+            {
+                for (char flag : arg.substr(1))
+                {
+                    if (flag == 'a')
+                    {
+                        // -rlptgoD; like rsync, owners are only kept when running as root.
+                        options.recursive = options.group = options.devices = true;
+                        options.owner = geteuid() == 0;
+                    }
+                    else if (flag == 'r')
+                        options.recursive = true;
+                    else if (flag == 'v')
+                        options.verbose = true;
+                    else if (flag == 'n')
+                        options.dryRun = true;
+                    else if (flag == 'o')
+                        options.owner = geteuid() == 0;
+                    else if (flag == 'g')
+                        options.group = true;
+                    else if (flag == 'D')
+                        options.devices = true;
+                    else if (!strchr("tpl", flag)) // times, permissions and symlinks are always kept
+                        native = false;
+                }
+            }
+            else if (arg[0] == '-')
+                native = false;
+            else
+            {
+                size_t colon = arg.find(':');
+                native = colon == std::string::npos || arg.find('/') < colon;
+                paths.push_back(arg);
+            }
+        }
+        if (native && paths.size() == 2)
+        {
+            sync(paths[0], paths[1], options);
+            return;
+        }
+        if (native)
+        {
+            std::cout << "Usage: rsync [-avrnogD] [--delete] [--stats] [source] [destination]\n";
+            return;
+        }
+        std::string command = "rsync ";
+        for (int i = 1; i < args.size(); i++)
+        {
+            command += shellQuote(args[i]) + " ";
+        }
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Syncs files and directories between two locations, copying only changed blocks of local files. "
+               "Usage: rsync [-avrnogD] [--delete] [--stats] [source] [destination]";
+    }
+};
+
+class SqlCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::string command = "sqlite3 ";
+        for (int i = 1; i < args.size(); i++)
+        {
+            command += shellQuote(args[i]) + " ";
+        }
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Executes SQL commands or scripts. Usage: sql [database] [SQL command]";
+    }
+};
+
+class GitCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::string command = "git ";
+        for (int i = 1; i < args.size(); i++)
+        {
+            command += shellQuote(args[i]) + " ";
+        }
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Executes Git commands for version control. Usage: git [command]";
+    }
+};
+
+class PythonCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::string command = "python3 ";
+        for (int i = 1; i < args.size(); i++)
+        {
+            command += shellQuote(args[i]) + " ";
+        }
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Executes Python scripts or commands. Usage: python [script or command]";
+    }
+};
+
+class EnvListCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        system("printenv");
+    }
+    std::string helpText() override
+    {
+        return "Lists all environment variables. Usage: envlist";
+    }
+};
+
+class GppCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: g++ [source file]\n";
+            return;
+        }
+        std::string command = "g++ " + shellQuote(args[1]) + " -o " + shellQuote(args[1].substr(0, args[1].find('.')));
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Compiles C++ source files. Usage: g++ [source file]";
+    }
+};
+
+// Chunked AES-256-GCM container shared by encrypt/decrypt.
+//
+//   header  "DSHAEAD1" | chunk size u32 | PBKDF2 iterations u32 | salt[16] | nonce[12] | reserved[4]
+//   chunks  ciphertext[chunk size] | tag[16], repeated; the last chunk may be short
+//
+// Each chunk is sealed independently with nonce = base nonce ^ chunk index
+// and AAD = header | index | final flag, so chunks can be processed in
+// parallel or individually while reordering and truncation are detected.
+class ChunkedCipher
+{
+public:
+    static const size_t headerSize = 48;
+    static const size_t tagSize = 16;
+
+    struct Header
+    {
+        uint32_t chunkSize = 1 << 20;
+        uint32_t iterations = 200000;
+        unsigned char salt[16];
+        unsigned char nonce[12];
+        unsigned char bytes[headerSize];
+    };
+
+    static void encodeHeader(Header &header)
+    {
+        memset(header.bytes, 0, headerSize);
+        memcpy(header.bytes, "DSHAEAD1", 8);
+        for (int i = 0; i < 4; ++i)
+        {
+            header.bytes[8 + i] = (header.chunkSize >> (8 * i)) & 0xff;
+            header.bytes[12 + i] = (header.iterations >> (8 * i)) & 0xff;
+        }
+        memcpy(header.bytes + 16, header.salt, 16);
+        memcpy(header.bytes + 32, header.nonce, 12);
+    }
+
+    static bool decodeHeader(const unsigned char *bytes, size_t size, Header &header)
+    {
+        if (size < headerSize || memcmp(bytes, "DSHAEAD1", 8) != 0)
+            return false;
+        memcpy(header.bytes, bytes, headerSize);
+        header.chunkSize = header.iterations = 0;
+        for (int i = 3; i >= 0; --i)
+        {
+            header.chunkSize = (header.chunkSize << 8) | bytes[8 + i];
+            header.iterations = (header.iterations << 8) | bytes[12 + i];
+        }
+        memcpy(header.salt, bytes + 16, 16);
+        memcpy(header.nonce, bytes + 32, 12);
+        return header.chunkSize > 0 && header.chunkSize <= (1u << 30) && header.iterations > 0;
+    }
+
+    static bool readSecret(const std::string &keyFile, bool confirm, std::string &secret)
+    {
+        if (!keyFile.empty())
+        {
+            std::ifstream file(keyFile, std::ios::binary);
+            if (!file.is_open())
+            {
+                perror(keyFile.c_str());
+                return false;
+            }
+            secret.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            while (!secret.empty() && (secret.back() == '\n' || secret.back() == '\r'))
+                secret.pop_back();
+            return !secret.empty();
+        }
+        int tty = open("/dev/tty", O_RDWR | O_CLOEXEC);
+        if (tty < 0)
+        {
+            std::cout << "No terminal to read the passphrase from; use -k [keyfile]\n";
+            return false;
+        }
+        auto prompt = [tty](const char *text, std::string &out) {
+            struct termios saved, quiet;
+            tcgetattr(tty, &saved);
+            quiet = saved;
+            quiet.c_lflag &= ~ECHO;
+            tcsetattr(tty, TCSAFLUSH, &quiet);
+            writeAll(tty, text, strlen(text));
+            out.clear();
+            char c;
+            while (read(tty, &c, 1) == 1 && c != '\n')
+                out += c;
+            tcsetattr(tty, TCSAFLUSH, &saved);
+            writeAll(tty, "\n", 1);
+        };
+        std::string again;
+        prompt("Passphrase: ", secret);
+        if (confirm)
+            prompt("Confirm passphrase: ", again);
+        close(tty);
+        if (confirm && again != secret)
+        {
+            std::cout << "Passphrases do not match\n";
+            return false;
+        }
+        return !secret.empty();
+    }
+
+    static bool deriveKey(const std::string &secret, const Header &header, unsigned char key[32])
+    {
+        return PKCS5_PBKDF2_HMAC(secret.data(), secret.size(), header.salt, sizeof(header.salt),
+                                 header.iterations, EVP_sha256(), 32, key) == 1;
+    }
+
+    // Seals (encrypt) or opens (decrypt) one chunk. `in` holds plaintext or
+    // ciphertext; on encrypt `tag` is written, on decrypt it is verified.
+    static bool process(bool encrypt, const unsigned char key[32], const Header &header, uint64_t index, bool final,
+                        const unsigned char *in, size_t size, unsigned char *out, unsigned char *tag)
+    {
+        unsigned char nonce[12], aad[headerSize + 9];
+        memcpy(nonce, header.nonce, 12);
+        for (int i = 0; i < 8; ++i)
+            nonce[4 + i] ^= (index >> (8 * (7 - i))) & 0xff;
+        memcpy(aad, header.bytes, headerSize);
+        for (int i = 0; i < 8; ++i)
+            aad[headerSize + i] = (index >> (8 * (7 - i))) & 0xff;
+        aad[headerSize + 8] = final ? 1 : 0;
+
+        EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+        int len = 0;
+        bool ok = ctx &&
+                  EVP_CipherInit_ex(ctx, EVP_aes_256_gcm(), nullptr, nullptr, nullptr, encrypt) == 1 &&
+                  EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, 12, nullptr) == 1 &&
+                  EVP_CipherInit_ex(ctx, nullptr, nullptr, key, nonce, encrypt) == 1 &&
+                  EVP_CipherUpdate(ctx, nullptr, &len, aad, sizeof(aad)) == 1 &&
+                  (size == 0 || EVP_CipherUpdate(ctx, out, &len, in, size) == 1);
+        if (ok && !encrypt)
+            ok = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, tagSize, tag) == 1;
+        ok = ok && EVP_CipherFinal_ex(ctx, out + size, &len) == 1;
+        if (ok && encrypt)
+            ok = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, tagSize, tag) == 1;
+        EVP_CIPHER_CTX_free(ctx);
+        return ok;
+    }
+};
+
+class EncryptCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::string input, output, keyFile;
+        uint32_t chunkMiB = 1;
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if (args[i] == "-o" && i + 1 < args.size())
+                output = args[++i];
+            else if (args[i] == "-k" && i + 1 < args.size())
+                keyFile = args[++i];
+            else if (args[i] == "-c" && i + 1 < args.size())
+                chunkMiB = std::max(1, atoi(args[++i].c_str()));
+            else
+                input = args[i];
+        }
+        if (input.empty() || chunkMiB > 1024)
+        {
+            std::cout << "Usage: encrypt [file] [-o output] [-k keyfile] [-c chunk_MiB]\n";
+            return;
+        }
+        if (output.empty())
+            output = input + ".enc";
+
+        MappedFile source;
+        if (!source.open(input))
+        {
+            perror(input.c_str());
+            return;
+        }
+        std::string secret;
+        if (!ChunkedCipher::readSecret(keyFile, keyFile.empty(), secret))
+            return;
+        ChunkedCipher::Header header;
+        header.chunkSize = chunkMiB << 20;
+        unsigned char key[32];
+        if (RAND_bytes(header.salt, sizeof(header.salt)) != 1 || RAND_bytes(header.nonce, sizeof(header.nonce)) != 1)
+        {
+            std::cout << "encrypt: no randomness available\n";
+            return;
+        }
+        ChunkedCipher::encodeHeader(header);
+        if (!ChunkedCipher::deriveKey(secret, header, key))
+        {
+            std::cout << "encrypt: key derivation failed\n";
+            return;
+        }
+        OPENSSL_cleanse(&secret[0], secret.size());
+
+        int fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0)
+        {
+            perror(output.c_str());
+            return;
+        }
+        const unsigned char *plain = reinterpret_cast<const unsigned char *>(source.data());
+        uint64_t size = source.size();
+        uint64_t chunks = std::max<uint64_t>(1, (size + header.chunkSize - 1) / header.chunkSize);
+        uint64_t stride = header.chunkSize + ChunkedCipher::tagSize;
+        std::atomic<bool> ok(writeAll(fd, reinterpret_cast<const char *>(header.bytes), ChunkedCipher::headerSize));
+        // Chunks land at fixed offsets, so workers write them with pwrite
+        // in whatever order they finish.
+        ThreadPool pool;
+        for (uint64_t index = 0; index < chunks; ++index)
+        {
+            pool.submit([&, index] {
+                uint64_t begin = index * header.chunkSize;
+                size_t length = std::min<uint64_t>(header.chunkSize, size - begin);
+                std::vector<unsigned char> sealed(length + ChunkedCipher::tagSize + 16);
+                bool done = ChunkedCipher::process(true, key, header, index, index + 1 == chunks, plain + begin, length,
+                                                   sealed.data(), sealed.data() + length);
+                off_t at = ChunkedCipher::headerSize + index * stride;
+                size_t total = length + ChunkedCipher::tagSize;
+                for (size_t written = 0; done && written < total;)
+                {
+                    ssize_t n = pwrite(fd, sealed.data() + written, total - written, at + written);
+                    if (n <= 0)
+                        done = false;
+                    else
+                        written += n;
+                }
+                if (!done)
+                    ok = false;
+            });
+        }
+        pool.wait();
+        OPENSSL_cleanse(key, sizeof(key));
+        if (close(fd) != 0 || !ok)
+        {
+            std::cout << "encrypt: failed to write " << output << "\n";
+            unlink(output.c_str());
+        }
+    }
+    std::string helpText() override
+    {
+        return "Encrypts a file with chunked AES-256-GCM. Usage: encrypt [file] [-o output] [-k keyfile] [-c chunk_MiB]";
+    }
+};
+
+class DecryptCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        std::string input, output, keyFile;
+        uint64_t offset = 0, length = UINT64_MAX;
+        bool verifyOnly = false;
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if (args[i] == "-o" && i + 1 < args.size())
+                output = args[++i];
+            else if (args[i] == "-k" && i + 1 < args.size())
+                keyFile = args[++i];
+            else if (args[i] == "--offset" && i + 1 < args.size())
+                offset = strtoull(args[++i].c_str(), nullptr, 0);
+            else if (args[i] == "--length" && i + 1 < args.size())
+                length = strtoull(args[++i].c_str(), nullptr, 0);
+            else if (args[i] == "--verify")
+                verifyOnly = true;
+            else
+                input = args[i];
+        }
+        if (output.empty() && input.size() > 4 && input.compare(input.size() - 4, 4, ".enc") == 0)
+            output = input.substr(0, input.size() - 4);
+        if (input.empty() || (output.empty() && !verifyOnly))
+        {
+            std::cout << "Usage: decrypt [file.enc] [-o output|-] [-k keyfile] [--offset N] [--length N] [--verify]\n";
+            return;
+        }
+
+        MappedFile source;
+        if (!source.open(input))
+        {
+            perror(input.c_str());
+            return;
+        }
+        ChunkedCipher::Header header;
+        const unsigned char *data = reinterpret_cast<const unsigned char *>(source.data());
+        if (!ChunkedCipher::decodeHeader(data, source.size(), header))
+        {
+            std::cout << "decrypt: " << input << " is not an encrypted dsh file\n";
+            return;
+        }
+        uint64_t stride = header.chunkSize + ChunkedCipher::tagSize;
+        uint64_t body = source.size() - ChunkedCipher::headerSize;
+        uint64_t chunks = (body + stride - 1) / stride;
+        if (chunks == 0 || body - (chunks - 1) * stride < ChunkedCipher::tagSize)
+        {
+            std::cout << "decrypt: " << input << " is truncated\n";
+            return;
+        }
+        uint64_t plainSize = body - chunks * ChunkedCipher::tagSize;
+        if (offset >= plainSize && plainSize > 0)
+            return;
+        uint64_t end = std::min(plainSize, length > plainSize - offset ? plainSize : offset + length);
+        uint64_t firstChunk = verifyOnly ? 0 : offset / header.chunkSize;
+        uint64_t lastChunk = verifyOnly || end == 0 ? chunks - 1 : (end - 1) / header.chunkSize;
+
+        std::string secret;
+        unsigned char key[32];
+        if (!ChunkedCipher::readSecret(keyFile, false, secret))
+            return;
+        bool derived = ChunkedCipher::deriveKey(secret, header, key);
+        OPENSSL_cleanse(&secret[0], secret.size());
+        if (!derived)
+        {
+            std::cout << "decrypt: key derivation failed\n";
+            return;
+        }
+
+        int fd = -1;
+        if (!verifyOnly)
+        {
+            std::cout << std::flush;
+            fd = output == "-" ? STDOUT_FILENO : open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+            if (fd < 0)
+            {
+                perror(output.c_str());
+                OPENSSL_cleanse(key, sizeof(key));
+                return;
+            }
+        }
+
+        // Batches of chunks are opened in parallel and released in order, so
+        // output streams incrementally and nothing unauthenticated is written.
+        // A batch holds about 256MiB of plaintext at most (one chunk if the
+        // chunks are bigger), whatever the core count or chunk size.
+        ThreadPool pool;
+        const uint64_t inFlightLimit = 256ULL << 20;
+        size_t batch = std::max<uint64_t>(1, std::min<uint64_t>(pool.size() * 4, inFlightLimit / header.chunkSize));
+        bool ok = true;
+        uint64_t failedChunk = 0;
+        for (uint64_t start = firstChunk; ok && start <= lastChunk; start += batch)
+        {
+            uint64_t stop = std::min<uint64_t>(lastChunk + 1, start + batch);
+            std::vector<std::vector<unsigned char>> plain(stop - start);
+            std::vector<char> opened(stop - start, 0);
+            for (uint64_t index = start; index < stop; ++index)
+            {
+                pool.submit([&, index] {
+                    const unsigned char *chunk = data + ChunkedCipher::headerSize + index * stride;
+                    size_t sealed = std::min<uint64_t>(stride, body - index * stride);
+                    size_t size = sealed - ChunkedCipher::tagSize;
+                    std::vector<unsigned char> tag(chunk + size, chunk + sealed);
+                    std::vector<unsigned char> &out = plain[index - start];
+                    out.resize(size + 16);
+                    opened[index - start] = ChunkedCipher::process(false, key, header, index, index + 1 == chunks,
+                                                                   chunk, size, out.data(), tag.data());
+                    out.resize(size);
+                });
+            }
+            pool.wait();
+            for (uint64_t index = start; ok && index < stop; ++index)
+            {
+                if (!opened[index - start])
+                {
+                    ok = false;
+                    failedChunk = index;
+                    break;
+                }
+                if (verifyOnly)
+                    continue;
+                uint64_t chunkBegin = index * header.chunkSize;
+                uint64_t from = std::max(offset, chunkBegin) - chunkBegin;
+                uint64_t to = std::min<uint64_t>(end, chunkBegin + plain[index - start].size()) - chunkBegin;
+                if (from < to && !writeAll(fd, reinterpret_cast<const char *>(plain[index - start].data()) + from, to - from))
+                {
+                    perror("decrypt");
+                    ok = false;
+                    failedChunk = UINT64_MAX;
+                }
+            }
+        }
+        OPENSSL_cleanse(key, sizeof(key));
+        if (fd >= 0 && fd != STDOUT_FILENO)
+            close(fd);
+        if (!ok)
+        {
+            if (failedChunk != UINT64_MAX)
+                std::cout << "decrypt: authentication failed at chunk " << failedChunk << " (wrong key or corrupted file)\n";
+            if (fd >= 0 && fd != STDOUT_FILENO)
+                unlink(output.c_str());
+        }
+        else if (verifyOnly)
+        {
+            std::cout << input << ": OK (" << chunks << " chunks, " << plainSize << " bytes)\n";
+        }
+    }
+    std::string helpText() override
+    {
+        return "Decrypts and verifies files made by encrypt. Usage: decrypt [file.enc] [-o output|-] [-k keyfile] [--offset N] [--length N] [--verify]";
+    }
+};
+
+class DiffCommand : public Command
+{
+private:
+    typedef std::vector<std::string_view> Lines;
+
+    std::vector<int> a, b;
+    std::vector<char> deleted, inserted;
+    std::vector<int> forward, backward;
+    std::vector<uint32_t> slots;
+    std::vector<std::string_view> representatives;
+    std::vector<uint64_t> hashes;
+    // Bisections that have not met after this many diagonals give up on a
+    // minimal script and split the region where the searches got furthest.
+    static const int maxCost = 1024;
+
+    static Lines splitLines(const char *data, size_t size)
+    {
+        Lines lines;
+        const char *end = data + size;
+        while (data < end)
+        {
+            const char *nl = static_cast<const char *>(memchr(data, '\n', end - data));
+            const char *next = nl ? nl + 1 : end;
+            lines.emplace_back(data, next - data);
+            data = next;
+        }
+        return lines;
+    }
+
+    // Finds a point on an optimal edit path between a[aLo,aHi) and b[bLo,bHi)
+    // by running the forward and reverse Myers searches until they overlap.
+    bool bisect(int aLo, int aHi, int bLo, int bHi, int &splitA, int &splitB)
+    {
+        const int *x = a.data() + aLo;
+        const int *y = b.data() + bLo;
+        int n = aHi - aLo, m = bHi - bLo;
+        int maxD = (n + m + 1) / 2;
+        int offset = maxD;
+        int length = 2 * maxD + 2;
+        forward.assign(length, -1);
+        backward.assign(length, -1);
+        forward[offset + 1] = 0;
+        backward[offset + 1] = 0;
+        int delta = n - m;
+        bool front = delta % 2 != 0;
+        int k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+        for (int d = 0; d < maxD && d < maxCost; ++d)
+        {
+            for (int k1 = -d + k1start; k1 <= d - k1end; k1 += 2)
+            {
+                int k1Offset = offset + k1;
+                int x1 = (k1 == -d || (k1 != d && forward[k1Offset - 1] < forward[k1Offset + 1]))
+                             ? forward[k1Offset + 1]
+                             : forward[k1Offset - 1] + 1;
+                int y1 = x1 - k1;
+                while (x1 < n && y1 < m && x[x1] == y[y1])
+                    ++x1, ++y1;
+                forward[k1Offset] = x1;
+                if (x1 > n)
+                    k1end += 2;
+                else if (y1 > m)
+                    k1start += 2;
+                else if (front)
+                {
+                    int k2Offset = offset + delta - k1;
+                    if (k2Offset >= 0 && k2Offset < length && backward[k2Offset] != -1 && x1 >= n - backward[k2Offset])
+                    {
+                        splitA = aLo + x1;
+                        splitB = bLo + y1;
+                        return true;
+                    }
+                }
+            }
+            for (int k2 = -d + k2start; k2 <= d - k2end; k2 += 2)
+            {
+                int k2Offset = offset + k2;
+                int x2 = (k2 == -d || (k2 != d && backward[k2Offset - 1] < backward[k2Offset + 1]))
+                             ? backward[k2Offset + 1]
+                             : backward[k2Offset - 1] + 1;
+                int y2 = x2 - k2;
+                while (x2 < n && y2 < m && x[n - x2 - 1] == y[m - y2 - 1])
+                    ++x2, ++y2;
+                backward[k2Offset] = x2;
+                if (x2 > n)
+                    k2end += 2;
+                else if (y2 > m)
+                    k2start += 2;
+                else if (!front)
+                {
+                    int k1Offset = offset + delta - k2;
+                    if (k1Offset >= 0 && k1Offset < length && forward[k1Offset] != -1)
+                    {
+                        int x1 = forward[k1Offset];
+                        int y1 = offset + x1 - k1Offset;
+                        if (x1 >= n - x2)
+                        {
+                            splitA = aLo + x1;
+                            splitB = bLo + y1;
+                            return true;
+                        }
+                    }
+                }
+            }
+        }
+        // Too expensive: like GNU diff, take the diagonal that reached
+        // furthest in either direction as a heuristic split point.
+        int best = 0;
+        for (int i = 0; i < length; ++i)
+        {
+            int k = i - offset;
+            int x1 = forward[i], y1 = x1 - k;
+            if (x1 >= 0 && x1 <= n && y1 >= 0 && y1 <= m && x1 + y1 > best)
+            {
+                best = x1 + y1;
+                splitA = aLo + x1;
+                splitB = bLo + y1;
+            }
+            int x2 = backward[i], y2 = x2 - k;
+            if (x2 >= 0 && x2 <= n && y2 >= 0 && y2 <= m && x2 + y2 > best)
+            {
+                best = x2 + y2;
+                splitA = aHi - x2;
+                splitB = bHi - y2;
+            }
+        }
+        return best > 0 && best < n + m;
+    }
+
+    void compare(int aLo, int aHi, int bLo, int bHi)
+    {
+        while (aLo < aHi && bLo < bHi && a[aLo] == b[bLo])
+            ++aLo, ++bLo;
+        while (aLo < aHi && bLo < bHi && a[aHi - 1] == b[bHi - 1])
+            --aHi, --bHi;
+        int splitA, splitB;
+        if (aLo == aHi || bLo == bHi || !bisect(aLo, aHi, bLo, bHi, splitA, splitB))
+        {
+            std::fill(deleted.begin() + aLo, deleted.begin() + aHi, 1);
+            std::fill(inserted.begin() + bLo, inserted.begin() + bHi, 1);
+            return;
+        }
+        compare(aLo, splitA, bLo, splitB);
+        compare(splitA, aHi, splitB, bHi);
+    }
+
+    static uint64_t hashLine(std::string_view line)
+    {
+        uint64_t hash = 0x9e3779b97f4a7c15ULL ^ line.size();
+        size_t i = 0;
+        for (; i + 8 <= line.size(); i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, line.data() + i, 8);
+            hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+            hash ^= hash >> 32;
+        }
+        for (; i < line.size(); ++i)
+            hash = (hash ^ (unsigned char)line[i]) * 0x100000001b3ULL;
+        return hash ^ (hash >> 29);
+    }
+
+    // Maps each distinct line to a small integer once, so the edit search
+    // compares ints. ID 0 is reserved for the trimmed common prefix/suffix.
+    // Passing a non-zero `expected` starts a fresh table for a new pair.
+    void intern(const Lines &lines, size_t from, size_t to, std::vector<int> &ids, size_t expected)
+    {
+        if (expected)
+        {
+            size_t capacity = 16;
+            while (capacity < expected * 2)
+                capacity <<= 1;
+            slots.assign(capacity, 0);
+            representatives.assign(1, std::string_view());
+            hashes.assign(1, 0);
+        }
+        size_t mask = slots.size() - 1;
+        for (size_t i = from; i < to; ++i)
+        {
+            uint64_t hash = hashLine(lines[i]);
+            size_t slot = hash & mask;
+            while (slots[slot] && (hashes[slots[slot]] != hash || representatives[slots[slot]] != lines[i]))
+                slot = (slot + 1) & mask;
+            if (!slots[slot])
+            {
+                slots[slot] = representatives.size();
+                representatives.push_back(lines[i]);
+                hashes.push_back(hash);
+            }
+            ids[i] = slots[slot];
+        }
+    }
+
+    static std::string fileStamp(const std::string &path)
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            return "";
+        char buffer[64], zone[8];
+        struct tm tm;
+        localtime_r(&st.st_mtime, &tm);
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
+        strftime(zone, sizeof(zone), "%z", &tm);
+        char stamp[96];
+        snprintf(stamp, sizeof(stamp), "\t%s.%09ld %s", buffer, (long)st.st_mtim.tv_nsec, zone);
+        return stamp;
+    }
+
+    static std::string hunkRange(int start, int count)
+    {
+        if (count == 1)
+            return std::to_string(start + 1);
+        return std::to_string(count == 0 ? start : start + 1) + "," + std::to_string(count);
+    }
+
+    static void emitLine(std::string &out, char marker, std::string_view line)
+    {
+        out += marker;
+        out.append(line.data(), line.size());
+        if (line.empty() || line.back() != '\n')
+            out += "\n\\ No newline at end of file\n";
+    }
+
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        int context = 3;
+        bool brief = false;
+        std::vector<std::string> files;
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if (args[i] == "-U" && i + 1 < args.size())
+                context = std::max(0, atoi(args[++i].c_str()));
+            else if (args[i] == "-q")
+                brief = true;
+            else if (args[i] == "-u")
+                continue;
+            else
+                files.push_back(args[i]);
+        }
+        if (files.size() != 2)
+        {
+            std::cout << "Usage: diff [-q] [-U lines] [file1] [file2]\n";
+            return;
+        }
+        // Only regular files can be mapped; anything else would read as empty.
+        for (auto &file : files)
+        {
+            struct stat st;
+            if (stat(file.c_str(), &st) != 0)
+            {
+                perror(("diff: " + file).c_str());
+                return;
+            }
+            if (!S_ISREG(st.st_mode))
+            {
+                std::cout << "diff: " << file << ": not a regular file\n";
+                return;
+            }
+        }
+        MappedFile first, second;
+        if (!first.open(files[0]) || !second.open(files[1]))
+        {
+            perror("diff");
+            return;
+        }
+        if (first.size() == second.size() &&
+            (first.size() == 0 || memcmp(first.data(), second.data(), first.size()) == 0))
+            return;
+        bool binary = memchr(first.data(), '\0', std::min<size_t>(first.size(), 8192)) ||
+                      memchr(second.data(), '\0', std::min<size_t>(second.size(), 8192));
+        if (brief || binary)
+        {
+            std::cout << (binary ? "Binary files " : "Files ") << files[0] << " and " << files[1] << " differ\n";
+            return;
+        }
+
+        Lines left = splitLines(first.data(), first.size());
+        Lines right = splitLines(second.data(), second.size());
+        size_t prefix = 0, suffix = 0;
+        while (prefix < left.size() && prefix < right.size() && left[prefix] == right[prefix])
+            ++prefix;
+        while (suffix < left.size() - prefix && suffix < right.size() - prefix &&
+               left[left.size() - 1 - suffix] == right[right.size() - 1 - suffix])
+            ++suffix;
+        a.assign(left.size(), 0);
+        b.assign(right.size(), 0);
+        intern(left, prefix, left.size() - suffix, a, (right.size() - prefix - suffix) + (left.size() - prefix - suffix));
+        intern(right, prefix, right.size() - suffix, b, 0);
+        deleted.assign(a.size(), 0);
+        inserted.assign(b.size(), 0);
+        compare(0, a.size(), 0, b.size());
+
+        struct Change
+        {
+            int aStart, aEnd, bStart, bEnd;
+        };
+        std::vector<Change> changes;
+        int n = a.size(), m = b.size();
+        for (int i = 0, j = 0; i < n || j < m;)
+        {
+            if (i < n && j < m && !deleted[i] && !inserted[j])
+            {
+                ++i, ++j;
+                continue;
+            }
+            Change change{i, i, j, j};
+            while (i < n && deleted[i])
+                ++i;
+            while (j < m && inserted[j])
+                ++j;
+            change.aEnd = i;
+            change.bEnd = j;
+            changes.push_back(change);
+        }
+
+        std::string out = "--- " + files[0] + fileStamp(files[0]) + "\n+++ " + files[1] + fileStamp(files[1]) + "\n";
+        for (size_t first = 0; first < changes.size();)
+        {
+            size_t last = first;
+            while (last + 1 < changes.size() && changes[last + 1].aStart - changes[last].aEnd <= 2 * context)
+                ++last;
+            int aFrom = std::max(0, changes[first].aStart - context);
+            int bFrom = changes[first].bStart - (changes[first].aStart - aFrom);
+            int aTo = std::min(n, changes[last].aEnd + context);
+            int bTo = changes[last].bEnd + (aTo - changes[last].aEnd);
+            out += "@@ -" + hunkRange(aFrom, aTo - aFrom) + " +" + hunkRange(bFrom, bTo - bFrom) + " @@\n";
+            int i = aFrom;
+            for (size_t c = first; c <= last; ++c)
+            {
+                for (; i < changes[c].aStart; ++i)
+                    emitLine(out, ' ', left[i]);
+                for (; i < changes[c].aEnd; ++i)
+                    emitLine(out, '-', left[i]);
+                for (int j = changes[c].bStart; j < changes[c].bEnd; ++j)
+                    emitLine(out, '+', right[j]);
+            }
+            for (; i < aTo; ++i)
+                emitLine(out, ' ', left[i]);
+            if (out.size() >= (1 << 20))
+            {
+                OutputSink::shared().write(out.data(), out.size());
+                out.clear();
+            }
+            first = last + 1;
+        }
+        OutputSink::shared().write(out.data(), out.size());
+    }
+    std::string helpText() override
+    {
+        return "Compares files line by line (unified output). Usage: diff [-q] [-U lines] [file1] [file2]";
+    }
+};
+
+class IfstatCommand : public Command
+{
+private:
+    static volatile sig_atomic_t interrupted;
+
+    static void onInterrupt(int)
+    {
+        interrupted = 1;
+    }
+
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        double interval = 1.0;
+        long count = -1;
+        bool packets = false;
+        std::vector<std::string> selected;
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if (args[i] == "-i" && i + 1 < args.size())
+            {
+                std::stringstream names(args[++i]);
+                std::string name;
+                while (std::getline(names, name, ','))
+                    selected.push_back(name);
+            }
+            else if (args[i] == "-n" && i + 1 < args.size())
+                count = atol(args[++i].c_str());
+            else if (args[i] == "-p")
+                packets = true;
+            else if (args[i][0] != '-' && atof(args[i].c_str()) > 0)
+                interval = atof(args[i].c_str());
+            else
+            {
+                std::cout << "Usage: ifstat [-i if1,if2] [-n count] [-p] [interval]\n";
+                return;
+            }
+        }
+
+        NetDevCounters devices;
+        std::map<std::string, NetDevCounters::Counters> previous, current;
+        if (!devices.sample(previous))
+        {
+            perror("ifstat: /proc/net/dev");
+            return;
+        }
+        std::vector<InterfaceInfo> interfaces;
+        if (selected.empty() && queryInterfaces(interfaces))
+        {
+            for (auto &entry : interfaces)
+            {
+                if ((entry.flags & IFF_UP) && !(entry.flags & IFF_LOOPBACK))
+                    selected.push_back(entry.name);
+            }
+        }
+        for (auto &name : selected)
+        {
+            if (!previous.count(name))
+            {
+                std::cout << "ifstat: no such interface: " << name << "\n";
+                return;
+            }
+        }
+
+        const int width = 10;
+        int span = width * (packets ? 4 : 2);
+        std::string header, units;
+        char cell[64];
+        for (auto &name : selected)
+        {
+            int pad = std::max(0, (span - (int)name.size()) / 2);
+            header += std::string(pad, ' ') + name + std::string(std::max(0, span - pad - (int)name.size()), ' ') + "  ";
+            snprintf(cell, sizeof(cell), "%*s%*s", width, "KB/s in", width, "KB/s out");
+            units += cell;
+            if (packets)
+            {
+                snprintf(cell, sizeof(cell), "%*s%*s", width, "pkt/s in", width, "pkt/s out");
+                units += cell;
+            }
+            units += "  ";
+        }
+        std::cout << header << "\n" << units << "\n" << std::flush;
+
+        struct sigaction action = {}, saved;
+        action.sa_handler = onInterrupt;
+        sigemptyset(&action.sa_mask);
+        interrupted = 0;
+        sigaction(SIGINT, &action, &saved);
+
+        struct timespec last, now;
+        clock_gettime(CLOCK_MONOTONIC, &last);
+        for (long iteration = 0; (count < 0 || iteration < count) && !interrupted; ++iteration)
+        {
+            struct timespec delay = {(time_t)interval, (long)((interval - (time_t)interval) * 1e9)};
+            if (nanosleep(&delay, nullptr) != 0 || !devices.sample(current))
+                break;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            double elapsed = (now.tv_sec - last.tv_sec) + (now.tv_nsec - last.tv_nsec) / 1e9;
+            last = now;
+            std::string line;
+            for (auto &name : selected)
+            {
+                const NetDevCounters::Counters &a = previous[name], &b = current[name];
+                snprintf(cell, sizeof(cell), "%*.2f%*.2f", width, (b.rxBytes - a.rxBytes) / 1024.0 / elapsed, width,
+                         (b.txBytes - a.txBytes) / 1024.0 / elapsed);
+                line += cell;
+                if (packets)
+                {
+                    snprintf(cell, sizeof(cell), "%*.1f%*.1f", width, (b.rxPackets - a.rxPackets) / elapsed, width,
+                             (b.txPackets - a.txPackets) / elapsed);
+                    line += cell;
+                }
+                line += "  ";
+            }
+            std::cout << line << "\n" << std::flush;
+            previous.swap(current);
+        }
+        sigaction(SIGINT, &saved, nullptr);
+    }
+    std::string helpText() override
+    {
+        return "Displays per-interface bandwidth from /proc/net/dev (Ctrl-C stops). Usage: ifstat [-i if1,if2] [-n count] [-p] [interval]";
+    }
+};
+
+volatile sig_atomic_t IfstatCommand::interrupted = 0;
+
+class HtopCommand : public TopCommand
+{
+public:
+    std::string helpText() override
+    {
+        return "Provides detailed system performance information (built-in live top). Usage: htop [-d seconds] [-c]";
+    }
+};
+
+class VimCommand : public Command
+{
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: vim [file]\n";
+            return;
+        }
+        std::string command = "vim " + shellQuote(args[1]);
+        system(command.c_str());
+    }
+    std::string helpText() override
+    {
+        return "Opens a file in Vim editor. Usage: vim [file]";
+    }
+};
+
+// Native stream editor for the common subset of sed: s/re/replacement/flags
+// (g, p, i, N), d, p, q and =, addressed by line numbers, $ and /re/, with
+// ranges and !. Input is mmapped and scanned in place; when the script is
+// only unaddressed substitutions, runs of lines with no match are found
+// with one search over the rest of the file and copied through untouched.
+// -i rewrites files through a temp file and rename, several files in
+// parallel, and leaves files the script does not change alone.
+class SedCommand : public Command
+{
+private:
+    struct Address
+    {
+        enum
+        {
+            None,
+            Line,
+            Last,
+            Pattern
+        } kind = None;
+        uint64_t line = 0;
+        std::string pattern;
+    };
+
+    struct Instruction
+    {
+        Address from, to;
+        bool negate = false;
+        char command = 0;
+        std::string pattern, replacement;
+        bool global = false, print = false, ignoreCase = false;
+        uint64_t occurrence = 0;
+    };
+
+    struct Script
+    {
+        std::vector<Instruction> instructions;
+        bool extended = false;
+        bool quiet = false;
+
+        // True when every line can be handled without knowing where it is,
+        // so a file can be cut into chunks and edited in parallel.
+        bool stateless() const
+        {
+            for (auto &ins : instructions)
+            {
+                if (ins.from.kind == Address::Line || ins.from.kind == Address::Last || ins.to.kind != Address::None ||
+                    ins.command == 'q' || ins.command == '=')
+                    return false;
+            }
+            return true;
+        }
+
+        // True when lines no substitution matches come out unchanged.
+        bool substitutionsOnly() const
+        {
+            for (auto &ins : instructions)
+            {
+                if (ins.command != 's' || ins.from.kind != Address::None)
+                    return false;
+            }
+            return !quiet;
+        }
+    };
+
+    // A Script compiled for one thread, with its range state.
+    class Program
+    {
+    private:
+        const Script &script;
+        std::vector<std::unique_ptr<TextMatcher>> matchers, fromMatchers, toMatchers;
+        std::vector<bool> inRange;
+        std::vector<regmatch_t> groups = std::vector<regmatch_t>(10);
+        std::string space, scratch;
+        // Where each substitution's next match starts in the current chunk
+        // (past the end for none, SIZE_MAX for not searched yet).
+        std::vector<size_t> nextMatch;
+
+        bool matchesAddress(const Address &address, TextMatcher *matcher, const char *text, size_t length,
+                            uint64_t line, bool last)
+        {
+            if (address.kind == Address::Line)
+                return line == address.line;
+            if (address.kind == Address::Last)
+                return last;
+            return matcher->find(text, length, 0, groups.data(), 1);
+        }
+
+        bool selected(size_t index, const char *text, size_t length, uint64_t line, bool last)
+        {
+            const Instruction &ins = script.instructions[index];
+            bool hit;
+            if (ins.from.kind == Address::None)
+                hit = true;
+            else if (ins.to.kind == Address::None)
+                hit = matchesAddress(ins.from, fromMatchers[index].get(), text, length, line, last);
+            else if (inRange[index])
+            {
+                hit = true;
+                if (ins.to.kind == Address::Line ? line >= ins.to.line
+                                                 : matchesAddress(ins.to, toMatchers[index].get(), text, length, line, last))
+                    inRange[index] = false;
+            }
+            else
+            {
+                hit = matchesAddress(ins.from, fromMatchers[index].get(), text, length, line, last);
+                // A range whose end line is already behind covers one line.
+                if (hit)
+                    inRange[index] = !(ins.to.kind == Address::Line && ins.to.line <= line);
+            }
+            return hit != ins.negate;
+        }
+
+        bool substitute(size_t index, const char *text, size_t length, std::string &result)
+        {
+            const Instruction &ins = script.instructions[index];
+            TextMatcher &matcher = *matchers[index];
+            size_t count = std::min(groups.size(), matcher.groups());
+            size_t from = 0, copied = 0, lastEnd = SIZE_MAX;
+            uint64_t seen = 0;
+            bool replaced = false;
+            result.clear();
+            while (from <= length && matcher.find(text, length, from, groups.data(), count))
+            {
+                size_t start = groups[0].rm_so, end = groups[0].rm_eo;
+                from = end > start ? end : end + 1;
+                // An empty match right where the previous match ended is not
+                // a new occurrence (s/b*/-/g turns abc into -a-c-).
+                bool adjacent = start == end && start == lastEnd;
+                lastEnd = end;
+                if (adjacent || ++seen < std::max<uint64_t>(ins.occurrence, 1))
+                    continue;
+                result.append(text + copied, start - copied);
+                for (size_t i = 0; i < ins.replacement.size(); ++i)
+                {
+                    char c = ins.replacement[i];
+                    if (c == '&')
+                        result.append(text + start, end - start);
+                    else if (c == '\\' && i + 1 < ins.replacement.size())
+                    {
+                        char next = ins.replacement[++i];
+                        size_t group = next - '0';
+                        if (next >= '1' && next <= '9')
+                        {
+                            if (group < count && groups[group].rm_so >= 0)
+                                result.append(text + groups[group].rm_so, groups[group].rm_eo - groups[group].rm_so);
+                        }
+                        else
+                            result += next == 'n' ? '\n' : next == 't' ? '\t' : next;
+                    }
+                    else
+                        result += c;
+                }
+                copied = end;
+                replaced = true;
+                if (!ins.global)
+                    break;
+            }
+            if (replaced)
+                result.append(text + copied, length - copied);
+            return replaced;
+        }
+
+    public:
+        bool quit = false;
+
+        explicit Program(const Script &compiled) : script(compiled), inRange(compiled.instructions.size())
+        {
+            for (auto &ins : script.instructions)
+            {
+                auto make = [&](const std::string &pattern, bool ignoreCase) {
+                    std::unique_ptr<TextMatcher> matcher(new TextMatcher());
+                    matcher->compile(pattern, script.extended, ignoreCase);
+                    return matcher;
+                };
+                matchers.push_back(ins.command == 's' ? make(ins.pattern, ins.ignoreCase) : nullptr);
+                fromMatchers.push_back(ins.from.kind == Address::Pattern ? make(ins.from.pattern, false) : nullptr);
+                toMatchers.push_back(ins.to.kind == Address::Pattern ? make(ins.to.pattern, false) : nullptr);
+            }
+        }
+
+        // Offset of the first line at or after `pos` that some substitution
+        // could change (`size` if none); only valid for substitutionsOnly().
+        size_t nextCandidate(const char *data, size_t size, size_t pos)
+        {
+            // A matcher is only searched again once pos has passed its last
+            // match, so a rarely matching expression costs one scan per chunk.
+            size_t best = size + 1;
+            for (size_t i = 0; i < matchers.size(); ++i)
+            {
+                if (nextMatch[i] == SIZE_MAX || nextMatch[i] < pos)
+                    nextMatch[i] = matchers[i]->find(data, size, pos, groups.data(), 1) ? groups[0].rm_so : size + 1;
+                best = std::min(best, nextMatch[i]);
+            }
+            if (best > size)
+                return size;
+            const char *lineStart = (const char *)memrchr(data + pos, '\n', best - pos);
+            return lineStart ? lineStart - data + 1 : pos;
+        }
+
+        // Runs the script over one line (without its newline) and appends
+        // what it prints to `out`.
+        void run(const char *text, size_t length, bool newline, uint64_t line, bool last, std::string &out)
+        {
+            bool deleted = false;
+            for (size_t i = 0; i < script.instructions.size() && !deleted && !quit; ++i)
+            {
+                if (!selected(i, text, length, line, last))
+                    continue;
+                const Instruction &ins = script.instructions[i];
+                switch (ins.command)
+                {
+                case 'd':
+                    deleted = true;
+                    break;
+                case 'p':
+                    out.append(text, length).append("\n");
+                    break;
+                case '=':
+                    out.append(std::to_string(line)).append("\n");
+                    break;
+                case 'q':
+                    quit = true;
+                    break;
+                case 's':
+                    if (substitute(i, text, length, scratch))
+                    {
+                        space.swap(scratch);
+                        text = space.data();
+                        length = space.size();
+                        if (ins.print)
+                            out.append(text, length).append("\n");
+                    }
+                    break;
+                }
+            }
+            if (!deleted && !script.quiet)
+            {
+                out.append(text, length);
+                if (newline)
+                    out += '\n';
+            }
+        }
+
+        // Edits data[begin, end), which starts at a line boundary. Stops
+        // early after q.
+        void runLines(const char *data, size_t begin, size_t end, size_t size, uint64_t &line, std::string &out,
+                      bool lastFile)
+        {
+            bool skipping = script.substitutionsOnly();
+            nextMatch.assign(matchers.size(), SIZE_MAX);
+            size_t pos = begin;
+            while (pos < end && !quit)
+            {
+                if (skipping)
+                {
+                    size_t next = std::min(nextCandidate(data, end, pos), end);
+                    out.append(data + pos, next - pos);
+                    pos = next;
+                    if (pos >= end)
+                        break;
+                }
+                const char *newline = (const char *)memchr(data + pos, '\n', end - pos);
+                size_t lineEnd = newline ? newline - data : end;
+                ++line;
+                run(data + pos, lineEnd - pos, newline != nullptr, line, lastFile && lineEnd + 1 >= size, out);
+                pos = lineEnd + 1;
+            }
+        }
+    };
+
+    static size_t readDelimited(const std::string &text, size_t pos, char delimiter, std::string &value)
+    {
+        value.clear();
+        for (; pos < text.size() && text[pos] != delimiter; ++pos)
+        {
+            if (text[pos] == '\\' && pos + 1 < text.size())
+            {
+                if (text[pos + 1] == delimiter)
+                {
+                    value += delimiter;
+                    ++pos;
+                    continue;
+                }
+                if (text[pos + 1] == 'n')
+                {
+                    value += '\n';
+                    ++pos;
+                    continue;
+                }
+                value += text[pos++];
+            }
+            value += text[pos];
+        }
+        return pos;
+    }
+
+    static bool parseAddress(const std::string &text, size_t &pos, Address &address, std::string &error)
+    {
+        if (pos < text.size() && isdigit((unsigned char)text[pos]))
+        {
+            address.kind = Address::Line;
+            while (pos < text.size() && isdigit((unsigned char)text[pos]))
+                address.line = address.line * 10 + (text[pos++] - '0');
+        }
+        else if (pos < text.size() && text[pos] == '$')
+        {
+            address.kind = Address::Last;
+            ++pos;
+        }
+        else if (pos < text.size() && text[pos] == '/')
+        {
+            address.kind = Address::Pattern;
+            pos = readDelimited(text, pos + 1, '/', address.pattern);
+            if (pos >= text.size())
+            {
+                error = "unterminated address regex";
+                return false;
+            }
+            ++pos;
+        }
+        return true;
+    }
+
+    static std::string parse(const std::string &text, Script &script)
+    {
+        std::string error;
+        size_t pos = 0;
+        while (pos < text.size())
+        {
+            while (pos < text.size() && (isspace((unsigned char)text[pos]) || text[pos] == ';'))
+                ++pos;
+            if (pos >= text.size())
+                break;
+            Instruction ins;
+            if (!parseAddress(text, pos, ins.from, error))
+                return error;
+            if (ins.from.kind != Address::None && pos < text.size() && text[pos] == ',')
+            {
+                ++pos;
+                if (!parseAddress(text, pos, ins.to, error))
+                    return error;
+                if (ins.to.kind == Address::None)
+                    return "unexpected ','";
+            }
+            while (pos < text.size() && isspace((unsigned char)text[pos]))
+                ++pos;
+            if (pos < text.size() && text[pos] == '!')
+            {
+                ins.negate = true;
+                ++pos;
+            }
+            if (pos >= text.size())
+                return "missing command";
+            ins.command = text[pos++];
+            if (ins.command == 's')
+            {
+                if (pos >= text.size())
+                    return "unterminated `s' command";
+                char delimiter = text[pos];
+                pos = readDelimited(text, pos + 1, delimiter, ins.pattern);
+                if (pos >= text.size())
+                    return "unterminated `s' command";
+                // The replacement keeps its escapes for & and \1..\9.
+                size_t end = pos + 1;
+                for (; end < text.size() && text[end] != delimiter; ++end)
+                {
+                    if (text[end] == '\\' && end + 1 < text.size())
+                    {
+                        if (text[end + 1] != delimiter)
+                            ins.replacement += '\\';
+                        ins.replacement += text[++end];
+                        continue;
+                    }
+                    ins.replacement += text[end];
+                }
+                if (end >= text.size())
+                    return "unterminated `s' command";
+                for (pos = end + 1; pos < text.size() && text[pos] != ';' && text[pos] != '\n' && text[pos] != '}'; ++pos)
+                {
+                    char flag = text[pos];
+                    if (flag == 'g')
+                        ins.global = true;
+                    else if (flag == 'p')
+                        ins.print = true;
+                    else if (flag == 'i' || flag == 'I')
+                        ins.ignoreCase = true;
+                    else if (isdigit((unsigned char)flag))
+                        ins.occurrence = ins.occurrence * 10 + (flag - '0');
+                    else if (!isspace((unsigned char)flag))
+                        return std::string("unknown option to `s': ") + flag;
+                }
+                TextMatcher check;
+                std::string problem = check.compile(ins.pattern, script.extended, ins.ignoreCase);
+                if (!problem.empty())
+                    return problem;
+            }
+            else if (!strchr("dpq=", ins.command))
+                return std::string("unknown command: `") + ins.command + "'";
+            for (const Address *address : {&ins.from, &ins.to})
+            {
+                TextMatcher check;
+                std::string problem = address->kind == Address::Pattern ? check.compile(address->pattern, script.extended, false) : "";
+                if (!problem.empty())
+                    return problem;
+            }
+            script.instructions.push_back(ins);
+        }
+        return "";
+    }
+
+    // Edits a whole mapped input into consecutive output `parts`. Large
+    // inputs of stateless scripts are split at line boundaries and edited
+    // on the pool, one part per chunk.
+    static void editBuffer(const Script &script, const char *data, size_t size, uint64_t &line, Program &program,
+                           bool lastFile, std::vector<std::string> &parts)
+    {
+        const size_t chunkSize = 8 << 20;
+        if (size < 2 * chunkSize || !script.stateless())
+        {
+            parts.resize(1);
+            program.runLines(data, 0, size, size, line, parts[0], lastFile);
+            return;
+        }
+        std::vector<size_t> bounds = {0};
+        while (bounds.back() < size)
+        {
+            size_t next = std::min(size, bounds.back() + chunkSize);
+            const char *newline = next < size ? (const char *)memchr(data + next, '\n', size - next) : nullptr;
+            bounds.push_back(newline ? newline - data + 1 : size);
+        }
+        parts.resize(bounds.size() - 1);
+        ThreadPool pool;
+        for (size_t c = 0; c + 1 < bounds.size(); ++c)
+        {
+            pool.submit([&, c] {
+                Program local(script);
+                uint64_t ignored = 0;
+                local.runLines(data, bounds[c], bounds[c + 1], size, ignored, parts[c], lastFile);
+            });
+        }
+        pool.wait();
+    }
+
+    // Rewrites one file in place; returns "" or an error message.
+    static std::string editInPlace(const Script &script, const std::string &path, const std::string &suffix)
+    {
+        MappedFile file;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !file.open(path))
+            return path + ": " + strerror(errno);
+        std::vector<std::string> parts;
+        uint64_t line = 0;
+        Program program(script);
+        editBuffer(script, file.data(), file.size(), line, program, true, parts);
+        size_t offset = 0;
+        bool unchanged = true;
+        for (auto &part : parts)
+        {
+            unchanged = unchanged && offset + part.size() <= file.size() &&
+                        memcmp(part.data(), file.data() + offset, part.size()) == 0;
+            offset += part.size();
+        }
+        if (unchanged && offset == file.size())
+            return "";
+        std::string temp = path + ".dsh-sed.XXXXXX";
+        int fd = mkostemp(&temp[0], O_CLOEXEC);
+        if (fd < 0)
+            return path + ": " + strerror(errno);
+        bool ok = fchmod(fd, st.st_mode & 07777) == 0;
+        for (auto &part : parts)
+            ok = ok && writeAll(fd, part.data(), part.size());
+        if (fchown(fd, st.st_uid, st.st_gid) != 0 && getuid() == 0)
+            ok = false;
+        ok = close(fd) == 0 && ok;
+        if (ok && !suffix.empty())
+            ok = link(path.c_str(), (path + suffix).c_str()) == 0 || (errno == EEXIST && rename(path.c_str(), (path + suffix).c_str()) == 0);
+        if (!ok || rename(temp.c_str(), path.c_str()) != 0)
+        {
+            std::string error = path + ": " + strerror(errno);
+            unlink(temp.c_str());
+            return error;
+        }
+        return "";
+    }
+
+public:
+    void execute(const std::vector<std::string> &args) override
+    {
+        Script script;
+        std::string scriptText, suffix;
+        std::vector<std::string> files;
+        bool inPlace = false, haveScript = false;
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            const std::string &arg = args[i];
+            if (arg == "-n")
+                script.quiet = true;
+            else if (arg == "-E" || arg == "-r")
+                script.extended = true;
+            else if (arg.compare(0, 2, "-i") == 0)
+            {
+                inPlace = true;
+                suffix = arg.substr(2);
+            }
+            else if (arg == "-e" && i + 1 < args.size())
+            {
+                scriptText += (haveScript ? "\n" : "") + args[++i];
+                haveScript = true;
+            }
+            else if (!haveScript)
+            {
+                scriptText = arg;
+                haveScript = true;
+            }
+            else
+                files.push_back(arg);
+        }
+        if (!haveScript || (inPlace && files.empty()))
+        {
+            std::cout << "Usage: sed [-n] [-E] [-i[suffix]] [-e script] [script] [file...]\n";
+            return;
+        }
+        std::string error = parse(scriptText, script);
+        if (!error.empty())
+        {
+            std::cout << "sed: -e expression: " << error << "\n";
+            return;
+        }
+
+        if (inPlace)
+        {
+            std::vector<std::string> errors(files.size());
+            ThreadPool pool;
+            for (size_t f = 0; f < files.size(); ++f)
+                pool.submit([&, f] { errors[f] = editInPlace(script, files[f], suffix); });
+            pool.wait();
+            for (auto &message : errors)
+            {
+                if (!message.empty())
+                    std::cerr << "sed: " << message << "\n";
+            }
+            return;
+        }
+
+        if (files.empty())
+            files.push_back("/dev/stdin");
+        Program program(script);
+        uint64_t line = 0;
+        for (size_t f = 0; f < files.size() && !program.quit; ++f)
+        {
+            TraceSpan span("sed", files[f]);
+            MappedFile file;
+            if (!file.open(files[f]))
+            {
+                std::cerr << "sed: can't read " << files[f] << ": " << strerror(errno) << "\n";
+                continue;
+            }
+            std::vector<std::string> parts;
+            editBuffer(script, file.data(), file.size(), line, program, f + 1 == files.size(), parts);
+            for (auto &part : parts)
+                std::cout << part;
+        }
+    }
+    std::string helpText() override
+    {
+        return "Edits text streams: s/regex/replacement/[gpiN], d, p, q and = with line, $ and /regex/ "
+               "addresses and ranges. Usage: sed [-n] [-E] [-i[suffix]] [-e script] [script] [file...]";
+    }
+};
+
+struct TarHeader
+{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+static_assert(sizeof(TarHeader) == 512, "tar headers are one 512-byte block");
+
+class TarCommand : public Command
+{
+private:
+    struct Entry
+    {
+        std::string name;
+        std::string linkname;
+        char type = '0';
+        uint64_t size = 0;
+        mode_t mode = 0644;
+        uid_t uid = 0;
+        gid_t gid = 0;
+        time_t mtime = 0;
+    };
+
+    // Archive input: regular uncompressed archives are read with pread so
+    // entry payloads can be handed to extraction workers by offset; anything
+    // else (gzip, stdin) goes through zlib, which also reads plain data.
+    struct Source
+    {
+        int fd = -1;
+        gzFile gz = nullptr;
+        off_t offset = 0;
+
+        bool read(char *buffer, size_t len)
+        {
+            while (len > 0)
+            {
+                ssize_t n = gz ? gzread(gz, buffer, len) : pread(fd, buffer, len, offset);
+                if (n < 0 && !gz && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+                buffer += n;
+                len -= n;
+                offset += n;
+            }
+            return true;
+        }
+        bool skip(uint64_t len)
+        {
+            if (!gz)
+            {
+                offset += len;
+                return true;
+            }
+            char buffer[1 << 14];
+            while (len > 0)
+            {
+                size_t n = std::min<uint64_t>(len, sizeof(buffer));
+                if (!read(buffer, n))
+                    return false;
+                len -= n;
+            }
+            return true;
+        }
+    };
+
+    // Archive output: raw archives get file payloads spliced in by the kernel,
+    // compressed archives stream through the parallel gzip writer.
+    struct Sink
+    {
+        int fd = -1;
+        ParallelGzipWriter *gz = nullptr;
+        bool ok = true;
+
+        void emit(const char *data, size_t len)
+        {
+            if (gz)
+                gz->write(data, len);
+            else if (!writeAll(fd, data, len))
+                ok = false;
+        }
+        void emitFile(int in, uint64_t size)
+        {
+            if (!gz)
+            {
+                ok = copyFileData(in, fd, size) && ok;
+                return;
+            }
+            std::vector<char> buffer(1 << 16);
+            while (size > 0)
+            {
+                ssize_t n = ::read(in, buffer.data(), std::min<uint64_t>(size, buffer.size()));
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                {
+                    std::fill(buffer.begin(), buffer.end(), 0);
+                    n = std::min<uint64_t>(size, buffer.size());
+                }
+                gz->write(buffer.data(), n);
+                size -= n;
+            }
+        }
+        void pad(uint64_t size)
+        {
+            static const char zeros[512] = {};
+            if (size % 512)
+                emit(zeros, 512 - size % 512);
+        }
+    };
+
+    std::map<uid_t, std::string> userNames;
+    std::map<gid_t, std::string> groupNames;
+
+    static void putNumber(char *field, size_t width, uint64_t value)
+    {
+        if (value < (1ULL << (3 * (width - 1))))
+        {
+            snprintf(field, width, "%0*llo", (int)width - 1, (unsigned long long)value);
+            return;
+        }
+        // GNU base-256 encoding for values that do not fit in octal.
+        memset(field, 0, width);
+        for (size_t i = width - 1; i > 0 && value; --i, value >>= 8)
+            field[i] = value & 0xff;
+        field[0] = (char)0x80;
+    }
+
+    static uint64_t getNumber(const char *field, size_t width)
+    {
+        uint64_t value = 0;
+        if (field[0] & 0x80)
+        {
+            for (size_t i = 1; i < width; ++i)
+                value = (value << 8) | (unsigned char)field[i];
+            return value;
+        }
+        size_t i = 0;
+        while (i < width && (field[i] == ' ' || field[i] == '\0'))
+            ++i;
+        for (; i < width && field[i] >= '0' && field[i] <= '7'; ++i)
+            value = value * 8 + (field[i] - '0');
+        return value;
+    }
+
+    static std::string getString(const char *field, size_t width)
+    {
+        return std::string(field, strnlen(field, width));
+    }
+
+    static unsigned headerChecksum(const TarHeader &header)
+    {
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&header);
+        unsigned sum = 0;
+        for (size_t i = 0; i < sizeof(TarHeader); ++i)
+        {
+            bool inChecksum = i >= offsetof(TarHeader, chksum) && i < offsetof(TarHeader, chksum) + sizeof(header.chksum);
+            sum += inChecksum ? ' ' : bytes[i];
+        }
+        return sum;
+    }
+
+    const std::string &userName(uid_t uid)
+    {
+        auto it = userNames.find(uid);
+        if (it == userNames.end())
+        {
+            struct passwd *pw = getpwuid(uid);
+            it = userNames.emplace(uid, pw ? pw->pw_name : "").first;
+        }
+        return it->second;
+    }
+
+    const std::string &groupName(gid_t gid)
+    {
+        auto it = groupNames.find(gid);
+        if (it == groupNames.end())
+        {
+            struct group *gr = getgrgid(gid);
+            it = groupNames.emplace(gid, gr ? gr->gr_name : "").first;
+        }
+        return it->second;
+    }
+
+    void writeLongName(Sink &sink, char type, const std::string &value)
+    {
+        TarHeader header{};
+        strcpy(header.name, "././@LongLink");
+        putNumber(header.mode, sizeof(header.mode), 0);
+        putNumber(header.uid, sizeof(header.uid), 0);
+        putNumber(header.gid, sizeof(header.gid), 0);
+        putNumber(header.size, sizeof(header.size), value.size() + 1);
+        putNumber(header.mtime, sizeof(header.mtime), 0);
+        header.typeflag = type;
+        memcpy(header.magic, "ustar ", 6);
+        memcpy(header.version, " ", 2);
+        snprintf(header.chksum, sizeof(header.chksum), "%06o", headerChecksum(header));
+        header.chksum[7] = ' ';
+        sink.emit(reinterpret_cast<const char *>(&header), sizeof(header));
+        sink.emit(value.c_str(), value.size() + 1);
+        sink.pad(value.size() + 1);
+    }
+
+    void writeHeader(Sink &sink, const Entry &entry)
+    {
+        TarHeader header{};
+        const std::string &name = entry.name;
+        bool longName = false;
+        if (name.size() <= sizeof(header.name))
+        {
+            memcpy(header.name, name.data(), name.size());
+        }
+        else
+        {
+            size_t split = name.rfind('/', std::min(name.size() - 2, sizeof(header.prefix)));
+            while (split != std::string::npos && split > 0 && name.size() - split - 1 > sizeof(header.name))
+                split = name.rfind('/', split - 1);
+            if (split != std::string::npos && split > 0 && name.size() - split - 1 <= sizeof(header.name))
+            {
+                memcpy(header.prefix, name.data(), split);
+                memcpy(header.name, name.data() + split + 1, name.size() - split - 1);
+            }
+            else
+            {
+                longName = true;
+                memcpy(header.name, name.data(), sizeof(header.name));
+            }
+        }
+        if (entry.linkname.size() > sizeof(header.linkname))
+            writeLongName(sink, 'K', entry.linkname);
+        if (longName)
+            writeLongName(sink, 'L', name);
+        memcpy(header.linkname, entry.linkname.data(), std::min(entry.linkname.size(), sizeof(header.linkname)));
+        putNumber(header.mode, sizeof(header.mode), entry.mode & 07777);
+        putNumber(header.uid, sizeof(header.uid), entry.uid);
+        putNumber(header.gid, sizeof(header.gid), entry.gid);
+        putNumber(header.size, sizeof(header.size), entry.size);
+        putNumber(header.mtime, sizeof(header.mtime), entry.mtime);
+        header.typeflag = entry.type;
+        memcpy(header.magic, "ustar", 6);
+        memcpy(header.version, "00", 2);
+        strncpy(header.uname, userName(entry.uid).c_str(), sizeof(header.uname) - 1);
+        strncpy(header.gname, groupName(entry.gid).c_str(), sizeof(header.gname) - 1);
+        snprintf(header.chksum, sizeof(header.chksum), "%06o", headerChecksum(header));
+        header.chksum[7] = ' ';
+        sink.emit(reinterpret_cast<const char *>(&header), sizeof(header));
+    }
+
+    void addPath(Sink &sink, const std::string &path)
+    {
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0)
+        {
+            perror(path.c_str());
+            return;
+        }
+        Entry entry;
+        entry.name = path;
+        while (entry.name.size() > 1 && entry.name[0] == '/')
+            entry.name.erase(0, 1);
+        entry.mode = st.st_mode;
+        entry.uid = st.st_uid;
+        entry.gid = st.st_gid;
+        entry.mtime = st.st_mtime;
+        if (S_ISDIR(st.st_mode))
+        {
+            entry.type = '5';
+            if (entry.name.back() != '/')
+                entry.name += '/';
+            writeHeader(sink, entry);
+            DIR *dir = opendir(path.c_str());
+            if (!dir)
+            {
+                perror(path.c_str());
+                return;
+            }
+            std::vector<std::string> children;
+            while (struct dirent *ent = readdir(dir))
+            {
+                if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+                    children.push_back(ent->d_name);
+            }
+            closedir(dir);
+            std::sort(children.begin(), children.end());
+            std::string base = path.back() == '/' ? path : path + "/";
+            for (auto &child : children)
+                addPath(sink, base + child);
+        }
+        else if (S_ISLNK(st.st_mode))
+        {
+            std::vector<char> target(st.st_size > 0 ? st.st_size + 1 : PATH_MAX);
+            ssize_t n = readlink(path.c_str(), target.data(), target.size());
+            if (n < 0)
+            {
+                perror(path.c_str());
+                return;
+            }
+            entry.type = '2';
+            entry.linkname.assign(target.data(), n);
+            writeHeader(sink, entry);
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            int in = open(path.c_str(), O_RDONLY);
+            if (in < 0)
+            {
+                perror(path.c_str());
+                return;
+            }
+            posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+            entry.size = st.st_size;
+            writeHeader(sink, entry);
+            sink.emitFile(in, entry.size);
+            sink.pad(entry.size);
+            close(in);
+        }
+        else
+        {
+            std::cout << "Skipping special file: " << path << "\n";
+        }
+    }
+
+    bool readEntry(Source &source, Entry &entry)
+    {
+        std::string longName, longLink;
+        while (true)
+        {
+            TarHeader header;
+            if (!source.read(reinterpret_cast<char *>(&header), sizeof(header)))
+                return false;
+            const char *bytes = reinterpret_cast<const char *>(&header);
+            if (std::all_of(bytes, bytes + sizeof(header), [](char c) { return c == 0; }))
+                return false;
+            if (getNumber(header.chksum, sizeof(header.chksum)) != headerChecksum(header))
+            {
+                std::cout << "tar: invalid header checksum\n";
+                return false;
+            }
+            entry = Entry();
+            entry.type = header.typeflag ? header.typeflag : '0';
+            entry.size = getNumber(header.size, sizeof(header.size));
+            // Long names and pax records are read whole; GNU tar rejects
+            // ones this large too, and a crafted size must not exhaust memory.
+            if (strchr("LKxg", entry.type) && entry.size > maxMetadataSize)
+            {
+                std::cout << "tar: archive header too large\n";
+                return false;
+            }
+            if (entry.type == 'L' || entry.type == 'K')
+            {
+                std::string value(entry.size, '\0');
+                if (!source.read(&value[0], value.size()) || !source.skip((512 - entry.size % 512) % 512))
+                    return false;
+                value.resize(strnlen(value.c_str(), value.size()));
+                (entry.type == 'L' ? longName : longLink) = value;
+                continue;
+            }
+            if (entry.type == 'x' || entry.type == 'g')
+            {
+                std::string records(entry.size, '\0');
+                if (!source.read(&records[0], records.size()) || !source.skip((512 - entry.size % 512) % 512))
+                    return false;
+                size_t pos = 0;
+                while (entry.type == 'x' && pos < records.size())
+                {
+                    size_t space = records.find(' ', pos);
+                    size_t length = strtoull(records.c_str() + pos, nullptr, 10);
+                    if (space == std::string::npos || length == 0 || pos + length > records.size())
+                        break;
+                    std::string record = records.substr(space + 1, pos + length - space - 2);
+                    if (record.compare(0, 5, "path=") == 0)
+                        longName = record.substr(5);
+                    else if (record.compare(0, 9, "linkpath=") == 0)
+                        longLink = record.substr(9);
+                    pos += length;
+                }
+                continue;
+            }
+            entry.name = getString(header.name, sizeof(header.name));
+            if (header.prefix[0] && memcmp(header.magic, "ustar", 6) == 0)
+                entry.name = getString(header.prefix, sizeof(header.prefix)) + "/" + entry.name;
+            if (!longName.empty())
+                entry.name = longName;
+            entry.linkname = longLink.empty() ? getString(header.linkname, sizeof(header.linkname)) : longLink;
+            entry.mode = getNumber(header.mode, sizeof(header.mode));
+            entry.uid = getNumber(header.uid, sizeof(header.uid));
+            entry.gid = getNumber(header.gid, sizeof(header.gid));
+            entry.mtime = getNumber(header.mtime, sizeof(header.mtime));
+            if (entry.type == '5' || entry.type == '2' || entry.type == '1')
+                entry.size = 0;
+            return true;
+        }
+    }
+
+    static const uint64_t maxMetadataSize = 1 << 20;
+
+    static bool safePath(std::string &name)
+    {
+        while (!name.empty() && name[0] == '/')
+            name.erase(0, 1);
+        std::istringstream parts(name);
+        std::string part;
+        while (getline(parts, part, '/'))
+        {
+            if (part == "..")
+                return false;
+        }
+        return !name.empty();
+    }
+
+    // Symlink targets are resolved against the link's own directory and
+    // must stay inside the extraction root.
+    static bool safeLink(const std::string &name, const std::string &target)
+    {
+        if (target.empty() || target[0] == '/')
+            return false;
+        int depth = -1;
+        std::string part;
+        std::istringstream nameParts(name);
+        while (getline(nameParts, part, '/'))
+        {
+            if (!part.empty() && part != ".")
+                ++depth;
+        }
+        std::istringstream targetParts(target);
+        while (getline(targetParts, part, '/'))
+        {
+            if (part == ".." && --depth < 0)
+                return false;
+            if (part != ".." && !part.empty() && part != ".")
+                ++depth;
+        }
+        return true;
+    }
+
+    // Opens the directory that holds name, creating missing parents on the
+    // way. Every component is opened with O_NOFOLLOW, so a symlink planted by
+    // an earlier entry cannot redirect later ones outside the current directory.
+    static int openParent(const std::string &name, std::string &leaf)
+    {
+        int dirFd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        size_t start = 0;
+        for (size_t pos = name.find('/'); dirFd >= 0 && pos != std::string::npos; pos = name.find('/', start))
+        {
+            std::string part = name.substr(start, pos - start);
+            start = pos + 1;
+            if (part.empty() || part == ".")
+                continue;
+            mkdirat(dirFd, part.c_str(), 0777);
+            int next = openat(dirFd, part.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            close(dirFd);
+            dirFd = next;
+        }
+        leaf = name.substr(start);
+        return dirFd;
+    }
+
+    static int createFile(const std::string &name)
     {
-        return "Provides detailed system performance information. Usage: htop";
+        std::string leaf;
+        int dirFd = openParent(name, leaf);
+        if (dirFd < 0)
+            return -1;
+        int fd = openat(dirFd, leaf.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+        close(dirFd);
+        return fd;
     }
-};
 
-class VimCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    static bool selected(const std::string &name, const std::vector<std::string> &members)
     {
-        if (args.size() < 2)
+        if (members.empty())
+            return true;
+        for (auto &member : members)
         {
-            std::cout << "Usage: vim [file]\n";
-            return;
+            if (name == member || (name.compare(0, member.size(), member) == 0 &&
+                                   (name[member.size()] == '/' || member.back() == '/')))
+                return true;
         }
-        std::string command = "vim " + args[1];
-        system(command.c_str());
+        return false;
     }
-    std::string helpText() override
+
+    static void finishFile(int fd, const Entry &entry)
     {
-        return "Opens a file in Vim editor. Usage: vim [file]";
+        fchmod(fd, entry.mode & 07777);
+        if (geteuid() == 0)
+            fchown(fd, entry.uid, entry.gid);
+        struct timespec times[2] = {{entry.mtime, 0}, {entry.mtime, 0}};
+        futimens(fd, times);
     }
-};
 
-class SedCommand : public Command
-{
-public:
-    void execute(const std::vector<std::string> &args) override
+    void create(const std::string &archive, bool compress, const std::vector<std::string> &paths)
     {
-        if (args.size() < 3)
+        int fd = archive == "-" ? STDOUT_FILENO : open(archive.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
         {
-            std::cout << "Usage: sed [expression] [file]\n";
+            perror("tar");
             return;
         }
-        std::string command = "sed '" + args[1] + "' " + args[2];
-        system(command.c_str());
+        std::cout << std::flush;
+        std::unique_ptr<ParallelGzipWriter> gz;
+        Sink sink;
+        sink.fd = fd;
+        if (compress)
+        {
+            gz.reset(new ParallelGzipWriter(fd));
+            sink.gz = gz.get();
+        }
+        for (auto &path : paths)
+            addPath(sink, path);
+        static const char trailer[1024] = {};
+        sink.emit(trailer, sizeof(trailer));
+        if (gz && !gz->finish())
+            sink.ok = false;
+        if (!sink.ok)
+            perror("tar: write failed");
+        if (fd != STDOUT_FILENO)
+            close(fd);
     }
-    std::string helpText() override
+
+    void extract(const std::string &archive, bool list, const std::vector<std::string> &members)
     {
-        return "Performs text transformations. Usage: sed [expression] [file]";
+        Source source;
+        source.fd = archive == "-" ? STDIN_FILENO : open(archive.c_str(), O_RDONLY);
+        if (source.fd < 0)
+        {
+            perror("tar");
+            return;
+        }
+        struct stat st;
+        unsigned char magic[2] = {0, 0};
+        bool raw = fstat(source.fd, &st) == 0 && S_ISREG(st.st_mode) &&
+                   !(pread(source.fd, magic, 2, 0) == 2 && magic[0] == 0x1f && magic[1] == 0x8b);
+        if (!raw)
+        {
+            source.gz = gzdopen(dup(source.fd), "rb");
+            if (!source.gz)
+            {
+                std::cout << "tar: unable to read archive\n";
+                if (source.fd != STDIN_FILENO)
+                    close(source.fd);
+                return;
+            }
+            gzbuffer(source.gz, 1 << 17);
+        }
+
+        // Payloads are written to disk by a pool; the reader only walks
+        // headers (raw archives) or decompresses (gzip) on this thread.
+        ThreadPool pool;
+        std::atomic<uint64_t> buffered(0);
+        const uint64_t bufferLimit = 256ULL << 20;
+        const uint64_t streamThreshold = 16ULL << 20;
+        std::set<std::string> scheduled;
+        std::vector<Entry> directories;
+        Entry entry;
+        while (readEntry(source, entry))
+        {
+            uint64_t padded = (entry.size + 511) & ~511ULL;
+            std::string name = entry.name;
+            if (!selected(name, members))
+            {
+                if (!source.skip(padded))
+                    break;
+                continue;
+            }
+            if (list)
+            {
+                std::cout << entry.name << (entry.type == '2' ? " -> " + entry.linkname : "") << "\n";
+                if (!source.skip(padded))
+                    break;
+                continue;
+            }
+            if (!safePath(name))
+            {
+                std::cout << "tar: skipping unsafe path " << entry.name << "\n";
+                if (!source.skip(padded))
+                    break;
+                continue;
+            }
+            while (name.size() > 1 && name.back() == '/')
+                name.pop_back();
+            std::string linkname = entry.linkname;
+            if ((entry.type == '2' && !safeLink(name, linkname)) || (entry.type == '1' && !safePath(linkname)))
+            {
+                std::cout << "tar: skipping unsafe link " << entry.name << " -> " << entry.linkname << "\n";
+                if (!source.skip(padded))
+                    break;
+                continue;
+            }
+            if (scheduled.count(name) || (entry.type == '1' && scheduled.count(linkname)))
+            {
+                pool.wait();
+                scheduled.clear();
+            }
+            std::string leaf;
+            int dirFd = openParent(name, leaf);
+            if (dirFd < 0)
+            {
+                perror(name.c_str());
+                if (!source.skip(padded))
+                    break;
+                continue;
+            }
+            if (entry.type == '5')
+            {
+                mkdirat(dirFd, leaf.c_str(), 0700);
+                entry.name = name;
+                directories.push_back(entry);
+            }
+            else if (entry.type == '2' || entry.type == '1')
+            {
+                unlinkat(dirFd, leaf.c_str(), 0);
+                int rc = -1;
+                if (entry.type == '2')
+                {
+                    rc = symlinkat(linkname.c_str(), dirFd, leaf.c_str());
+                }
+                else
+                {
+                    std::string targetLeaf;
+                    int targetFd = openParent(linkname, targetLeaf);
+                    if (targetFd >= 0)
+                    {
+                        rc = linkat(targetFd, targetLeaf.c_str(), dirFd, leaf.c_str(), 0);
+                        close(targetFd);
+                    }
+                }
+                if (rc != 0)
+                    perror(name.c_str());
+            }
+            close(dirFd);
+            if (entry.type == '0' || entry.type == '7')
+            {
+                scheduled.insert(name);
+                if (!source.gz)
+                {
+                    off_t offset = source.offset;
+                    int archiveFd = source.fd;
+                    pool.submit([name, entry, offset, archiveFd] {
+                        int out = createFile(name);
+                        if (out < 0)
+                        {
+                            perror(name.c_str());
+                            return;
+                        }
+                        off_t in = offset;
+                        uint64_t remaining = entry.size;
+                        while (remaining > 0)
+                        {
+                            ssize_t n = copy_file_range(archiveFd, &in, out, nullptr, remaining, 0);
+                            if (n <= 0)
+                                break;
+                            remaining -= n;
+                        }
+                        std::vector<char> buffer(1 << 16);
+                        while (remaining > 0)
+                        {
+                            ssize_t n = pread(archiveFd, buffer.data(), std::min<uint64_t>(remaining, buffer.size()), in);
+                            if (n <= 0 || !writeAll(out, buffer.data(), n))
+                                break;
+                            in += n;
+                            remaining -= n;
+                        }
+                        finishFile(out, entry);
+                        close(out);
+                    });
+                    source.offset += padded;
+                    continue;
+                }
+                if (entry.size > streamThreshold)
+                {
+                    // Too big to buffer: decompress straight to disk here.
+                    int out = createFile(name);
+                    if (out < 0)
+                        perror(name.c_str());
+                    std::vector<char> buffer(1 << 20);
+                    uint64_t remaining = entry.size;
+                    bool complete = true;
+                    while (remaining > 0)
+                    {
+                        size_t n = std::min<uint64_t>(remaining, buffer.size());
+                        if (!source.read(buffer.data(), n))
+                        {
+                            complete = false;
+                            break;
+                        }
+                        if (out >= 0 && !writeAll(out, buffer.data(), n))
+                        {
+                            perror(name.c_str());
+                            close(out);
+                            out = -1;
+                        }
+                        remaining -= n;
+                    }
+                    if (out >= 0)
+                    {
+                        finishFile(out, entry);
+                        close(out);
+                    }
+                    if (!complete || !source.skip(padded - entry.size))
+                    {
+                        std::cout << "tar: unexpected end of archive\n";
+                        break;
+                    }
+                    continue;
+                }
+                auto data = std::make_shared<std::string>(entry.size, '\0');
+                if (!source.read(&(*data)[0], data->size()) || !source.skip(padded - entry.size))
+                {
+                    std::cout << "tar: unexpected end of archive\n";
+                    break;
+                }
+                if (buffered + data->size() > bufferLimit)
+                    pool.wait();
+                buffered += data->size();
+                pool.submit([name, entry, data, &buffered] {
+                    int out = createFile(name);
+                    if (out < 0 || !writeAll(out, data->data(), data->size()))
+                        perror(name.c_str());
+                    if (out >= 0)
+                    {
+                        finishFile(out, entry);
+                        close(out);
+                    }
+                    buffered -= data->size();
+                });
+                continue;
+            }
+            if (!source.skip(padded))
+                break;
+        }
+        pool.wait();
+        // Directory metadata last, so extracting into them does not bump the mtime.
+        for (auto it = directories.rbegin(); it != directories.rend(); ++it)
+        {
+            std::string leaf;
+            int dirFd = openParent(it->name, leaf);
+            int fd = dirFd < 0 ? -1 : openat(dirFd, leaf.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd >= 0)
+            {
+                fchmod(fd, it->mode & 07777);
+                struct timespec times[2] = {{it->mtime, 0}, {it->mtime, 0}};
+                futimens(fd, times);
+                close(fd);
+            }
+            if (dirFd >= 0)
+                close(dirFd);
+        }
+        if (source.gz)
+            gzclose(source.gz);
+        if (source.fd != STDIN_FILENO)
+            close(source.fd);
     }
-};
 
-class TarCommand : public Command
-{
 public:
     void execute(const std::vector<std::string> &args) override
     {
-        if (args.size() < 4)
+        if (args.size() < 3 || args[1].empty() || std::string("cxt").find(args[1][0]) == std::string::npos ||
+            (args[1][0] == 'c' && args.size() < 4))
         {
-            std::cout << "Usage: tar [c|x] [tarfile] [files...]\n";
+            std::cout << "Usage: tar [c|x|t][z] [tarfile] [files...]\n";
             return;
         }
-        std::string mode = (args[1] == "c" ? "-cf " : "-xf ");
-        std::string command = "tar " + mode + args[2] + " ";
-        for (int i = 3; i < args.size(); i++)
-        {
-            command += args[i] + " ";
-        }
-        system(command.c_str());
+        bool compress = args[1].find('z') != std::string::npos;
+        std::vector<std::string> paths(args.begin() + 3, args.end());
+        if (args[1][0] == 'c')
+            create(args[2], compress, paths);
+        else
+            extract(args[2], args[1][0] == 't', paths);
     }
     std::string helpText() override
     {
-        return "Manages archives for backup and restoration. Usage: tar [c|x] [tarfile] [files...]";
+        return "Manages archives for backup and restoration. Usage: tar [c|x|t][z] [tarfile] [files...]";
     }
 };
 
@@ -1418,7 +9891,7 @@ public:
             std::cout << "Usage: login [username]\n";
             return;
         }
-        std::string command = "login " + args[1];
+        std::string command = "login " + shellQuote(args[1]);
         system(command.c_str());
     }
     std::string helpText() override
@@ -1437,7 +9910,7 @@ public:
             std::cout << "Usage: service [service_name] [start|stop|restart]\n";
             return;
         }
-        std::string command = "service " + args[1] + " " + args[2];
+        std::string command = "service " + shellQuote(args[1]) + " " + shellQuote(args[2]);
         system(command.c_str());
     }
     std::string helpText() override
@@ -1456,7 +9929,7 @@ public:
         {
             path = args[1];
         }
-        std::string command = "du -sh " + path;
+        std::string command = "du -sh " + shellQuote(path);
         system(command.c_str());
     }
     std::string helpText() override
@@ -1470,12 +9943,12 @@ class MysqlCommand : public Command
 public:
     void execute(const std::vector<std::string> &args) override
     {
-        std::string command = "mysql -u user -p -e '";
+        std::string sql;
         for (int i = 1; i < args.size(); i++)
         {
-            command += args[i] + " ";
+            sql += args[i] + " ";
         }
-        command += "'";
+        std::string command = "mysql -u user -p -e " + shellQuote(sql);
         system(command.c_str());
     }
     std::string helpText() override
@@ -1492,7 +9965,7 @@ public:
         std::string command = "crontab ";
         if (args.size() > 1)
         {
-            command += args[1];
+            command += shellQuote(args[1]);
         }
         system(command.c_str());
     }
@@ -1510,7 +9983,7 @@ public:
         std::string command = "inotifywait -m ";
         if (args.size() > 1)
         {
-            command += args[1];
+            command += shellQuote(args[1]);
         }
         system(command.c_str());
     }
@@ -1530,7 +10003,7 @@ public:
             std::cout << "Usage: play [audio file]\n";
             return;
         }
-        std::string command = "ffplay -autoexit " + args[1]; // Assumes ffplay is installed
+        std::string command = "ffplay -autoexit " + shellQuote(args[1]); // Assumes ffplay is installed
         system(command.c_str());
     }
     std::string helpText() override
@@ -1547,7 +10020,7 @@ public:
         std::string command = "";
         for (int i = 1; i < args.size(); i++)
         {
-            command += args[i] + " ";
+            command += shellQuote(args[i]) + " ";
         }
         system(command.c_str());
     }
@@ -1571,7 +10044,7 @@ public:
         std::string command;
         for (size_t i = 2; i < args.size(); ++i)
         {
-            command += args[i] + " ";
+            command += shellQuote(args[i]) + " ";
         }
         while (true)
         {
@@ -1595,7 +10068,7 @@ public:
         std::string command = "screen";
         for (size_t i = 1; i < args.size(); ++i)
         {
-            command += " " + args[i];
+            command += " " + shellQuote(args[i]);
         }
         system(command.c_str());
     }
@@ -1613,7 +10086,7 @@ public:
         std::string command = "iptables";
         for (size_t i = 1; i < args.size(); ++i)
         {
-            command += " " + args[i];
+            command += " " + shellQuote(args[i]);
         }
         system(command.c_str());
     }
@@ -1625,6 +10098,220 @@ public:
 
 class SSHCommand : public Command
 {
+private:
+    struct Job
+    {
+        std::string host;
+        pid_t pid = -1;
+        int fds[2] = {-1, -1}; // stdout, stderr
+        std::string partial[2];
+        std::string captured[2];
+        int status = -1;
+        uint64_t start = 0, micros = 0;
+    };
+
+    static uint64_t nowMicros()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+    }
+
+    // Shared by every connection so the first session to a host becomes the
+    // ControlMaster and later ones (and later runs, for ControlPersist) reuse it.
+    // The ControlMaster sockets live here, so a directory someone else
+    // created in /tmp first must not be trusted. Empty when unusable.
+    static std::string controlDirectory()
+    {
+        std::string dir = "/tmp/dsh-ssh-" + std::to_string(getuid());
+        if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+        {
+            perror(dir.c_str());
+            return "";
+        }
+        struct stat st;
+        if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() ||
+            (st.st_mode & 0777) != 0700)
+        {
+            std::cerr << "ssh: " << dir << " must be a directory owned by you with mode 0700\n";
+            return "";
+        }
+        return dir;
+    }
+
+    static bool spawn(Job &job, const std::vector<std::string> &options, const std::string &command)
+    {
+        std::vector<std::string> argv = options;
+        // A host read from a file must not be taken for an ssh option.
+        argv.push_back("--");
+        argv.push_back(job.host);
+        argv.push_back(command);
+        std::vector<char *> pointers;
+        for (auto &arg : argv)
+            pointers.push_back(const_cast<char *>(arg.c_str()));
+        pointers.push_back(nullptr);
+
+        int out[2], err[2];
+        if (pipe2(out, O_CLOEXEC) != 0)
+            return false;
+        if (pipe2(err, O_CLOEXEC) != 0)
+        {
+            close(out[0]);
+            close(out[1]);
+            return false;
+        }
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+        job.start = nowMicros();
+        int error = posix_spawnp(&job.pid, "ssh", &actions, nullptr, pointers.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(out[1]);
+        close(err[1]);
+        if (error != 0)
+        {
+            close(out[0]);
+            close(err[0]);
+            errno = error;
+            return false;
+        }
+        job.fds[0] = out[0];
+        job.fds[1] = err[0];
+        return true;
+    }
+
+    // Emits the complete lines of `text` prefixed with the host name; the
+    // unterminated tail stays in `partial` until more arrives or EOF.
+    static void emitLines(const std::string &host, std::string &partial, bool toStderr)
+    {
+        size_t begin = 0, end;
+        std::string out;
+        while ((end = partial.find('\n', begin)) != std::string::npos)
+        {
+            out.append(host).append(": ").append(partial, begin, end - begin + 1);
+            begin = end + 1;
+        }
+        partial.erase(0, begin);
+        if (toStderr)
+            std::cerr << out;
+        else
+            std::cout << out;
+    }
+
+    void fanOut(const std::vector<std::string> &hosts, const std::string &command, int parallel, int timeout, bool json)
+    {
+        std::string controlDir = controlDirectory();
+        if (controlDir.empty())
+            return;
+        std::vector<std::string> options = {"ssh", "-o", "BatchMode=yes", "-o", "ControlMaster=auto",
+                                            "-o", "ControlPersist=60", "-o",
+                                            "ControlPath=" + controlDir + "/%C"};
+        if (timeout > 0)
+            options.insert(options.end(), {"-o", "ConnectTimeout=" + std::to_string(timeout)});
+        std::vector<Job> jobs(hosts.size());
+        size_t next = 0, running = 0;
+        std::vector<char> buffer(65536);
+        std::vector<struct pollfd> polls;
+        std::vector<std::pair<size_t, int>> owners;
+        while (next < jobs.size() || running > 0)
+        {
+            for (; next < jobs.size() && running < (size_t)parallel; ++next)
+            {
+                jobs[next].host = hosts[next];
+                if (spawn(jobs[next], options, command))
+                    ++running;
+                else
+                {
+                    perror("ssh");
+                    jobs[next].status = 127;
+                }
+            }
+            polls.clear();
+            owners.clear();
+            for (size_t j = 0; j < jobs.size(); ++j)
+            {
+                for (int stream = 0; stream < 2; ++stream)
+                {
+                    if (jobs[j].fds[stream] >= 0)
+                    {
+                        polls.push_back({jobs[j].fds[stream], POLLIN, 0});
+                        owners.emplace_back(j, stream);
+                    }
+                }
+            }
+            if (polls.empty())
+                break;
+            if (poll(polls.data(), polls.size(), -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                perror("poll");
+                break;
+            }
+            for (size_t p = 0; p < polls.size(); ++p)
+            {
+                if (!polls[p].revents)
+                    continue;
+                Job &job = jobs[owners[p].first];
+                int stream = owners[p].second;
+                ssize_t n = read(polls[p].fd, buffer.data(), buffer.size());
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n > 0)
+                {
+                    if (json)
+                        job.captured[stream].append(buffer.data(), n);
+                    else
+                    {
+                        job.partial[stream].append(buffer.data(), n);
+                        emitLines(job.host, job.partial[stream], stream == 1);
+                    }
+                    continue;
+                }
+                close(job.fds[stream]);
+                job.fds[stream] = -1;
+                if (!json && !job.partial[stream].empty())
+                {
+                    job.partial[stream] += '\n';
+                    emitLines(job.host, job.partial[stream], stream == 1);
+                }
+                if (job.fds[0] < 0 && job.fds[1] < 0)
+                {
+                    int status;
+                    while (waitpid(job.pid, &status, 0) < 0 && errno == EINTR)
+                        ;
+                    job.micros = nowMicros() - job.start;
+                    job.status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+                    --running;
+                }
+            }
+        }
+
+        Report report;
+        size_t failed = 0;
+        uint64_t slowest = 0;
+        for (auto &job : jobs)
+        {
+            report.row().text("host", "HOST", job.host).number("status", "STATUS", job.status);
+            report.number("ms", "TIME", job.micros / 1000.0, CommandStats::formatMicros(job.micros));
+            if (json)
+                report.text("stdout", "STDOUT", job.captured[0]).text("stderr", "STDERR", job.captured[1]);
+            failed += job.status != 0;
+            slowest = std::max(slowest, job.micros);
+        }
+        if (json)
+        {
+            report.printJson(false);
+            return;
+        }
+        std::cout << "\n";
+        report.printTable();
+        std::cout << jobs.size() << " hosts: " << jobs.size() - failed << " ok, " << failed << " failed, slowest "
+                  << CommandStats::formatMicros(slowest) << "\n";
+    }
+
 public:
     void execute(const std::vector<std::string> &args) override
     {
@@ -1633,22 +10320,143 @@ public:
             std::cout << "Usage: ssh [user@hostname]\n";
             return;
         }
-        std::string command = "ssh " + args[1];
-        for (size_t i = 2; i < args.size(); ++i)
+        if (args[1] != "-H" && args[1] != "-f")
         {
-            command += " " + args[i];
+            std::string command = "ssh " + shellQuote(args[1]);
+            for (size_t i = 2; i < args.size(); ++i)
+            {
+                command += " " + shellQuote(args[i]);
+            }
+            system(command.c_str());
+            return;
         }
-        system(command.c_str());
+
+        std::vector<std::string> rest(args.begin() + 1, args.end());
+        bool json = Report::wantsJson(rest);
+        std::vector<std::string> hosts;
+        int parallel = 32, timeout = 10;
+        size_t i = 0;
+        for (; i + 1 < rest.size() && rest[i][0] == '-'; i += 2)
+        {
+            if (rest[i] == "-H")
+            {
+                std::stringstream list(rest[i + 1]);
+                std::string host;
+                while (std::getline(list, host, ','))
+                {
+                    if (!host.empty())
+                        hosts.push_back(host);
+                }
+            }
+            else if (rest[i] == "-f")
+            {
+                std::ifstream file(rest[i + 1]);
+                if (!file)
+                {
+                    perror(rest[i + 1].c_str());
+                    return;
+                }
+                std::string line;
+                while (std::getline(file, line))
+                {
+                    std::istringstream words(line);
+                    std::string host;
+                    if (words >> host && host[0] != '#')
+                        hosts.push_back(host);
+                }
+            }
+            else if (rest[i] == "-P")
+                parallel = std::max(1, atoi(rest[i + 1].c_str()));
+            else if (rest[i] == "-t")
+                timeout = atoi(rest[i + 1].c_str());
+            else
+                break;
+        }
+        if (hosts.empty() || i >= rest.size())
+        {
+            std::cout << "Usage: ssh -H host1,host2 | -f hostfile [-P parallel] [-t connect_timeout] [--json] command\n";
+            return;
+        }
+        std::string command = rest[i];
+        for (++i; i < rest.size(); ++i)
+            command += " " + rest[i];
+        fanOut(hosts, command, parallel, timeout, json);
     }
     std::string helpText() override
     {
-        return "Connects to a host via SSH. Usage: ssh [user@hostname] [options]";
+        return "Connects to a host via SSH, or runs a command on many hosts in parallel over multiplexed "
+               "connections. Usage: ssh [user@hostname] [options] | ssh -H host1,host2 | -f hostfile "
+               "[-P parallel] [-t connect_timeout] [--json] command. -t only bounds connection setup (default "
+               "10s); a command that hangs once connected is not interrupted";
     }
 };
 
-int main()
+// Runs one already tokenized command line: a builtin or alias from the
+// registry, otherwise a program from PATH. Returns the exit status (builtins
+// report 0) and records timing and resource usage in CommandStats; the
+// usage is also copied to `usageOut` when given.
+int runCommand(CommandRegistry &registry, const std::vector<std::string> &tokens, struct rusage *usageOut,
+               std::string *output)
+{
+    struct timespec start, end;
+    struct rusage selfBefore, childrenBefore, selfAfter, childrenAfter, usage = {};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int status = 0;
+    bool external = false;
+    Command *cmd;
+    {
+        TraceSpan span("lookup", tokens[0]);
+        cmd = registry.getCommand(tokens[0]);
+    }
+    if (cmd)
+    {
+        getrusage(RUSAGE_SELF, &selfBefore);
+        getrusage(RUSAGE_CHILDREN, &childrenBefore);
+        {
+            TraceSpan span("builtin", tokens[0]);
+            if (output)
+            {
+                OutputCapture capture;
+                cmd->execute(tokens);
+                *output = capture.finish();
+            }
+            else
+                cmd->execute(tokens);
+        }
+        getrusage(RUSAGE_SELF, &selfAfter);
+        getrusage(RUSAGE_CHILDREN, &childrenAfter);
+        // Builtins that still shell out are charged for their children too.
+        CommandStats::accumulate(usage, selfBefore, selfAfter);
+        CommandStats::accumulate(usage, childrenBefore, childrenAfter);
+        usage.ru_maxrss = selfAfter.ru_maxrss;
+        if (childrenAfter.ru_maxrss > childrenBefore.ru_maxrss)
+            usage.ru_maxrss = std::max(usage.ru_maxrss, childrenAfter.ru_maxrss);
+    }
+    else
+    {
+        std::string path;
+        {
+            TraceSpan span("path lookup", tokens[0]);
+            path = PathCache::shared().resolve(tokens[0]);
+        }
+        if (path.empty())
+        {
+            std::cout << "Unknown command: " << tokens[0] << "\n";
+            return 127;
+        }
+        external = true;
+        status = runExternalCommand(path, tokens, &usage, output);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t wallMicros = (end.tv_sec - start.tv_sec) * 1000000ULL + (end.tv_nsec - start.tv_nsec) / 1000;
+    CommandStats::shared().record(tokens[0], external, status, wallMicros, usage);
+    if (usageOut)
+        *usageOut = usage;
+    return status;
+}
+
+void registerBuiltinCommands(CommandRegistry &registry)
 {
-    CommandRegistry registry;
     registry.registerCommand("help", new HelpCommand());
     registry.registerCommand("setenv", new SetEnvCommand());
     registry.registerCommand("ls", new ListFilesCommand());
@@ -1683,6 +10491,11 @@ int main()
     registry.registerCommand("wc", new WcCommand());
     registry.registerCommand("df", new DfCommand());
     registry.registerCommand("env", new EnvCommand());
+    registry.registerCommand("hash", new HashCommand());
+    registry.registerCommand("history", new HistoryCommand());
+    registry.registerCommand("prompt", new PromptCommand());
+    registry.registerCommand("stats", new StatsCommand());
+    registry.registerCommand("time", new TimeCommand(registry));
     registry.registerCommand("ln", new LnCommand());
     registry.registerCommand("chgrp", new ChgrpCommand());
     registry.registerCommand("uptime", new UptimeCommand());
@@ -1691,6 +10504,8 @@ int main()
     registry.registerCommand("traceroute", new TracerouteCommand());
     registry.registerCommand("gzip", new GzipCommand());
     registry.registerCommand("kill", new KillCommand());
+    registry.registerCommand("pkill", new PkillCommand(false));
+    registry.registerCommand("pgrep", new PkillCommand(true));
     registry.registerCommand("awk", new AwkCommand());
     registry.registerCommand("uname", new UnameCommand());
     registry.registerCommand("less", new LessCommand());
@@ -1712,6 +10527,7 @@ int main()
     registry.registerCommand("envlist", new EnvListCommand());
     registry.registerCommand("g++", new GppCommand());
     registry.registerCommand("encrypt", new EncryptCommand());
+    registry.registerCommand("decrypt", new DecryptCommand());
     registry.registerCommand("diff", new DiffCommand());
     registry.registerCommand("ifstat", new IfstatCommand());
     registry.registerCommand("htop", new HtopCommand());
@@ -1730,6 +10546,243 @@ int main()
     registry.registerCommand("screen", new ScreenCommand());
     registry.registerCommand("iptables", new IPTablesCommand());
     registry.registerCommand("ssh", new SSHCommand());
+}
+
+// `dsh --server` keeps a warm shell behind a Unix socket: the registry,
+// .dshrc, PATH cache and every other lazily built cache survive between
+// commands. A pool of pre-forked workers accept() on the same socket. A
+// client (`dsh -c 'line'`) sends its working directory and the command line
+// along with its stdin/stdout/stderr descriptors, so output streams straight
+// to the caller without being copied through the server, and gets the exit
+// status back (see dsh_client.cpp).
+class ShellServer
+{
+private:
+    static volatile sig_atomic_t stopping;
+    CommandRegistry &registry;
+    std::string path;
+    int workerCount;
+    int listenFd = -1;
+
+    static void onSignal(int)
+    {
+        stopping = 1;
+    }
+
+    // Runs one request on an accepted connection and replies with its status.
+    void serve(int connection, const std::vector<std::string> &environment, const int *savedFds)
+    {
+        struct ucred peer;
+        socklen_t peerLength = sizeof(peer);
+        if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &peer, &peerLength) != 0 || peer.uid != getuid())
+            return;
+        std::vector<char> payload(65536);
+        char control[CMSG_SPACE(3 * sizeof(int))];
+        struct iovec part = {payload.data(), payload.size()};
+        struct msghdr message = {};
+        message.msg_iov = &part;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        ssize_t n;
+        while ((n = recvmsg(connection, &message, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+            ;
+        struct cmsghdr *header = n > 0 ? CMSG_FIRSTHDR(&message) : nullptr;
+        if (!header || header->cmsg_type != SCM_RIGHTS || header->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+            return;
+        int fds[3];
+        memcpy(fds, CMSG_DATA(header), sizeof(fds));
+        // A cut-off command line must not run.
+        if (message.msg_flags & MSG_TRUNC)
+        {
+            std::string error = "dsh: command line longer than " + std::to_string(payload.size()) + " bytes\n";
+            writeAll(fds[2], error.data(), error.size());
+            for (int fd : fds)
+                close(fd);
+            int32_t status = 2;
+            send(connection, &status, sizeof(status), MSG_NOSIGNAL);
+            return;
+        }
+        std::string cwd(payload.data(), strnlen(payload.data(), n));
+        std::string line = cwd.size() < (size_t)n ? std::string(payload.data() + cwd.size() + 1, n - cwd.size() - 1) : "";
+
+        for (int i = 0; i < 3; ++i)
+        {
+            dup2(fds[i], i);
+            close(fds[i]);
+        }
+        OutputSink::shared().install();
+        int32_t status = 0;
+        if (chdir(cwd.c_str()) != 0)
+        {
+            perror(cwd.c_str());
+            status = 1;
+        }
+        else
+        {
+            TraceSpan span("command", line);
+            std::vector<std::string> tokens = Expander(0, &registry).expand(line);
+            if (!tokens.empty() && tokens[0] != "exit")
+                status = runCommand(registry, tokens);
+        }
+        std::cout.flush();
+        fflush(stdout);
+        for (int i = 0; i < 3; ++i)
+            dup2(savedFds[i], i);
+        // Builtins like setenv must not leak into the next client's command.
+        clearenv();
+        for (auto &entry : environment)
+        {
+            size_t eq = entry.find('=');
+            setenv(entry.substr(0, eq).c_str(), entry.substr(eq + 1).c_str(), 1);
+        }
+        send(connection, &status, sizeof(status), MSG_NOSIGNAL);
+    }
+
+    void worker()
+    {
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGPIPE, SIG_IGN);
+        std::vector<std::string> environment;
+        for (char **entry = environ; *entry; ++entry)
+            environment.push_back(*entry);
+        int savedFds[3];
+        for (int i = 0; i < 3; ++i)
+            savedFds[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+        while (true)
+        {
+            int connection = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (connection < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                perror("dsh: accept");
+                return;
+            }
+            serve(connection, environment, savedFds);
+            close(connection);
+        }
+    }
+
+    pid_t spawnWorker()
+    {
+        std::cout.flush();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            worker();
+            _exit(1);
+        }
+        if (pid < 0)
+            perror("dsh: fork");
+        return pid;
+    }
+
+public:
+    ShellServer(CommandRegistry &commands, const std::string &socketPath, int workers)
+        : registry(commands), path(socketPath), workerCount(workers > 0 ? workers : std::max(1L, sysconf(_SC_NPROCESSORS_ONLN)))
+    {
+    }
+
+    int run()
+    {
+        int existing = connectToServer(path);
+        if (existing >= 0)
+        {
+            close(existing);
+            std::cerr << "dsh: a server is already listening on " << path << "\n";
+            return 1;
+        }
+        struct sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+        {
+            std::cerr << "dsh: socket path too long: " << path << "\n";
+            return 1;
+        }
+        strcpy(address.sun_path, path.c_str());
+        unlink(path.c_str());
+        listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        mode_t mask = umask(0177);
+        bool bound = listenFd >= 0 && bind(listenFd, (struct sockaddr *)&address, sizeof(address)) == 0;
+        umask(mask);
+        if (!bound || listen(listenFd, SOMAXCONN) != 0)
+        {
+            perror(path.c_str());
+            return 1;
+        }
+
+        struct sigaction action = {};
+        action.sa_handler = onSignal;
+        sigaction(SIGTERM, &action, nullptr);
+        sigaction(SIGINT, &action, nullptr);
+        std::set<pid_t> workers;
+        for (int i = 0; i < workerCount; ++i)
+        {
+            pid_t pid = spawnWorker();
+            if (pid > 0)
+                workers.insert(pid);
+        }
+        std::cerr << "dsh: serving on " << path << " with " << workers.size() << " workers\n";
+        while (!stopping && !workers.empty())
+        {
+            pid_t pid = waitpid(-1, nullptr, 0);
+            if (pid < 0 || !workers.erase(pid) || stopping)
+                continue;
+            // A command crashed or exited its worker: replace it.
+            pid = spawnWorker();
+            if (pid > 0)
+                workers.insert(pid);
+        }
+        for (pid_t pid : workers)
+            kill(pid, SIGTERM);
+        for (pid_t pid : workers)
+            waitpid(pid, nullptr, 0);
+        close(listenFd);
+        unlink(path.c_str());
+        return 0;
+    }
+};
+
+volatile sig_atomic_t ShellServer::stopping = 0;
+
+int runShell(int argc, char **argv)
+{
+    useBufferedOutput();
+    bool server = false, hasCommand = false;
+    std::string socketPath, commandLine;
+    int workers = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--trace" && i + 1 < argc)
+            Tracer::start(argv[++i]);
+        else if (arg == "--server")
+            server = true;
+        else if (arg == "--socket" && i + 1 < argc)
+            socketPath = argv[++i];
+        else if (arg == "--workers" && i + 1 < argc)
+            workers = atoi(argv[++i]);
+        else if (arg == "-c" && i + 1 < argc)
+        {
+            hasCommand = true;
+            commandLine = argv[++i];
+        }
+        else
+        {
+            std::cerr << "Usage: dsh [--trace file.json] [--server [--workers n]] [--socket path] [-c command]\n";
+            return 2;
+        }
+    }
+    if (socketPath.empty())
+        socketPath = serverSocketPath();
+    int status;
+    if (hasCommand && !server && runOnServer(socketPath, commandLine, status))
+        return status;
+
+    CommandRegistry registry;
+    registerBuiltinCommands(registry);
 
     const char* homeDir = getenv("HOME");
     if (homeDir != nullptr) {
@@ -1737,45 +10790,76 @@ int main()
         loadDshrc(dshrcPath, registry);
     }
 
+    if (server)
+        return ShellServer(registry, socketPath, workers).run();
+    if (hasCommand)
+    {
+        std::vector<std::string> tokens = Expander(0, &registry).expand(commandLine);
+        status = tokens.empty() || tokens[0] == "exit" ? 0 : runCommand(registry, tokens);
+        std::cout.flush();
+        Tracer::finish();
+        return status;
+    }
+
 
     std::cout << "Welcome to DSH\n";
-    char *input, shell_prompt[100];
-    rl_bind_key('\t', rl_complete);
+    char *input;
+    CompletionEngine::shared().attach(registry);
+    const char *historyFile = getenv("DSH_HISTFILE");
+    if (historyFile || homeDir)
+        CommandHistory::shared().open(historyFile ? historyFile : std::string(homeDir) + "/.dsh_history");
 
+    int lastStatus = 0;
     while (true)
     {
-        snprintf(shell_prompt, sizeof(shell_prompt), "%s: ", getcwd(NULL, 0));
         std::cout << std::flush;
-        input = readline(shell_prompt);
+        std::string prompt;
+        {
+            TraceSpan span("prompt");
+            prompt = Prompt::shared().render();
+        }
+        input = readline(prompt.c_str());
         if (!input)
             break;
 
         if (input && *input)
             add_history(input);
 
+        std::string line(input);
+        free(input);
+        TraceSpan commandSpan("command", line);
         std::vector<std::string> tokens;
-        std::istringstream iss(input);
-        std::string token;
-        while (iss >> token)
         {
-            tokens.push_back(token);
+            TraceSpan span("expand");
+            tokens = Expander(lastStatus, &registry).expand(line);
         }
-        free(input);
 
         if (tokens.empty())
             continue;
+        struct timespec wallStart, start, end;
+        clock_gettime(CLOCK_REALTIME, &wallStart);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int64_t startMs = wallStart.tv_sec * 1000LL + wallStart.tv_nsec / 1000000;
         if (tokens[0] == "exit")
-            break;
-
-        Command *cmd = registry.getCommand(tokens[0]);
-        if (cmd)
         {
-            cmd->execute(tokens);
+            CommandHistory::shared().record(line, startMs, 0, 0);
+            break;
         }
-        else
+
+        int status = runCommand(registry, tokens);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        uint32_t durationMs = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
         {
-            std::cout << "Unknown command: " << tokens[0] << "\n";
+            TraceSpan span("history");
+            CommandHistory::shared().record(line, startMs, durationMs, status);
         }
-    }
+        Prompt::shared().commandFinished(status, durationMs);
+        lastStatus = status;
+    }
+    const char *statsFile = getenv("DSH_STATS_FILE");
+    if (statsFile && !CommandStats::shared().dump(statsFile))
+        perror(statsFile);
+    if (!Tracer::finish())
+        perror("dsh: trace");
     return 0;
 }
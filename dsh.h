@@ -0,0 +1,100 @@
+#ifndef DSH_H
+#define DSH_H
+
+#include <sys/resource.h>
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+class Command
+{
+public:
+    virtual ~Command() = default;
+    virtual void execute(const std::vector<std::string> &args) = 0;
+    virtual std::string helpText() = 0;
+};
+
+class CommandRegistry
+{
+private:
+    std::map<std::string, Command *> commands;
+    std::map<std::string, std::string> aliases;
+
+public:
+    ~CommandRegistry()
+    {
+        for (auto cmd : commands)
+        {
+            delete cmd.second;
+        }
+    }
+    void registerCommand(const std::string &commandName, Command *command)
+    {
+        commands[commandName] = command;
+    }
+    Command *getCommand(const std::string &commandName)
+    {
+        if (aliases.count(commandName)) {
+            return commands[aliases[commandName]];
+        }
+        auto it = commands.find(commandName);
+        if (it != commands.end())
+        {
+            return it->second;
+        }
+        return nullptr;
+    }
+    void listCommands()
+    {
+        std::cout << "Available commands:\n";
+        for (auto &command : commands)
+        {
+            std::cout << command.first << " - " << command.second->helpText() << "\n";
+        }
+    }
+    void registerAlias(const std::string& aliasName, const std::string& commandName) {
+        aliases[aliasName] = commandName;
+    }
+    std::vector<std::string> names() const
+    {
+        std::vector<std::string> out;
+        for (auto &command : commands)
+            out.push_back(command.first);
+        for (auto &alias : aliases)
+            out.push_back(alias.first);
+        return out;
+    }
+};
+
+// Registers every builtin command and its name with the registry.
+void registerBuiltinCommands(CommandRegistry &registry);
+
+// Runs one tokenized command line (builtin, alias or PATH program) and
+// returns its exit status; `usage` receives what it cost. With `output` the
+// command's standard output is collected there instead of being written.
+int runCommand(CommandRegistry &registry, const std::vector<std::string> &tokens, struct rusage *usage = nullptr,
+               std::string *output = nullptr);
+
+// Routes std::cout through dsh's large, tty-aware output buffer instead of
+// the stdio-synchronised default. Done by runShell before anything is printed.
+void useBufferedOutput();
+
+// Where `dsh --server` listens: $DSH_SOCKET, else $XDG_RUNTIME_DIR/dsh.sock,
+// else /tmp/dsh-<uid>.sock.
+std::string serverSocketPath();
+
+// Connects to a server socket; -1 when nothing is listening there or the
+// server runs as another user.
+int connectToServer(const std::string &socketPath);
+
+// Runs `line` on the server with this process's stdin/stdout/stderr and
+// stores its exit status. Returns false when no server is listening.
+bool runOnServer(const std::string &socketPath, const std::string &line, int &status);
+
+// The interactive shell: parses dsh's own options, loads ~/.dshrc and runs
+// the read-eval loop until exit or end of input.
+int runShell(int argc, char **argv);
+
+#endif
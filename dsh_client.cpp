@@ -0,0 +1,91 @@
+// Client side of `dsh --server`, kept apart from the builtins so the thin
+// dshc binary links nothing but this file.
+#include "dsh.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+
+std::string serverSocketPath()
+{
+    const char *configured = getenv("DSH_SOCKET");
+    if (configured && *configured)
+        return configured;
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime)
+        return std::string(runtime) + "/dsh.sock";
+    return "/tmp/dsh-" + std::to_string(getuid()) + ".sock";
+}
+
+int connectToServer(const std::string &socketPath)
+{
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+        return -1;
+    strcpy(address.sun_path, socketPath.c_str());
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    // Anyone can bind a name in /tmp first; only hand our fds and command
+    // lines to a server running as us.
+    struct ucred peer;
+    socklen_t peerLength = sizeof(peer);
+    if (fd >= 0 && (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peerLength) != 0 || peer.uid != getuid()))
+    {
+        std::cerr << "dsh: ignoring " << socketPath << ": server is not running as this user\n";
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+bool runOnServer(const std::string &socketPath, const std::string &line, int &status)
+{
+    int fd = connectToServer(socketPath);
+    if (fd < 0)
+        return false;
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)))
+        strcpy(cwd, "/");
+    std::string payload = std::string(cwd) + '\0' + line;
+
+    // One datagram carries the request and our stdin/stdout/stderr.
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    struct iovec part = {const_cast<char *>(payload.data()), payload.size()};
+    char control[CMSG_SPACE(sizeof(fds))] = {};
+    struct msghdr message = {};
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+    ssize_t n;
+    while ((n = sendmsg(fd, &message, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+        ;
+    int32_t reply = 0;
+    if (n >= 0)
+    {
+        while ((n = recv(fd, &reply, sizeof(reply), 0)) < 0 && errno == EINTR)
+            ;
+    }
+    close(fd);
+    if (n != sizeof(reply))
+    {
+        std::cerr << "dsh: lost connection to server " << socketPath << "\n";
+        reply = 255;
+    }
+    status = reply;
+    return true;
+}
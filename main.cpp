@@ -0,0 +1,6 @@
+#include "dsh.h"
+
+int main(int argc, char **argv)
+{
+    return runShell(argc, argv);
+}